@@ -0,0 +1,29 @@
+#!/bin/bash
+# Compares the two dispatch loops of the bytecode VM (--stackless mode):
+# computed goto against the portable switch, both built with optimizations.
+# usage: ./benchmark_dispatch.sh [runs]
+
+runs=${1:-5}
+# each script runs for seconds, so that the gap isn't lost in start up.
+scripts="samples/fib.lox samples/methods.lox"
+
+for dispatch in ON OFF; do
+    cmake -S . -B build/dispatch-$dispatch -DCMAKE_BUILD_TYPE=Release \
+          -DLOX_COMPUTED_GOTO=$dispatch > /dev/null 2>&1 || exit 1
+    cmake --build build/dispatch-$dispatch -j"$(nproc)" > /dev/null 2>&1 || exit 1
+done
+
+for script in $scripts; do
+    for dispatch in ON OFF; do
+        best=""
+        for ((i = 0; i < runs; i++)); do
+            start=$(date +%s.%N)
+            ./build/dispatch-$dispatch/interpreter --stackless $script > /dev/null
+            end=$(date +%s.%N)
+            best=$(awk -v s=$start -v e=$end -v b="$best" \
+                   'BEGIN { t = e - s; print (b == "" || t < b) ? t : b }')
+        done
+        [[ $dispatch == ON ]] && name="computed goto" || name="switch"
+        printf "%-28s %-14s best of %d: %.3fs\n" $script "$name" $runs $best
+    done
+done
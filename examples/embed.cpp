@@ -0,0 +1,111 @@
+// Embeds Lox through lox::Context and measures what a call from the host
+// costs on each engine:
+//   embed [calls] [threads]
+// With several threads, each runs the same measurements on a context of
+// its own, all at once.
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "context.hpp"
+
+using namespace lox;
+using Clock = std::chrono::steady_clock;
+
+static const char* const script = R"(
+fun noop() {}
+fun add(a, b) { return a + b; }
+class Vector {
+  init(x, y) {
+    this.x = x;
+    this.y = y;
+  }
+  dot(other) { return this.x * other.x + this.y * other.y; }
+}
+var v = Vector(3, 4);
+print v.dot(v);
+)";
+
+struct Result {
+    // nanoseconds per call.
+    double noop, add, byName, method;
+    bool ok;
+};
+
+template <class F>
+static double perCall(size_t calls, F call) {
+    auto start = Clock::now();
+    for (size_t i = 0; i < calls; i++) call(i);
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / calls;
+}
+
+static Result measure(Engine engine, size_t calls) {
+    // the script's output isn't wanted.
+    std::ostringstream out;
+    Options options;
+    options.engine = engine;
+    options.out = &out;
+    Context context{options};
+    Result result {};
+    if (context.run(script) != Context::Status::Ok) return result;
+
+    // looked up once, then called like any value.
+    LoxObject noop = context.get("noop");
+    LoxObject add = context.get("add");
+    LoxObject dot = context.get("v").get(Token(IDENTIFIER, "dot", 0));
+    LoxObject v = context.get("v");
+
+    double sum = 0;
+    result.noop = perCall(calls, [&](size_t) { context.call(noop, {}); });
+    result.add = perCall(calls, [&](size_t i) {
+        sum += static_cast<double>(context.call(add, {LoxObject(double(i)), LoxObject(1.0)}));
+    });
+    result.byName = perCall(calls, [&](size_t i) {
+        sum -= static_cast<double>(context.call("add", {LoxObject(double(i)), LoxObject(1.0)}));
+    });
+    result.method = perCall(calls, [&](size_t) {
+        sum += static_cast<double>(context.call(dot, {v}));
+    });
+    result.ok = sum == 25.0 * calls;
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    size_t calls = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t threads = argc > 2 ? std::stoul(argv[2]) : 1;
+    const struct { Engine engine; const char* name; } engines[] = {
+        {Engine::TreeWalker, "tree walker"}, {Engine::Stackless, "stackless"},
+        {Engine::Registers, "registers"}, {Engine::Tiered, "tiered"},
+    };
+
+    std::printf("%zu calls per measure, %zu thread(s), ns per call\n", calls, threads);
+    std::printf("%-12s %8s %8s %8s %8s\n", "engine", "noop", "add", "by name", "method");
+    bool ok = true;
+    for (auto& [engine, name] : engines) {
+        std::vector<Result> results(threads);
+        std::vector<std::thread> running;
+        auto start = Clock::now();
+        for (size_t t = 0; t < threads; t++) {
+            running.emplace_back([&, t, engine = engine] { results[t] = measure(engine, calls); });
+        }
+        for (auto& thread : running) thread.join();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        Result mean {};
+        for (auto& result : results) {
+            mean.noop += result.noop / threads;
+            mean.add += result.add / threads;
+            mean.byName += result.byName / threads;
+            mean.method += result.method / threads;
+            ok = ok && result.ok;
+        }
+        std::printf("%-12s %8.0f %8.0f %8.0f %8.0f", name, mean.noop, mean.add, mean.byName, mean.method);
+        if (threads > 1) std::printf("   %.1f M calls/s in all", 4.0 * calls * threads / seconds / 1e6);
+        std::printf("\n");
+    }
+    if (!ok) std::fprintf(stderr, "wrong results\n");
+    return ok ? 0 : 1;
+}
@@ -25,6 +25,14 @@ class ASTprinter: public ExprVisitor {
             return LoxObject();
         }
 
+        LoxObject visitInlinedExpr(Inlined& expr) override {
+            return expr.original->accept(*this);
+        }
+
+        LoxObject visitHoistedExpr(Hoisted& expr) override {
+            return expr.expression->accept(*this);
+        }
+
         LoxObject visitLiteralExpr(Literal& expr) override {
             ast_string += (std::string)expr.value;
             return LoxObject(); 
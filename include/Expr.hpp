@@ -12,12 +12,15 @@
 
 namespace lox { 
 
+class Function;
 class Assign;
 class Binary;
 class Call;
 class CommaExpr;
 class Get;
 class Grouping;
+class Hoisted;
+class Inlined;
 class Literal;
 class Logical;
 class Set;
@@ -35,6 +38,8 @@ class ExprVisitor {
 		virtual LoxObject visitCommaExprExpr( CommaExpr& expr) = 0;
 		virtual LoxObject visitGetExpr( Get& expr) = 0;
 		virtual LoxObject visitGroupingExpr( Grouping& expr) = 0;
+		virtual LoxObject visitHoistedExpr( Hoisted& expr) = 0;
+		virtual LoxObject visitInlinedExpr( Inlined& expr) = 0;
 		virtual LoxObject visitLiteralExpr( Literal& expr) = 0;
 		virtual LoxObject visitLogicalExpr( Logical& expr) = 0;
 		virtual LoxObject visitSetExpr( Set& expr) = 0;
@@ -64,6 +69,10 @@ class Assign: public Expr {
 		}
 		Token name;
 		std::unique_ptr<Expr> value;
+		// resolver annotations
+		int slot = -1;
+		int upvalue = -1;
+		int global = -1;
 };
 
 class Binary: public Expr {
@@ -131,6 +140,35 @@ class Grouping: public Expr {
 		std::unique_ptr<Expr> expression;
 };
 
+class Hoisted: public Expr {
+	public:
+		Hoisted(std::unique_ptr<Expr>&& expression_) {
+			expression = std::move (expression_);
+		}
+		LoxObject accept(ExprVisitor& visitor) override {
+			return visitor.visitHoistedExpr(*this);
+		}
+		std::unique_ptr<Expr> expression;
+		// resolver annotations
+		int slot = -1;
+};
+
+class Inlined: public Expr {
+	public:
+		Inlined(std::unique_ptr<Expr>&& original_, std::unique_ptr<Expr>&& body_) {
+			original = std::move (original_);
+			body = std::move (body_);
+		}
+		LoxObject accept(ExprVisitor& visitor) override {
+			return visitor.visitInlinedExpr(*this);
+		}
+		std::unique_ptr<Expr> original;
+		std::unique_ptr<Expr> body;
+		// resolver annotations
+		Function* function = nullptr;
+		int firstSlot = -1;
+};
+
 class Literal: public Expr {
 	public:
 		Literal(LoxObject value_) {
@@ -183,6 +221,11 @@ class Super: public Expr {
 		}
 		Token keyword;
 		Token method;
+		// resolver annotations
+		int slot = -1;
+		int upvalue = -1;
+		int thisSlot = -1;
+		int thisUpvalue = -1;
 };
 
 class Ternary: public Expr {
@@ -209,6 +252,9 @@ class This: public Expr {
 			return visitor.visitThisExpr(*this);
 		}
 		Token keyword;
+		// resolver annotations
+		int slot = -1;
+		int upvalue = -1;
 };
 
 class Unary: public Expr {
@@ -233,6 +279,10 @@ class Variable: public Expr {
 			return visitor.visitVariableExpr(*this);
 		}
 		Token name;
+		// resolver annotations
+		int slot = -1;
+		int upvalue = -1;
+		int global = -1;
 };
 
 } // lox namespace
\ No newline at end of file
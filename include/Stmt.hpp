@@ -10,6 +10,9 @@
 #include <memory>
 #include <vector>
 #include "Expr.hpp"
+#include "upvalue.hpp"
+#include "chunk.hpp"
+#include "jit.hpp"
 
 namespace lox { 
 
@@ -53,6 +56,9 @@ class Block: public Stmt {
 			visitor.visitBlockStmt(*this);
 		}
 		std::vector<std::unique_ptr<Stmt>> statements;
+		// resolver annotations
+		bool captured = false;
+		unsigned int firstSlot = 0;
 };
 
 class Class: public Stmt {
@@ -68,6 +74,11 @@ class Class: public Stmt {
 		Token name;
 		std::unique_ptr<Expr> superclass;
 		std::vector<std::unique_ptr<Function>> methods;
+		// resolver annotations
+		int slot = -1;
+		int superSlot = -1;
+		int global = -1;
+		std::vector<std::string> fields;
 };
 
 class Expression: public Stmt {
@@ -96,6 +107,16 @@ class Function: public Stmt {
 		std::string kind;
 		std::vector<Token> params;
 		std::vector<std::unique_ptr<Stmt>> body;
+		// resolver annotations
+		unsigned int frameSize = 0;
+		int slot = -1;
+		int global = -1;
+		std::vector<UpvalueDesc> upvalues;
+		std::shared_ptr<Chunk> chunk;
+		std::shared_ptr<Chunk> registerChunk;
+		unsigned int calls = 0;
+		unsigned int loops = 0;
+		std::shared_ptr<NativeCode> native;
 };
 
 class If: public Stmt {
@@ -135,6 +156,8 @@ class Return: public Stmt {
 		}
 		Token keyword;
 		std::unique_ptr<Expr> value;
+		// resolver annotations
+		bool tailCall = false;
 };
 
 class Var: public Stmt {
@@ -148,6 +171,9 @@ class Var: public Stmt {
 		}
 		Token name;
 		std::unique_ptr<Expr> initializer;
+		// resolver annotations
+		int slot = -1;
+		int global = -1;
 };
 
 class While: public Stmt {
@@ -161,6 +187,13 @@ class While: public Stmt {
 		}
 		std::unique_ptr<Expr> condition;
 		std::unique_ptr<Stmt> body;
+		// resolver annotations
+		unsigned int backEdges = 0;
+		std::shared_ptr<Chunk> chunk;
+		std::vector<int> hoisted;
+		std::vector<std::string> reads;
+		size_t getters = 0;
+		bool hoisting = true;
 };
 
 } // lox namespace
\ No newline at end of file
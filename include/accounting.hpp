@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace lox {
+
+class Accounting {
+    /*
+    Charges the memory an interpreter allocates for its scripts to its
+    account, byte for byte and by what it's used for. The pools charge
+    their slabs themselves. Strings, instances' fields, frames and code
+    come from Allocator, whose blocks start with the account that was
+    current on the thread when they were allocated, so that freeing one
+    gives it back to that account whatever the thread or the time. The
+    host's own allocations aren't touched. An account outlives its
+    interpreter until the last block charged to it is freed.
+
+    Allocator throws the script's runtime error when a block would take
+    the account past its limit, and so do the points where the interpreter
+    takes a slab for an object. The code that can't stop halfway, the
+    compilers and the collector, runs unchecked.
+    */
+    public:
+        enum Kind : uint8_t { Instances, Functions, Classes, Upvalues, Strings, Frames, Code };
+        static constexpr size_t KINDS = 7;
+
+        struct Account {
+            std::atomic<size_t> bytes[KINDS] {};
+            std::atomic<size_t> total {0};
+            std::atomic<size_t> peak {0};
+            // 0 for none.
+            std::atomic<size_t> limit {0};
+            // the bytes charged, plus one while the owner has it open.
+            std::atomic<size_t> held {1};
+        };
+
+        static Account* open() { return new Account(); }
+        // the owner is gone: the account is freed with its last block.
+        static void close(Account* account) { release(account, 1); }
+
+        // the allocations of the thread are charged to account while alive.
+        class Charge {
+            public:
+                explicit Charge(Account* account) : previous{active} { active = account; }
+                ~Charge() { active = previous; }
+                Charge(const Charge&) = delete;
+                Charge& operator=(const Charge&) = delete;
+            private:
+                Account* previous;
+        };
+
+        // the allocations of the thread don't check the limit while alive.
+        class Unchecked {
+            public:
+                Unchecked() : previous{checked} { checked = false; }
+                ~Unchecked() { checked = previous; }
+                Unchecked(const Unchecked&) = delete;
+                Unchecked& operator=(const Unchecked&) = delete;
+            private:
+                bool previous;
+        };
+
+        static Account* current() { return active; }
+
+        static void charge(Account* account, Kind kind, size_t bytes);
+        static void discharge(Account* account, Kind kind, size_t bytes);
+
+        // throws the runtime error of a script whose account is over its
+        // limit, or would be with bytes more.
+        static void check(size_t bytes = 0) {
+            if (!active || !checked) return;
+            size_t limit = active->limit.load(std::memory_order_relaxed);
+            if (limit && active->total.load(std::memory_order_relaxed) + bytes > limit) exceeded(limit);
+        }
+
+        static const char* name(Kind kind);
+        static void print(const Account& account, std::ostream& out);
+
+        // a block of bytes charged to the current account as kind.
+        static void* allocate(size_t bytes, Kind kind);
+        static void deallocate(void* block, size_t bytes, Kind kind);
+
+        // Standard allocator charging its blocks as kind.
+        template <class T, Kind kind>
+        class Allocator {
+            public:
+                using value_type = T;
+                template <class U> struct rebind { using other = Allocator<U, kind>; };
+
+                Allocator() = default;
+                template <class U>
+                Allocator(const Allocator<U, kind>&) {}
+
+                T* allocate(size_t n) { return static_cast<T*>(Accounting::allocate(n * sizeof(T), kind)); }
+                void deallocate(T* p, size_t n) { Accounting::deallocate(p, n * sizeof(T), kind); }
+
+                template <class U>
+                bool operator==(const Allocator<U, kind>&) const { return true; }
+                template <class U>
+                bool operator!=(const Allocator<U, kind>&) const { return false; }
+        };
+
+        template <class T, Kind kind>
+        using Vector = std::vector<T, Allocator<T, kind>>;
+        template <class K, class V, Kind kind>
+        using Map = std::map<K, V, std::less<K>, Allocator<std::pair<const K, V>, kind>>;
+        using String = std::basic_string<char, std::char_traits<char>, Allocator<char, Strings>>;
+
+    private:
+        static thread_local Account* active;
+        static thread_local bool checked;
+
+        static void release(Account* account, size_t bytes);
+        [[noreturn]] static void exceeded(size_t limit);
+};
+
+} // namespace lox
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "accounting.hpp"
+#include "loxObject.hpp"
+#include "token.hpp"
+
+namespace lox {
+
+class Function;
+class Class;
+class While;
+
+// Operands are 16 bits wide, stored big endian right after the opcode.
+// The list expands to the OpCode enum and to the VM's dispatch table. A
+// site operand indexes the chunk's type feedback.
+#define LOX_OPCODES(X) \
+    X(OP_CONSTANT)        /* constant index */     \
+    X(OP_NIL)                                      \
+    X(OP_TRUE)                                     \
+    X(OP_FALSE)                                    \
+    X(OP_POP)                                      \
+    X(OP_GET_LOCAL)       /* slot */               \
+    X(OP_SET_LOCAL)       /* slot */               \
+    X(OP_GET_UPVALUE)     /* upvalue index */      \
+    X(OP_SET_UPVALUE)     /* upvalue index */      \
+    X(OP_GET_GLOBAL)      /* global, name index */ \
+    X(OP_DEFINE_GLOBAL)   /* global */             \
+    X(OP_SET_GLOBAL)      /* global, name index */ \
+    X(OP_GET_PROPERTY)    /* name index, site */   \
+    X(OP_SET_PROPERTY)    /* name index, site */   \
+    X(OP_GET_SUPER)       /* name index */         \
+    X(OP_EQUAL)           /* site */               \
+    X(OP_NOT_EQUAL)       /* site */               \
+    X(OP_GREATER)         /* site */               \
+    X(OP_GREATER_EQUAL)   /* site */               \
+    X(OP_LESS)            /* site */               \
+    X(OP_LESS_EQUAL)      /* site */               \
+    X(OP_ADD)             /* site */               \
+    X(OP_SUBTRACT)        /* site */               \
+    X(OP_MULTIPLY)        /* site */               \
+    X(OP_DIVIDE)          /* site */               \
+    X(OP_NOT)                                      \
+    X(OP_NEGATE)                                   \
+    X(OP_PRINT)                                    \
+    X(OP_JUMP)            /* forward offset */     \
+    X(OP_JUMP_IF_FALSE)   /* forward offset */     \
+    X(OP_JUMP_IF_TRUE)    /* forward offset */     \
+    X(OP_LOOP)            /* backward offset */    \
+    X(OP_CALL)            /* argument count, site */ \
+    X(OP_TAIL_CALL)       /* argument count */     \
+    X(OP_CLOSURE)         /* function index */     \
+    X(OP_CLASS)           /* class index */        \
+    X(OP_CLOSE_UPVALUES)  /* first slot */         \
+    X(OP_RETURN)                                   \
+    X(OP_END_LOOP)                                 \
+    /* superinstructions of the common idioms */   \
+    X(OP_COMPARE_LOCAL_JUMP) /* slot constant comparison offset */ \
+    X(OP_INCREMENT_LOCAL) /* slot constant */      \
+    X(OP_ADD_LOCALS)      /* slot slot */          \
+    X(OP_INVOKE)          /* name argument count */ \
+    /* guards of the inlined calls */              \
+    X(OP_CHECK_FUNCTION)  /* function index, offset */ \
+    X(OP_CHECK_METHOD)    /* name function offset */ \
+    /* loop invariants, computed once per loop */  \
+    X(OP_START_HOISTED)   /* loop index */         \
+    X(OP_GET_HOISTED)     /* slot offset */        \
+    X(OP_SET_HOISTED)     /* slot */               \
+    /* specializations, same operands as generic */ \
+    X(OP_EQUAL_NUMBERS)                            \
+    X(OP_NOT_EQUAL_NUMBERS)                        \
+    X(OP_GREATER_NUMBERS)                          \
+    X(OP_GREATER_EQUAL_NUMBERS)                    \
+    X(OP_LESS_NUMBERS)                             \
+    X(OP_LESS_EQUAL_NUMBERS)                       \
+    X(OP_ADD_NUMBERS)                              \
+    X(OP_SUBTRACT_NUMBERS)                         \
+    X(OP_MULTIPLY_NUMBERS)                         \
+    X(OP_DIVIDE_NUMBERS)                           \
+    X(OP_ADD_STRINGS)                              \
+    X(OP_GET_FIELD)                                \
+    X(OP_SET_FIELD)                                \
+    X(OP_CALL_FUNCTION)
+
+enum OpCode : uint8_t {
+#define OPCODE_ENUM(op) op,
+    LOX_OPCODES(OPCODE_ENUM)
+#undef OPCODE_ENUM
+    OP_COUNT
+};
+
+// Register code: A, B and C are slots of the frame, locals first then
+// temporaries. A call finds its callee in A and the arguments in the slots
+// right after it, and leaves its result in A.
+#define LOX_REGISTER_OPCODES(X) \
+    X(R_LOADK)            /* A constant */         \
+    X(R_LOADNIL)          /* A */                  \
+    X(R_LOADTRUE)         /* A */                  \
+    X(R_LOADFALSE)        /* A */                  \
+    X(R_MOVE)             /* A B */                \
+    X(R_GETUPVAL)         /* A upvalue */          \
+    X(R_SETUPVAL)         /* upvalue B */          \
+    X(R_GETGLOBAL)        /* A global name */      \
+    X(R_DEFGLOBAL)        /* global B */           \
+    X(R_SETGLOBAL)        /* global name B */      \
+    X(R_GETPROP)          /* A B name */           \
+    X(R_SETPROP)          /* A name C */           \
+    X(R_GETSUPER)         /* A this super name */  \
+    X(R_EQ)               /* A B C */              \
+    X(R_NE)               /* A B C */              \
+    X(R_GT)               /* A B C */              \
+    X(R_GE)               /* A B C */              \
+    X(R_LT)               /* A B C */              \
+    X(R_LE)               /* A B C */              \
+    X(R_ADD)              /* A B C */              \
+    X(R_SUB)              /* A B C */              \
+    X(R_MUL)              /* A B C */              \
+    X(R_DIV)              /* A B C */              \
+    X(R_NOT)              /* A B */                \
+    X(R_NEG)              /* A B */                \
+    X(R_PRINT)            /* A */                  \
+    X(R_JMP)              /* forward offset */     \
+    X(R_JMPF)             /* A forward offset */   \
+    X(R_JMPT)             /* A forward offset */   \
+    X(R_LOOP)             /* backward offset */    \
+    X(R_CALL)             /* A argument count */   \
+    X(R_TAILCALL)         /* A argument count */   \
+    X(R_CLOSURE)          /* A function */         \
+    X(R_CLASS)            /* A class */            \
+    X(R_CLOSE)            /* first slot */         \
+    X(R_RETURN)           /* A */
+
+enum RegisterOp : uint8_t {
+#define OPCODE_ENUM(op) op,
+    LOX_REGISTER_OPCODES(OPCODE_ENUM)
+#undef OPCODE_ENUM
+    R_COUNT
+};
+
+struct TypeFeedback {
+    // The operand types a binary operator, a call, or a property access
+    // last saw: both operands, the callee, or the object. The VM rewrites
+    // the instruction to a specialized one once they stay the same, and
+    // back to the generic one when they change.
+    OpCode generic;
+    OpCode specialized {OP_COUNT};   // what the types call for, OP_COUNT for nothing.
+    LoxType left {LoxType::Nil};
+    LoxType right {LoxType::Nil};
+    uint16_t countdown {0};           // runs left before specializing.
+    uint8_t deopts {0};
+
+    explicit TypeFeedback(OpCode op) : generic{op} {}
+};
+
+class Chunk {
+    /*
+    The instructions of a function body or of a script, compiled from the
+    resolved AST, either as stack code or as register code. Locals use the 
+    slots the resolver assigned, so a frame holds frameSize slots followed
+    by at most maxStack temporaries.
+    */
+    public:
+        Accounting::Vector<uint8_t, Accounting::Code> code;
+        Accounting::Vector<LoxObject, Accounting::Code> constants;
+        Accounting::Vector<Token, Accounting::Code> names;
+        Accounting::Vector<Function*, Accounting::Code> functions;
+        Accounting::Vector<Class*, Accounting::Code> classes;
+        Accounting::Vector<While*, Accounting::Code> loops;
+        Accounting::Vector<TypeFeedback, Accounting::Code> feedback;
+        unsigned int frameSize {0};
+        unsigned int maxStack {0};
+};
+
+} // namespace lox
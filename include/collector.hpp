@@ -0,0 +1,217 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "upvalue.hpp"
+
+namespace lox {
+
+class Interpreter;
+class LoxClass;
+class LoxFunction;
+class LoxInstance;
+
+class Collector {
+    /*
+    Frees the objects reference counting can't: the ones only kept alive
+    by cycles. It tracks the instances, functions and classes of an
+    interpreter in two generations. New objects start young, the young
+    generation is collected at once when it holds youngLimit objects and
+    its survivors move to the old one. Collecting a set of objects
+    subtracts from each object's count the references the set holds to
+    it; what remains comes from elsewhere, the frame stack, globals, the
+    native stack or another object, so objects left with users are roots.
+    Whatever the roots don't reach is garbage, whose references are
+    cleared so that the counts free it.
+
+    The old generation is too large to be collected in one pause. Once it
+    has grown by a quarter since its last cycle, and by YOUNG_LIMIT, a
+    cycle marks it in slices of at most the pause budget, run every
+    SLICE_ALLOCATIONS allocations: it counts the references each old
+    object holds, then marks from the roots it finds. The program runs
+    between slices, so a field overwritten while marking shades the value
+    it held, as the snapshot taken at the start of the cycle had it. The
+    unmarked objects are then only candidates, the counts may have moved
+    since: the last slices recount them, a few at a time, and free the
+    ones nothing outside of them refers to. Recounting any set of objects
+    is sound, and one with every candidate the set refers to holds whole
+    the garbage cycles it touches, so each recount takes such a closure,
+    only too long a chain of garbage exceeding the budget.
+
+    The budget bounds those slices only. A young collection runs whole,
+    the young generation halving down to MIN_YOUNG_LIMIT objects while
+    collecting it takes longer than the budget, so its pauses may still
+    overrun it, as compactions do. printStats counts the overruns.
+
+    With compaction on, once as many instances have been created as were
+    live after the last compaction, and at least MIN_TURNOVER, the next
+    safe point moves the instances to fresh slabs in the order a traversal from the roots
+    finds them, so that the objects of a structure are walked in address
+    order. Only the references the collector can rewrite are known, the
+    ones of the heap, the frame stack and the globals: an instance with
+    more users than that is referred to from elsewhere and stays put.
+    */
+    public:
+        enum class Kind : uint8_t { Instance, Function, Class };
+
+        // placed before every object of the heap.
+        struct alignas(std::max_align_t) Header {
+            Header* prev;
+            Header* next;
+            // while collecting, the users left once the references from
+            // the collected objects are taken off, REACHED once found live.
+            long refs;
+            Kind kind;
+            uint8_t generation;
+            // marked by the cycle numbered epoch.
+            bool marked;
+            uint32_t epoch;
+        };
+
+        static constexpr size_t YOUNG_LIMIT = 10000;
+        static constexpr size_t MIN_YOUNG_LIMIT = 500;
+        static constexpr size_t SLICE_ALLOCATIONS = 1000;
+        static constexpr size_t MIN_TURNOVER = 100000;
+
+        explicit Collector(Interpreter& interpreter);
+
+        // tracks an object just created, collecting first when it's time.
+        void track(Header* header, Kind kind);
+        void untrack(Header* header);
+        void setPauseBudget(double milliseconds);
+        // the barrier: called with the value of a field about to be
+        // overwritten.
+        void shade(const LoxObject& value) {
+            if (phase >= Phase::Stamp && phase <= Phase::Mark) shadeValue(value);
+        }
+        // drops the cycle under way, for the interpreter's destruction.
+        void abandon();
+
+        void setCompaction(bool enabled) { compaction = enabled; }
+        bool compactionDue() const { return due && phase == Phase::Idle; }
+        // only called at a safe point, where the running code refers to
+        // instances through LoxObjects alone.
+        void compact();
+
+        void printStats(std::ostream& out) const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+        static constexpr long REACHED = -1;
+        // generations of the candidates of a cycle and of the ones being
+        // recounted.
+        static constexpr uint8_t CANDIDATES = 2;
+        static constexpr uint8_t RECOUNTED = 3;
+        static constexpr size_t MIN_RECOUNT = 256;
+        static constexpr size_t BUCKETS = 12;
+
+        Interpreter& interpreter;
+        // sentinels of the circular lists of the two generations.
+        Header young;
+        Header old;
+        size_t youngCount {0};
+        size_t oldCount {0};
+        size_t youngLimit {YOUNG_LIMIT};
+        bool collecting {false};
+        Clock::duration budget {std::chrono::milliseconds(1)};
+
+        // the cycle under way over the old generation: Stamp counts the
+        // users of every old object, Subtract takes off the references
+        // among them, Mark reaches from the roots and Sweep moves the
+        // unmarked objects to the candidates, which Recount collects.
+        enum class Phase : uint8_t { Idle, Stamp, Subtract, Mark, Sweep, Recount };
+        Phase phase {Phase::Idle};
+        uint32_t epoch {0};
+        size_t oldAfterCycle {0};
+        size_t allocations {0};
+        // next object of the old generation the phase looks at.
+        Header* cursor {nullptr};
+        // gray objects, marked but whose references aren't yet.
+        std::vector<Header*> pending;
+        // closed upvalues of old functions, held until marked.
+        struct Held {
+            PUpvalue upvalue;
+            long refs;
+        };
+        std::vector<Held> held;
+        std::unordered_map<Upvalue*, size_t> heldIndex;
+        size_t heldCursor {0};
+        // objects promoted while a cycle runs join the old ones after it.
+        Header promoted;
+        Header candidates;
+        Header recounted;
+
+        bool compaction {false};
+        bool due {false};
+        size_t created {0};
+        size_t liveAfterCompaction {0};
+        size_t compactions {0};
+        size_t moved {0};
+        size_t pinned {0};
+
+        size_t youngCollections {0};
+        size_t cycles {0};
+        size_t slices {0};
+        size_t freed {0};
+        Clock::duration paused {};
+        Clock::duration longestPause {};
+        // pauses by kind, bucket i counting the ones under 2^i * 64 µs.
+        enum Pause { YoungPause, SlicePause, CompactPause };
+        size_t histogram[3][BUCKETS] {};
+        // pauses longer than the budget by more than an eighth, by kind.
+        size_t overruns[3] {};
+        void record(Pause kind, Clock::duration pause);
+
+        static void link(Header& list, Header* header);
+        static void unlink(Header* header);
+        static void splice(Header& to, Header& from);
+        static void* object(Header* header) { return header + 1; }
+        static Header* header(const LoxObject& value);
+
+        static size_t users(Header* header);
+        template <class F> static void references(Header* header, F visit);
+        static void clear(Header* header);
+        void hold(Header* header);
+        void release(Header* header);
+
+        // collects at once the objects of list, which are all of
+        // generation, moving the survivors to the old generation in to.
+        void collect(Header& list, uint8_t generation, Header& to);
+        void collectYoung();
+        void startCycle();
+        void slice();
+        void finishCycle();
+        size_t step();
+        size_t recount();
+        void mark(Header* header);
+        void scan(Header* header);
+        void reach(const LoxObject& value);
+        void shadeValue(const LoxObject& value);
+
+        static Header* instance(const LoxObject& value);
+        // every LoxObject the collector knows of, which compact rewrites.
+        template <class F> void forEachReference(F visit);
+};
+
+// an object of the collected heap, as allocated by the pools.
+template <class T>
+struct Tracked {
+    Collector::Header header;
+    T object;
+
+    template <class... Args>
+    Tracked(Args&&... args) : object(std::forward<Args>(args)...) {}
+    // the collector moves the header itself.
+    Tracked(Tracked&& other) : object(std::move(other.object)) {}
+
+    static Tracked* of(T* object) {
+        return reinterpret_cast<Tracked*>(reinterpret_cast<char*>(object) - sizeof(Collector::Header));
+    }
+};
+
+} // namespace lox
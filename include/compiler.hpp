@@ -0,0 +1,86 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <initializer_list>
+#include "Expr.hpp"
+#include "Stmt.hpp"
+#include "chunk.hpp"
+
+namespace lox {
+
+class Compiler : public ExprVisitor, public StmtVisitor {
+    /*
+    Turns resolved statements into a chunk for the stackless mode. Variables
+    keep the slots and upvalues the resolver annotated, so nothing is left
+    to resolve at run time. Function bodies are compiled the first time
+    they are called and the chunk is cached on their declaration.
+    */
+    public:
+        using SExpr = std::unique_ptr<Stmt>;
+        using PExpr = std::unique_ptr<Expr>;
+
+        static Chunk& compile(Function& function);
+        static std::unique_ptr<Chunk> compile(std::vector<SExpr>& statements, unsigned int frameSize);
+        // a loop on its own, to go on with in the frame of the tree walker.
+        static std::unique_ptr<Chunk> compile(While& loop, unsigned int frameSize);
+
+        // Expr
+        LoxObject visitAssignExpr(Assign& expr) override;
+        LoxObject visitBinaryExpr(Binary& expr) override;
+        LoxObject visitCallExpr(Call& expr) override;
+        LoxObject visitCommaExprExpr(CommaExpr& expr) override;
+        LoxObject visitGetExpr(Get& expr) override;
+        LoxObject visitGroupingExpr(Grouping& expr) override;
+        LoxObject visitHoistedExpr(Hoisted& expr) override;
+        LoxObject visitInlinedExpr(Inlined& expr) override;
+        LoxObject visitLiteralExpr(Literal& expr) override;
+        LoxObject visitLogicalExpr(Logical& expr) override;
+        LoxObject visitSetExpr(Set& expr) override;
+        LoxObject visitSuperExpr(Super& expr) override;
+        LoxObject visitTernaryExpr(Ternary& expr) override;
+        LoxObject visitThisExpr(This& expr) override;
+        LoxObject visitUnaryExpr(Unary& expr) override;
+        LoxObject visitVariableExpr(Variable& expr) override;
+
+        // Stmt
+        void visitBlockStmt(Block& stmt) override;
+        void visitClassStmt(Class& stmt) override;
+        void visitExpressionStmt(Expression& stmt) override;
+        void visitFunctionStmt(Function& stmt) override;
+        void visitIfStmt(If& stmt) override;
+        void visitPrintStmt(Print& stmt) override;
+        void visitReturnStmt(Return& stmt) override;
+        void visitVarStmt(Var& stmt) override;
+        void visitWhileStmt(While& stmt) override;
+
+    private:
+        Compiler(Chunk& chunk_, int receiver_ = -1) : chunk{chunk_}, receiver{receiver_} {}
+
+        Chunk& chunk;
+        // slot of the receiver an initializer returns, -1 elsewhere.
+        int receiver;
+        // temporaries on the stack at the current instruction.
+        unsigned int depth {0};
+
+        void compile(PExpr& expr) { expr->accept(*this); }
+        void compile(SExpr& stmt) { stmt->accept(*this); }
+
+        void emit(OpCode op, int effect);
+        void emit(OpCode op, size_t operand, int effect);
+        void emit(OpCode op, std::initializer_list<size_t> operands, int effect);
+        void setDepth(unsigned int d);
+        size_t emitJump(OpCode op);
+        void patchJump(size_t jump);
+        void emitLoop(size_t start);
+        size_t name(const Token& token);
+        size_t constant(const LoxObject& value);
+        // new type feedback entry for an instruction compiled as op.
+        size_t site(OpCode op);
+        size_t compareLocalJump(PExpr& condition);
+
+        void getVariable(int slot, int upvalue, const Token& name, int global = -1);
+        void setVariable(int slot, int upvalue, const Token& name, int global = -1);
+};
+
+} // namespace lox
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "errors.hpp"
+#include "loxObject.hpp"
+
+namespace lox {
+
+class Interpreter;
+
+// The tree walker nests a native call for every Lox call. The stackless
+// engine keeps Lox calls on the heap, up to the stack limit. The register
+// engine does the same with register code. The tiered engine starts in
+// the tree walker and moves hot functions to the stackless one.
+enum class Engine {
+    TreeWalker,
+    Stackless,
+    Registers,
+    Tiered
+};
+
+// A function of the tiered engine is compiled once it has been called
+// `calls` times or has looped `loops` times, and runs on the VM from its
+// next call on.
+struct TierUp {
+    unsigned int calls {100};
+    unsigned int loops {1000};
+    bool log {false};
+};
+
+// How a context runs its scripts.
+struct Options {
+    Engine engine {Engine::TreeWalker};
+    size_t stackLimit {512 << 20};
+    TierUp tierUp {};
+    bool jit {false};
+    // replaces calls of small functions and getters by their body.
+    bool inlining {true};
+    // computes the invariants of loops once per loop.
+    bool hoisting {true};
+    // longest slice of a cycle over the old generation, in ms. Young
+    // collections and compactions run whole: the young generation only
+    // shrinks while collecting it takes longer.
+    double pauseBudget {1};
+    // moves the live instances next to each other once enough were made.
+    bool compaction {false};
+    // bytes past which the scripts get a runtime error, 0 for no limit.
+    size_t heapLimit {0};
+    // where print statements and warnings write, and errors are reported.
+    std::ostream* out {&std::cout};
+    std::ostream* err {&std::cerr};
+};
+
+// a script compiled by a context.
+struct Program;
+
+class Context {
+    /*
+    An interpreter embedded in a host: its heap, its globals and the
+    programs it compiled belong to it alone, so that contexts run scripts
+    independently of each other, on as many threads as there are
+    contexts. A context is used by one thread at a time. The functions a
+    program declares keep referring to it, so a context keeps its
+    programs until it's destroyed, and the LoxObjects it hands out must
+    be destroyed before it.
+    */
+    public:
+        enum class Status { Ok, CompileError, RuntimeError };
+
+        explicit Context(Options options = {});
+        ~Context();
+        Context(const Context&) = delete;
+        Context& operator=(const Context&) = delete;
+
+        // scans, parses, resolves and optimizes source, nullptr when it
+        // has errors, which are reported.
+        Program* compile(const std::string& source);
+        Status run(Program& program);
+        Status run(const std::string& source);
+        // writes the C++ translation of source instead of running it.
+        // Returns false when it has errors.
+        bool translate(const std::string& source, std::ostream& out);
+
+        // the value of a global a program defined. Runtime errors, an
+        // undefined global included, are thrown as std::runtime_error.
+        LoxObject get(const std::string& name);
+        // calls a function, a class or a method, bound to its receiver.
+        LoxObject call(const LoxObject& callee, std::vector<LoxObject> args);
+        LoxObject call(const std::string& function, std::vector<LoxObject> args);
+
+        // what the heap holds and how it was collected.
+        void printHeapStats(std::ostream& out) const;
+
+    private:
+        Options options;
+        Errors errors;
+        // destroyed after the interpreter, whose functions refer to them.
+        std::vector<std::unique_ptr<Program>> programs;
+        std::unique_ptr<Interpreter> interpreter;
+
+        std::unique_ptr<Program> parse(const std::string& source, std::ostream& warnings);
+};
+
+} // namespace lox
@@ -1,24 +1,43 @@
 #pragma once
 
-#include <string>
+#include <cstddef>
 #include <iostream>
+#include <string>
 #include "token.hpp"
 
-using namespace lox;
-
-// not currently used due to hasError variable. Need to figure this out later
-static void report (int line, std::string where, std::string message){
-    std::cerr << "[line " << line 
-            << "] Error" << where
-            << ": " << message << std::endl;
-}
-static void error(int line, std::string message) {
-    report(line, "", message);
-}
-
-static void error(Token token, std::string message) {
-    if (token.token_type == EOF)
-        report(token.line, " at end", message);
-    else 
-        report (token.line, " at '" + token.lexeme + "'", message);
-}
\ No newline at end of file
+namespace lox {
+
+class Errors {
+    /*
+    The compile errors of a script, reported as they're found. The scanner,
+    the parser and the resolver of a script share one, which tells whether
+    the script can run.
+    */
+    public:
+        explicit Errors(std::ostream& out_ = std::cerr) : out{&out_} {}
+
+        void error(int line, const std::string& message) {
+            report(line, "", message);
+        }
+
+        void error(const Token& token, const std::string& message) {
+            if (token.token_type == EOFILE)
+                report(token.line, " at end", message);
+            else
+                report(token.line, " at '" + token.lexeme + "'", message);
+        }
+
+        bool found() const { return count > 0; }
+        void clear() { count = 0; }
+
+    private:
+        std::ostream* out;
+        size_t count {0};
+
+        void report(int line, const std::string& where, const std::string& message) {
+            *out << "[line " << line << "] Error" << where << ": " << message << std::endl;
+            count++;
+        }
+};
+
+} // namespace lox
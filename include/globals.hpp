@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "loxObject.hpp"
+#include "token.hpp"
+
+namespace lox {
+
+class Globals {
+    /*
+    The global variables of the scripts run by an interpreter, in a table
+    indexed by the number the resolver gives each name the first time a
+    script declares or uses it. Entries of names not defined yet are marked
+    undefined, so a read checks that mark before it returns the value and
+    nothing is looked up by name at run time.
+    */
+    public:
+        // index of the global named name, a new undefined entry if unknown.
+        unsigned int index(const std::string& name);
+        // index of name, -1 when no script has used it.
+        int find(const std::string& name) const;
+
+        bool defined(unsigned int index) const { return values[index].defined; }
+
+        void define(unsigned int index, const LoxObject& value) {
+            values[index].value = value;
+            values[index].defined = true;
+        }
+
+        // the global at index, name being what the script called it.
+        LoxObject& get(unsigned int index, const Token& name) {
+            Global& global = values[index];
+            if (!global.defined) undefined(name);
+            return global.value;
+        }
+
+        // calls visit with the value of every global, for the collector.
+        template <class F>
+        void forEach(F visit) {
+            for (Global& global : values) visit(global.value);
+        }
+
+    private:
+        struct Global {
+            LoxObject value;
+            bool defined {false};
+        };
+
+        std::vector<Global> values;
+        std::unordered_map<std::string, unsigned int> indexes;
+
+        [[noreturn]] static void undefined(const Token& name);
+};
+
+} // namespace lox
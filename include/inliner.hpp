@@ -0,0 +1,65 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Expr.hpp"
+#include "Stmt.hpp"
+
+namespace lox {
+
+class Inliner {
+    /*
+    Runs after the resolver and replaces the calls of small functions and
+    methods, and the reads of small getters, by a copy of their body. Only
+    bodies returning a single expression of operators, literals, parameters,
+    globals and property reads are copied, so a copy never calls anything
+    and a function can't be inlined into itself. The copy reads its
+    arguments and receiver from slots added to the caller's frame, and
+    runs under a guard: when the global was rebound to something else, or
+    the object's class doesn't find the method the body came from, the
+    original call is made instead.
+    */
+    public:
+        using SExpr = std::unique_ptr<Stmt>;
+        using PExpr = std::unique_ptr<Expr>;
+
+        // rewrites the call sites of a script, returns its new frame size.
+        static unsigned int optimize(std::vector<SExpr>& statements, unsigned int frameSize);
+
+        // guards of the copies: whether callee is still a closure of
+        // function, and whether object finds function as its method name.
+        static bool isFunction(const LoxObject& callee, const Function* function);
+        static bool isMethod(const LoxObject& object, const Token& name, const Function* function);
+
+    private:
+        // global functions and methods by name, nullptr for the ones
+        // declared more than once or too big to be inlined.
+        std::map<std::string, Function*> functions;
+        std::map<std::string, Function*> methods;
+        // functions whose body, or a copy of it, is being rewritten: none
+        // is inlined into itself.
+        std::vector<Function*> inlining;
+        // frame size of the code being rewritten, and first slot free for
+        // the arguments of a copy.
+        unsigned int* frameSize {nullptr};
+        unsigned int top {0};
+
+        void collect(std::vector<SExpr>& statements, bool global);
+        void collect(SExpr& stmt, bool global);
+        void rewrite(std::vector<SExpr>& statements);
+        void rewrite(SExpr& stmt);
+        void rewrite(PExpr& expr);
+        void rewrite(Function& function);
+        // the function a call or a getter read would run a copy of.
+        Function* target(PExpr& expr);
+        void replace(PExpr& expr, Function* function);
+
+        static bool inlinable(Function& function);
+        static bool small(PExpr& expr, unsigned int slots, unsigned int& budget);
+        // copy of an inlinable body with its slots moved from firstSlot on.
+        static PExpr copy(PExpr& expr, unsigned int firstSlot);
+};
+
+} // namespace lox
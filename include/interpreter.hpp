@@ -1,17 +1,26 @@
 #pragma once
 
 #include "loxCallable.hpp"
-#include "environment.hpp"
+#include "accounting.hpp"
+#include "collector.hpp"
+#include "globals.hpp"
+#include "pool.hpp"
+#include "upvalue.hpp"
+#include "vm.hpp"
+#include "jit.hpp"
 #include "loxObject.hpp"
 #include "Expr.hpp"
-#include "lox.hpp"
+#include "context.hpp"
 #include "Stmt.hpp"
 #include <iostream>
 #include <vector>
 #include <map>
+#include <set>
+#include <algorithm>
 
 namespace lox {
 
+class CallFrame;
 
 class Interpreter : public ExprVisitor, public  StmtVisitor{
 
@@ -21,6 +30,8 @@ class Interpreter : public ExprVisitor, public  StmtVisitor{
         // Expr
         LoxObject visitLiteralExpr(Literal& expr) override;
         LoxObject visitGroupingExpr(Grouping& expr) override;
+        LoxObject visitHoistedExpr(Hoisted& expr) override;
+        LoxObject visitInlinedExpr(Inlined& expr) override;
         LoxObject visitUnaryExpr(Unary& expr) override;
         LoxObject visitBinaryExpr(Binary& expr) override;
         LoxObject visitVariableExpr(Variable& expr) override;
@@ -53,27 +64,142 @@ class Interpreter : public ExprVisitor, public  StmtVisitor{
         void removeUser(LoxCallable* func);
         void removeUser(LoxInstance* inst);
 
-        LoxFunction* createFunction(LoxFunction* stmt, PEnvironment env);
-        LoxFunction* createFunction(Function* stmt, PEnvironment env, bool initClass = false);
+        LoxFunction* createFunction(LoxFunction* fun, LoxObject receiver);
+        LoxFunction* createFunction(Function* stmt, bool initClass = false);
         LoxInstance* createInstance(LoxClass* loxklass);
-        void registerFunction(LoxFunction* func, PEnvironment);
-        void deleteFunction(LoxFunction* func);
+        LoxObject createClass(Class& stmt, LoxObject superclass);
+        // callables and classes of scripts translated to C++.
+        LoxObject createCallable(std::unique_ptr<LoxCallable> callable);
+        LoxObject createClass(Token name, LoxObject superclass, std::map<std::string, LoxObject> methods);
+        // objects alive in the pools, their bytes and how full the slabs are.
+        void printHeapStats(std::ostream& out) const;
 
-        void interpret(std::vector<std::unique_ptr<Stmt>>& statements);
-        void executeBlock(std::vector<std::unique_ptr<Stmt>>& statements, PEnvironment Environment); 
-        void resolve(Expr* expr, unsigned int depth);
+        LoxObject call(LoxObject& callee, Call& expr);
+        // throws a runtime error rather than let the calls the tree walker
+        // nests, here being the latest, overflow the native stack.
+        void checkNativeStack(const void* here);
+        // calls callee from the host and the value of a global for it,
+        // throwing runtime errors.
+        LoxObject invoke(const LoxObject& callee, std::vector<LoxObject> args);
+        LoxObject global(const std::string& name);
+
+        // index in the table of globals the resolver gives a global's sites.
+        unsigned int globalIndex(const std::string& name) { return globals.index(name); }
+
+        void setEngine(Engine engine) { m_engine = engine; }
+        void setStackLimit(size_t bytes) { m_vm->setStackLimit(bytes); }
+        void setTierUp(TierUp thresholds) { m_tierUp = thresholds; }
+        void setPauseBudget(double milliseconds) { m_collector.setPauseBudget(milliseconds); }
+        // the write barrier of the collector, before a field is assigned.
+        void overwriting(const LoxObject& value) { m_collector.shade(value); }
+        void setCompaction(bool enabled) { m_collector.setCompaction(enabled); }
+        void setHeapLimit(size_t bytes) { m_account->limit = bytes; }
+        // what the interpreter and its scripts allocate is charged to it.
+        Accounting::Account* account() const { return m_account; }
+        std::set<std::string>& getters() { return m_getters; }
+        // the loops of the script's top level, where no native frame holds
+        // an instance but through a LoxObject, let the collector move them.
+        void safePoint() {
+            if (m_collector.compactionDue()) m_collector.compact();
+        }
+        void setJit(bool enabled) {
+            if (enabled && !m_jit) m_jit = std::make_unique<Jit>(*this);
+            if (!enabled) m_jit.reset();
+        }
+
+        // where print statements write and runtime errors are reported.
+        void setOutput(std::ostream& out, std::ostream& err) {
+            m_out = &out;
+            m_err = &err;
+        }
+
+        // returns false when the script stopped on a runtime error.
+        bool interpret(std::vector<std::unique_ptr<Stmt>>& statements, unsigned int frameSize = 0);
+        void executeBlock(std::vector<std::unique_ptr<Stmt>>& statements); 
     
     private:
 
-        PEnvironment globals;
-        PEnvironment environment;
-        std::map<Expr*, unsigned int> locals {};
+        // charged with what the interpreter allocates, its scripts'
+        // objects included, and outliving it until all of it is freed.
+        Accounting::Account* m_account {Accounting::open()};
+
+        // The interpreter owns every object of its scripts. Instances,
+        // functions, classes and upvalues come from its pools, the other
+        // callables are few and allocated on their own. An object is freed
+        // as soon as no LoxObject refers to it any more, cycles by the
+        // collector, the others when the interpreter is destroyed, by
+        // clearing the pools.
+        Slabs m_upvalues {m_account, Accounting::Upvalues};
+        Pool<Tracked<LoxInstance>> m_instances {m_account, Accounting::Instances};
+        Pool<Tracked<LoxFunction>> m_functions {m_account, Accounting::Functions};
+        Pool<Tracked<LoxClass>> m_classes {m_account, Accounting::Classes};
+        Collector m_collector {*this};
+        friend class Collector;
+        std::map<LoxCallable*, std::unique_ptr<LoxCallable>> m_callables;
+        // objects left without users, waiting to be freed.
+        struct Unused {
+            LoxType type;
+            LoxCallable* function;
+            LoxClass* klass;
+            LoxInstance* instance;
+        };
+        std::vector<Unused> m_unused;
+        bool m_freeing {false};
+        void free(Unused object);
+        template <class T, class... Args>
+        T* create(Pool<Tracked<T>>& pool, Collector::Kind kind, Args&&... args);
+        template <class T>
+        void destroy(Pool<Tracked<T>>& pool, T* object);
+
+        Globals globals;
+
+        // Contiguous slots holding the locals of the running calls. m_fp is
+        // the base of the innermost frame, m_sp the first free slot.
+        Accounting::Vector<LoxObject, Accounting::Frames> m_stack;
+        size_t m_fp {0};
+        size_t m_sp {0};
+        LoxFunction* m_closure {nullptr};
+        friend class CallFrame;
+
+        // A return statement sets m_returning so that statements unwind up to
+        // the call it exits. A tail call leaves its callee in m_tailCallee and
+        // its arguments right above the current frame instead of a value.
+        bool m_returning {false};
+        LoxObject m_returnValue;
+        LoxObject m_tailCallee;
+        friend class LoxFunction;
+        // the tail call a function translated to C++ leaves to its caller.
+        CompiledFunction::TailCall m_compiledTailCall;
+        friend class CompiledFunction;
+
+        std::ostream* m_out {&std::cout};
+        std::ostream* m_err {&std::cerr};
+
+        // The stackless mode runs compiled code on the same frame stack.
+        Engine m_engine {Engine::TreeWalker};
+        std::unique_ptr<VM> m_vm;
+        friend class VM;
 
-        std::map<LoxCallable*, std::pair<std::unique_ptr<LoxCallable>, size_t>> m_callables;
-        std::map<LoxClass*, std::pair<std::unique_ptr<LoxClass>, size_t>> m_classes;
-        std::map<LoxInstance*, std::pair<std::unique_ptr<LoxInstance>, size_t>> m_instances;
+        // With the tiered engine, counts a call of function and tells 
+        // whether it's hot enough to run compiled.
+        TierUp m_tierUp;
+        bool tierUp(Function& function);
+        // moves a hot loop to the VM. Returns false while it's still cold.
+        bool enterCompiledLoop(While& loop);
 
-        std::map<LoxFunction*, PEnvironment> m_funcenvs;
+        // the names of the getters the classes of the programs declare,
+        // which the loop optimizer doesn't hoist the reads of.
+        std::set<std::string> m_getters;
+        // whether the invariants of loop are computed once, rather than at
+        // each iteration because it reads a getter declared since.
+        bool hoists(While& loop);
+
+        // Runs numeric functions as machine code, when enabled.
+        std::unique_ptr<Jit> m_jit;
+        friend class Jit;
+
+        // Upvalues still pointing into m_stack, sorted by slot.
+        std::vector<PUpvalue> m_openUpvalues;
 
         bool m_destroying;
          
@@ -86,17 +212,52 @@ class Interpreter : public ExprVisitor, public  StmtVisitor{
             stmt->accept(*this);
         }
 
-        LoxObject lookUpVariable(Token name, Expr* expr) {
-            if (locals.find(expr) != locals.end()) {
-                auto distance = locals.at(expr);
-                return environment->getAt(distance, name.lexeme);
-            } else {
-                return globals->get(name);
+        void reserveStack(size_t slots) {
+            if (m_stack.size() < slots) {
+                m_stack.resize(std::max(slots, 2 * m_stack.size()));
             }
         }
 
+        PUpvalue captureUpvalue(size_t slot);
+        void closeUpvalues(size_t from);
+
+        LoxObject& upvalue(int index);
+
+        LoxObject lookUpVariable(Token& name, int slot, int upvalue, int global = -1) {
+            if (slot >= 0) {
+                return m_stack[m_fp + slot];
+            } else if (upvalue >= 0) {
+                return this->upvalue(upvalue);
+            } else {
+                return globals.get(global, name);
+            }
+        }
 
+};
 
+class CallFrame {
+    /*
+    Reserves the slots of a function call on top of the interpreter's 
+    frame stack. Arguments are stored straight into the first slots, then 
+    enter() makes the frame current. On exit the upvalues still open on the
+    frame are closed and the slots are released without any heap allocation.
+    */
+    public:
+        CallFrame(Interpreter& intp, unsigned int size);
+        ~CallFrame();
+        LoxObject& operator[](size_t i) { return interpreter.m_stack[base + i]; }
+        const LoxObject* slots() const { return interpreter.m_stack.data() + base; }
+        void enter(LoxFunction* closure) {
+            interpreter.m_fp = base;
+            interpreter.m_closure = closure;
+        }
+        void reuse(unsigned int size, size_t arity);
+    private:
+        Interpreter& interpreter;
+        size_t base;
+        size_t size;
+        size_t previousFp;
+        LoxFunction* previousClosure;
 };
 
 } // lox namespace
\ No newline at end of file
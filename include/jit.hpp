@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace lox {
+
+class Function;
+class LoxFunction;
+class LoxObject;
+class Interpreter;
+
+class NativeCode {
+    /*
+    Machine code of a function, in executable memory of its own. The entry
+    takes the arguments as doubles and writes the result, and returns false
+    when it bails out: the function is then run again by the interpreter,
+    which is only correct because compiled functions have no side effect.
+    A function that can't be compiled keeps a NativeCode without entry.
+    */
+    public:
+        using Entry = bool (*)(const double* args, double* result);
+
+        NativeCode() = default;
+        explicit NativeCode(const std::vector<uint8_t>& code);
+        NativeCode(const NativeCode&) = delete;
+        NativeCode& operator=(const NativeCode&) = delete;
+        ~NativeCode();
+
+        Entry entry {nullptr};
+        // calls itself through the global named after it.
+        bool recursive {false};
+        unsigned int bails {0};
+
+    private:
+        void* memory {nullptr};
+        size_t size {0};
+};
+
+class Jit {
+    /*
+    Template JIT for x86-64: functions computing with numbers, locals,
+    conditions, loops and calls to themselves are compiled to machine code
+    the first time they're called. Values are kept unboxed as doubles, the
+    arguments are checked to be numbers on the way in and anything the code
+    can't handle, a division by zero or a too deep recursion, bails out.
+    */
+    public:
+#ifdef LOX_JIT
+        static constexpr bool available = true;
+#else
+        static constexpr bool available = false;
+#endif
+
+        explicit Jit(Interpreter& intp) : interpreter{intp} {}
+        // runs function on args as machine code when it can. Returns false
+        // when the caller has to run it.
+        bool call(LoxFunction* function, const LoxObject* args, LoxObject& result);
+
+    private:
+        Interpreter& interpreter;
+        // compared by the compiled code to the stack pointer on entry.
+        uintptr_t stackLimit {0};
+};
+
+} // namespace lox
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "Expr.hpp"
+#include "Stmt.hpp"
+
+namespace lox {
+
+class LoopOptimizer {
+    /*
+    Runs after the inliner and hoists the invariants out of loops: an
+    operation whose operands no iteration changes is computed the first
+    time the loop reaches it, then read from two slots added to the frame,
+    the value and whether it was computed, until the loop starts again.
+    Computing it where it was rather than ahead of the loop keeps its
+    errors, and its absence when a branch never runs it. Only loops which
+    call nothing are considered, since a call or a getter can change any
+    global, field or captured local; then the loop's own assignments,
+    declarations and property writes tell which operands change. The
+    properties a loop reads are kept on it: the interpreter computes its
+    invariants at each iteration once one of them is the name of a getter,
+    which a program compiled later may declare.
+    */
+    public:
+        using SExpr = std::unique_ptr<Stmt>;
+        using PExpr = std::unique_ptr<Expr>;
+
+        // hoists the invariants of the loops of a script, returns its new
+        // frame size. getters holds the names of the getters declared by
+        // the scripts run so far, reading them calls code.
+        static unsigned int optimize(std::vector<SExpr>& statements, unsigned int frameSize,
+                                     std::set<std::string>& getters);
+
+    private:
+        // what the iterations of a loop may change.
+        struct Writes {
+            std::set<int> slots;
+            std::set<int> upvalues;
+            std::set<std::string> globals;
+            std::set<std::string> properties;
+            std::set<std::string> reads;
+            bool calls {false};
+        };
+
+        std::set<std::string>* getters {nullptr};
+        // frame size of the code being optimized.
+        unsigned int* frameSize {nullptr};
+
+        void collect(std::vector<SExpr>& statements);
+        void collect(SExpr& stmt);
+        void optimize(std::vector<SExpr>& statements);
+        void optimize(SExpr& stmt);
+        void optimize(Function& function);
+        void scan(SExpr& stmt, Writes& writes) const;
+        void scan(PExpr& expr, Writes& writes) const;
+        void hoist(SExpr& stmt, While& loop, const Writes& writes);
+        void hoist(PExpr& expr, While& loop, const Writes& writes);
+        static bool invariant(PExpr& expr, const Writes& writes);
+        // whether computing expr costs more than reading its slots.
+        static bool worth(PExpr& expr);
+        static bool variable(PExpr& expr);
+};
+
+} // namespace lox
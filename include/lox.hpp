@@ -1,21 +1,27 @@
 #pragma once
 
-#include "token.hpp"
+#include <string>
+#include "context.hpp"
 
 namespace lox {
 
 class Lox {
+    /*
+    The command line: runs a script file, or the lines typed at the prompt
+    one after the other, in a context of its own.
+    */
     public:
-       static void report (int line, std::string where, std::string message);
-       static void run (const std::string& source);
-       static void runFile (std::string path);
-       static void runPrompt();
-       static void error(int line, std::string message);
-       static void error(Token token, std::string message);
-       static void runtimeError(); // add argument later
+       explicit Lox(Options options);
+       void runFile(const std::string& path);
+       void runPrompt();
+       // writes the C++ translation of the script on stdout instead of running it.
+       void emitCpp(const std::string& path);
+       // prints what the interpreter's pools hold on stderr after each run.
+       void setHeapStats(bool enabled);
     private:
-        static bool hadError; 
-        static bool hadRuntimeError;
+        Context context;
+        bool heapStats {false};
+        Context::Status run(const std::string& source);
 };
 
-}
\ No newline at end of file
+}
@@ -3,14 +3,19 @@
 #include <vector>
 #include <chrono>
 #include <map>
+#include <unordered_map>
+#include <functional>
 #include "loxObject.hpp"
 #include "Stmt.hpp"
-#include "environment.hpp"
+#include "upvalue.hpp"
 
 
 namespace lox {
 
 using Arguments = std::vector<LoxObject>;
+class LoxFunction;
+class CompiledFunction;
+class CallFrame;
 
 class LoxCallable {
     public:
@@ -18,6 +23,15 @@ class LoxCallable {
         virtual LoxObject operator()(Interpreter& interpreter, std::vector<LoxObject> args) = 0;
         virtual size_t arity() const = 0;
         virtual std::string name() const = 0;
+        // cheaper than a dynamic_cast on the call path.
+        virtual LoxFunction* asFunction() { return nullptr; }
+        virtual CompiledFunction* asCompiled() { return nullptr; }
+    private:
+        // LoxObjects referring to the callable, its interpreter frees it
+        // when none is left.
+        size_t users {0};
+        friend class Interpreter;
+        friend class Collector;
 };
 
 class TimeFunction : public LoxCallable {
@@ -39,16 +53,17 @@ class TimeFunction : public LoxCallable {
 
 class LoxFunction : public LoxCallable {
     public:
-        LoxFunction(Function* declaration, Interpreter* intp, PEnvironment encl, bool isInit = false);
-        LoxFunction(LoxFunction& other, PEnvironment encl);
-        ~LoxFunction();
+        LoxFunction(Function* declaration, Interpreter* intp, Upvalues upvalues, bool isInit = false);
+        LoxFunction(LoxFunction& other, LoxObject receiver);
         size_t arity() const override { return declaration->params.size(); }
         std::string name() const override { return "<fun " + declaration->name.lexeme + ">"; }
         LoxObject operator()(Interpreter& in, std::vector<LoxObject> args) override ;
+        LoxObject call(Interpreter& in, CallFrame& frame);
+        LoxFunction* asFunction() override { return this; }
 
         // Needed getters & setters
-        PEnvironment getEnclosing() {
-            return enclosing;
+        Upvalues& getUpvalues() {
+            return upvalues;
         }
         Function* getDeclaration() {
             return declaration;
@@ -57,47 +72,138 @@ class LoxFunction : public LoxCallable {
         bool isGetter() const {
             return getter;
         }
+
+        bool isMethod() const {
+            return method;
+        }
+
+        LoxObject& getReceiver() {
+            return receiver;
+        }
     
     private:
         bool isInitializer;
         bool getter;
+        bool method;
         Function* declaration;
         Interpreter* interpreter;
-        PEnvironment enclosing;
+        Upvalues upvalues;
+        LoxObject receiver;     // "this" of a bound method.
+        friend class Collector;
 };
+
+class CompiledFunction : public LoxCallable {
+    /*
+    A function of a script translated to C++ by --emit-cpp. The body gets
+    a pointer to its arguments and the receiver the function is bound to,
+    nil for plain functions. Methods are bound by copying them with their
+    receiver, the body is shared.
+    */
+    public:
+        using Body = std::function<LoxObject(const LoxObject* args, const LoxObject& receiver)>;
+
+        CompiledFunction(std::string name, size_t arity, bool getter, Body body);
+        CompiledFunction(CompiledFunction& other, LoxObject receiver);
+        size_t arity() const override { return params; }
+        std::string name() const override { return "<fun " + fname + ">"; }
+        LoxObject operator()(Interpreter& in, std::vector<LoxObject> args) override {
+            return call(in, args.data());
+        }
+        LoxObject call(Interpreter& in, const LoxObject* args);
+        CompiledFunction* asCompiled() override { return this; }
+
+        // leaves a call in tail position for the running call to make once 
+        // the body has returned, so that tail recursion doesn't grow the 
+        // native stack. callee must be a compiled function.
+        static void tailCall(Interpreter& in, const LoxObject& callee, std::vector<LoxObject> args);
+
+        bool isGetter() const {
+            return getter;
+        }
+
+    private:
+        std::string fname;
+        size_t params;
+        bool getter;
+        std::shared_ptr<Body> body;
+        LoxObject receiver;
+
+    public:
+        struct TailCall {
+            LoxObject callee;
+            std::vector<LoxObject> args;
+        };
+};
+
 class LoxClass;
 
 class LoxInstance {
+    /*
+    The fields the class' init assigns to this live in slots laid out by
+    the class, allocated at once with the instance. A slot only holds a
+    field once assigned, which `present` tells. Fields added by any other
+    code go to a map.
+    */
     public:
         LoxInstance() = default;
         LoxInstance(LoxClass* klass_); 
-        std::string name() const { return "<instance " + cname.lexeme + ">"; }
+        LoxInstance(const LoxInstance&) = default;
+        // moved by the collector when it compacts the heap.
+        LoxInstance(LoxInstance&&) = default;
+        std::string name() const;
         LoxObject get(Token name);
         LoxObject set(Token name, LoxObject value);
+        bool getField(const std::string& name, LoxObject& value);
         LoxClass* getClass() const { return klass; };
         virtual ~LoxInstance() = default;   // so that I can use dynamic_cast.
     private:
         LoxClass* klass; 
-        Token cname;
-        std::map<std::string, LoxObject> fields {};
+        LoxObject klassObject;  // keeps the class alive as long as its instances.
+        Accounting::Vector<LoxObject, Accounting::Instances> slots {};
+        uint64_t present {0};
+        Accounting::Map<std::string, LoxObject, Accounting::Instances> fields {};
+        // LoxObjects referring to the instance, as for callables.
+        size_t users {0};
+        friend class Interpreter;
+        friend class Collector;
 };
 
 class LoxClass : public LoxCallable, public LoxInstance {
     public:
-        LoxClass(Class* stmt, LoxClass* superClass, Interpreter* intp, PEnvironment encl);
+        LoxClass(Class* stmt, LoxClass* superClass, Interpreter* intp);
+        // a class translated to C++, its methods are compiled functions.
+        LoxClass(Token name, LoxClass* superClass, Interpreter* intp, std::map<std::string, LoxObject> methods_);
         std::string name() const override { return "<class " + cname.lexeme + ">"; }
         LoxObject operator()(Interpreter& in, std::vector<LoxObject> args) override ;
         LoxObject function(Token name, LoxInstance* instance);
         LoxObject get(Token name);
         LoxObject set(Token name, LoxObject value);
+        bool getField(const std::string& name, LoxObject& value);
+        // unbound method looked up through the superclasses, nullptr if missing.
+        LoxFunction* findMethod(const std::string& name);
+        // the class' own init method, which class calls run.
+        LoxFunction* initializer();
+        // slot of the instances holding the field, -1 if it has none.
+        int slot(const std::string& field) const;
         size_t arity() const override;
     private:
         Interpreter* interpreter;
         LoxClass* super;
+        LoxObject superObject;  // keeps the superclass alive as long as the class.
         Token cname;
         std::map<std::string, LoxObject> methods {};
+        // every method the class answers to, its own and the inherited ones
+        // copied down from the superclass' table when the class is created,
+        // so that a lookup costs the same whatever the depth of the method.
+        std::unordered_map<std::string, LoxObject> table {};
         std::map<std::string, LoxObject> class_fields {};
+        // fields of the instances with a slot: the superclass' ones, then
+        // the ones the class' init assigns to this.
+        std::vector<std::string> layout {};
         friend class LoxInstance;
+        friend class Collector;
+
+        void flatten();
 
 };
 
@@ -4,6 +4,7 @@
 #include <ostream>
 #include <vector>
 #include "token.hpp"
+#include "accounting.hpp"
 
 namespace lox {
 
@@ -31,7 +32,7 @@ class LoxObject {
         LoxObject() : lox_type(LoxType::Nil) {}
         explicit LoxObject(bool b): lox_type(LoxType::Bool), boolean{b} {}
         explicit LoxObject(double d): lox_type(LoxType::Number), number{d} {}
-        explicit LoxObject(std::string s): lox_type(LoxType::String), string{s} {}
+        explicit LoxObject(const std::string& s): lox_type(LoxType::String), string{s.begin(), s.end()} {}
         explicit LoxObject( LoxCallable* callable, Interpreter* in);
         explicit LoxObject( LoxClass* lk, Interpreter* in);
         explicit LoxObject( LoxInstance* li, Interpreter* in);
@@ -77,6 +78,11 @@ class LoxObject {
             return lox_type;
         }
 
+        // the value of a Number, without conversion.
+        double getNumber() const {
+            return number;
+        }
+
         LoxClass* getLoxClass() const {
             return loxklass;
         }
@@ -86,13 +92,19 @@ class LoxObject {
         LoxType lox_type = LoxType::Nil;
         double number = 0.;
         bool boolean = false;
-        std::string string = "";
+        // charged to the interpreter running when it's allocated.
+        Accounting::String string;
         LoxCallable* function = nullptr;
         Interpreter* interpreter = nullptr;
         LoxClass* loxklass = nullptr;
         LoxInstance* instance = nullptr;
 
 
+        // drops the reference to the callable, class or instance held.
+        void release();
+        // which moves instances.
+        friend class Collector;
+
         void cast(LoxType t) {
             if (t == lox_type) return;
             if (lox_type == LoxType::Callable) {
@@ -105,7 +117,11 @@ class LoxObject {
                 case LoxType::Nil: break;
                 case LoxType::Bool: boolean = (bool)(*this); break;
                 case LoxType::Number: number = (double)(*this); break;
-                case LoxType::String: string = (std::string)(*this); break;
+                case LoxType::String: {
+                    std::string text = (std::string)(*this);
+                    string.assign(text.begin(), text.end());
+                    break;
+                }
                 case LoxType::Callable:
                     throw std::runtime_error("Cannot convert non-callable to callable");
                 // handle other types later
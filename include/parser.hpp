@@ -5,7 +5,7 @@
 #include <exception>
 #include "Expr.hpp"
 #include "token.hpp"
-#include "lox.hpp"
+#include "errors.hpp"
 #include "Stmt.hpp"
 #include "type.hpp"
 
@@ -14,7 +14,7 @@ namespace lox {
 
 class Parser {
     public:
-        Parser(std::vector<Token>& tokens_ );
+        Parser(std::vector<Token>& tokens_, Errors& errors_);
         std::vector<std::unique_ptr<Stmt>> parse();
 
     private:
@@ -24,6 +24,7 @@ class Parser {
 
         std::vector<Token> tokens;
         unsigned int current;
+        Errors& errors;
         //We use the boolean variable below to prevent commaOperator to parse inside function call. 
         // or on Maybe there's a better way to do that ? I DUNNO.
         bool isCall{false}; // 
@@ -195,7 +196,7 @@ class Parser {
                 if (!check(RIGHT_PARENT)){
                     do {
                         if (parameters.size() >= 255) {
-                            Lox::error(peek(), "Can't have more than 255 parameters");
+                            errors.error(peek(), "Can't have more than 255 parameters");
                         }
 
                         parameters.push_back(
@@ -237,7 +238,7 @@ class Parser {
                     auto getExpr = std::unique_ptr<Get>(static_cast<Get*>(expr.release()));
                     return std::make_unique<Set>(std::move(getExpr->object), getExpr->name, std::move(value));
                 } 
-                Lox::error(equals, "Invalid assignment target.");
+                errors.error(equals, "Invalid assignment target.");
             }
             return expr;
         }
@@ -407,7 +408,7 @@ class Parser {
             if (!check(RIGHT_PARENT)) {
                 do {
                     if (arguments.size() >= 255) {
-                        Lox::error(peek(), "Can't have more than 255 arguments");
+                        errors.error(peek(), "Can't have more than 255 arguments");
                     }
                     arguments.push_back(expression());
                 } while(match({COMMA}));
@@ -452,7 +453,7 @@ class Parser {
         }
 
         ParseError error(Token token, std::string message) {
-            Lox::error(token, message);
+            errors.error(token, message);
 
             return ParseError{message};
         }
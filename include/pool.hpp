@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+#include "accounting.hpp"
+
+namespace lox {
+
+// what a pool holds, printed by --heap-stats.
+struct PoolStats {
+    size_t live {0};        // blocks allocated and not freed yet.
+    size_t capacity {0};    // blocks the slabs have room for.
+    size_t slabs {0};
+    size_t blockSize {0};
+    size_t bytes() const;
+    double utilization() const { return capacity ? double(live) / capacity : 0; }
+};
+
+class Slabs {
+    /*
+    Hands out blocks of one size carved from slabs of SLAB_BYTES, and keeps
+    the freed ones on a list which the next allocations pop. Slabs are
+    aligned on their size so that a block finds the header of its slab,
+    which marks the blocks in use, by masking its address. Slabs are only
+    given back to the system all at once, by release. They are charged to
+    account as kind.
+    */
+    public:
+        static constexpr size_t SLAB_BYTES = 64 * 1024;
+
+        // blockSize 0 takes the size of the first allocation.
+        Slabs(Accounting::Account* account, Accounting::Kind kind, size_t blockSize = 0);
+        ~Slabs() { release(); }
+        Slabs(const Slabs&) = delete;
+        Slabs& operator=(const Slabs&) = delete;
+
+        void* allocate(size_t size);
+        void deallocate(void* block);
+        // calls f with every block in use, the ones it frees are skipped.
+        template <class F> void forEachLive(F f);
+        // frees every slab, blocks still in use included.
+        void release();
+        // forgets the free blocks: the next allocations take fresh slabs,
+        // in address order, until trim threads the free blocks again and
+        // frees the slabs left without any block in use.
+        void startFresh() { freeList = nullptr; }
+        void trim();
+        PoolStats stats() const;
+
+    private:
+        struct Slab {
+            uint64_t live[SLAB_BYTES / alignof(std::max_align_t) / 64];
+        };
+        static constexpr size_t HEADER = (sizeof(Slab) + alignof(std::max_align_t) - 1)
+                                         / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+        size_t blockSize;
+        size_t perSlab {0};
+        size_t live {0};
+        std::vector<Slab*> slabs;
+        void* freeList {nullptr};
+        Accounting::Account* account;
+        Accounting::Kind kind;
+
+        void setBlockSize(size_t size);
+        void grow();
+        static Slab* slabOf(void* block) {
+            return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(block) & ~(SLAB_BYTES - 1));
+        }
+        char* block(Slab* slab, size_t i) const {
+            return reinterpret_cast<char*>(slab) + HEADER + i * blockSize;
+        }
+};
+
+template <class F>
+void Slabs::forEachLive(F f) {
+    for (size_t s = 0; s < slabs.size(); s++) {
+        for (size_t i = 0; i < perSlab; i++) {
+            if (slabs[s]->live[i / 64] & (uint64_t{1} << (i % 64))) f(block(slabs[s], i));
+        }
+    }
+}
+
+template <class T>
+class Pool {
+    /*
+    Objects of type T allocated from slabs. Destroying the pool destroys
+    the objects still alive in it, then frees the slabs.
+    */
+    public:
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned type");
+
+        Pool(Accounting::Account* account, Accounting::Kind kind) : slabs{account, kind, sizeof(T)} {}
+        ~Pool() { clear(); }
+
+        template <class... Args>
+        T* create(Args&&... args) {
+            void* block = slabs.allocate(sizeof(T));
+            try {
+                return new (block) T(std::forward<Args>(args)...);
+            } catch (...) {
+                slabs.deallocate(block);
+                throw;
+            }
+        }
+
+        void destroy(T* object) {
+            object->~T();
+            slabs.deallocate(object);
+        }
+
+        void clear() {
+            slabs.forEachLive([this](void* block) { destroy(static_cast<T*>(block)); });
+            slabs.release();
+        }
+
+        // moves the objects of order to fresh slabs, one after the other,
+        // calling moved(from, to) for each, then frees the slabs emptied.
+        template <class F>
+        void compact(const std::vector<T*>& order, F moved) {
+            slabs.startFresh();
+            for (T* object : order) {
+                T* copy = new (slabs.allocate(sizeof(T))) T(std::move(*object));
+                object->~T();
+                moved(object, copy);
+            }
+            for (T* object : order) slabs.deallocate(object);
+            slabs.trim();
+        }
+
+        PoolStats stats() const { return slabs.stats(); }
+
+    private:
+        Slabs slabs;
+};
+
+template <class T>
+class PoolAllocator {
+    /*
+    Standard allocator over slabs, for std::allocate_shared: the object and
+    the control block of a shared pointer are then a single block.
+    */
+    public:
+        using value_type = T;
+
+        explicit PoolAllocator(Slabs& slabs_) : slabs{&slabs_} {}
+        template <class U>
+        PoolAllocator(const PoolAllocator<U>& other) : slabs{other.slabs} {}
+
+        T* allocate(size_t n) { return static_cast<T*>(slabs->allocate(n * sizeof(T))); }
+        void deallocate(T* p, size_t) { slabs->deallocate(p); }
+
+        template <class U>
+        bool operator==(const PoolAllocator<U>& other) const { return slabs == other.slabs; }
+        template <class U>
+        bool operator!=(const PoolAllocator<U>& other) const { return slabs != other.slabs; }
+
+    private:
+        Slabs* slabs;
+        template <class U> friend class PoolAllocator;
+};
+
+} // namespace lox
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <initializer_list>
+#include "Expr.hpp"
+#include "Stmt.hpp"
+#include "chunk.hpp"
+
+namespace lox {
+
+class RegisterCompiler : public ExprVisitor, public StmtVisitor {
+    /*
+    Compiles resolved statements to register code. The slots the resolver
+    assigned to locals are used as registers directly, so reading a local
+    costs no instruction and `a + b` is a single ADD. Temporaries are
+    allocated as a stack right above the locals and released as soon as
+    the expression that needed them is compiled.
+    */
+    public:
+        using SExpr = std::unique_ptr<Stmt>;
+        using PExpr = std::unique_ptr<Expr>;
+
+        static Chunk& compile(Function& function);
+        static std::unique_ptr<Chunk> compile(std::vector<SExpr>& statements, unsigned int frameSize);
+
+        // Expr
+        LoxObject visitAssignExpr(Assign& expr) override;
+        LoxObject visitBinaryExpr(Binary& expr) override;
+        LoxObject visitCallExpr(Call& expr) override;
+        LoxObject visitCommaExprExpr(CommaExpr& expr) override;
+        LoxObject visitGetExpr(Get& expr) override;
+        LoxObject visitGroupingExpr(Grouping& expr) override;
+        LoxObject visitHoistedExpr(Hoisted& expr) override;
+        LoxObject visitInlinedExpr(Inlined& expr) override;
+        LoxObject visitLiteralExpr(Literal& expr) override;
+        LoxObject visitLogicalExpr(Logical& expr) override;
+        LoxObject visitSetExpr(Set& expr) override;
+        LoxObject visitSuperExpr(Super& expr) override;
+        LoxObject visitTernaryExpr(Ternary& expr) override;
+        LoxObject visitThisExpr(This& expr) override;
+        LoxObject visitUnaryExpr(Unary& expr) override;
+        LoxObject visitVariableExpr(Variable& expr) override;
+
+        // Stmt
+        void visitBlockStmt(Block& stmt) override;
+        void visitClassStmt(Class& stmt) override;
+        void visitExpressionStmt(Expression& stmt) override;
+        void visitFunctionStmt(Function& stmt) override;
+        void visitIfStmt(If& stmt) override;
+        void visitPrintStmt(Print& stmt) override;
+        void visitReturnStmt(Return& stmt) override;
+        void visitVarStmt(Var& stmt) override;
+        void visitWhileStmt(While& stmt) override;
+
+    private:
+        RegisterCompiler(Chunk& chunk_, int receiver_ = -1)
+            : chunk{chunk_}, receiver{receiver_}, top{chunk_.frameSize} {}
+
+        Chunk& chunk;
+        // slot of the receiver an initializer returns, -1 elsewhere.
+        int receiver;
+        // first free temporary.
+        unsigned int top;
+        // where the expression being compiled must leave its value, -1 when
+        // any register will do. The visitor reports the one it used in result.
+        int target {-1};
+        unsigned int result {0};
+
+        // compiles expr and returns the register holding its value. With a
+        // destination the value always ends up there.
+        unsigned int expr(PExpr& e, int destination = -1);
+        void statement(SExpr& stmt);
+
+        unsigned int allocate();
+        unsigned int destination() { return target >= 0 ? target : allocate(); }
+        bool isLocal(unsigned int reg) const { return reg < chunk.frameSize; }
+
+        void emit(RegisterOp op, std::initializer_list<size_t> operands);
+        size_t emitJump(RegisterOp op, std::initializer_list<size_t> operands = {});
+        void patchJump(size_t jump);
+        void emitLoop(size_t start);
+        size_t name(const Token& token);
+        void call(Call& expr, RegisterOp op);
+};
+
+} // namespace lox
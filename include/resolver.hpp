@@ -2,9 +2,12 @@
 
 #include <stack>
 #include <map>
+#include <algorithm>
 #include "Expr.hpp"
 #include "Stmt.hpp"
 #include "interpreter.hpp"
+#include "errors.hpp"
+#include "type.hpp"
 
 namespace lox {
 
@@ -13,7 +16,10 @@ class Resolver : public ExprVisitor, public StmtVisitor {
     public:
         using SExpr = std::unique_ptr<Stmt>;
         using PExpr = std::unique_ptr<Expr>;
-        Resolver(Interpreter* intp): interpreter{intp} {}
+        Resolver(Interpreter* intp, Errors& errors_): interpreter{intp}, errors{errors_} {}
+
+        // slots needed by the block scopes of the top-level code.
+        unsigned int frameSize() const { return scriptFrame.size; }
 
         void resolve(std::vector<SExpr>& statements) {
 
@@ -23,13 +29,13 @@ class Resolver : public ExprVisitor, public StmtVisitor {
 
         }
 
-        void reportUnusedVariables() {
+        void reportUnusedVariables(std::ostream& out = std::cout) {
 
             // report unused variables
             for (auto& scope: var_initializations) {
                 for (auto it = scope.begin(); it != scope.end(); it++) {
                     if (!it->second) {
-                        std::cout << "variable " << it->first << " declared but unused.\n";
+                        out << "variable " << it->first << " declared but unused.\n";
                     }
                 }
             }
@@ -37,23 +43,25 @@ class Resolver : public ExprVisitor, public StmtVisitor {
 
         void visitBlockStmt(Block& stmt) override {
             beginScope();
+            stmt.firstSlot = currentFrame->next;
             resolve(stmt.statements);
-            endScope();
+            stmt.captured = endScope();
         }
 
         void visitClassStmt(Class& stmt) {
             ClassType enclosingClass = currentClass;
             currentClass = ClassType::CLASS;
 
-            declare(stmt.name);
+            declare(stmt.name, &stmt.slot);
             define(stmt.name);
+            if (stmt.slot < 0) stmt.global = interpreter->globalIndex(stmt.name.lexeme);
 
             // Resolve possible superclass
             if (stmt.superclass) {
                 
                 auto superclassName = static_cast<Variable*>(stmt.superclass.get())->name;
                 if (stmt.name.lexeme == superclassName.lexeme) {
-                    Lox::error(superclassName, "A class can't inherit from itself.");
+                    errors.error(superclassName, "A class can't inherit from itself.");
                 }
 
                 currentClass = ClassType::SUBCLASS;
@@ -61,23 +69,23 @@ class Resolver : public ExprVisitor, public StmtVisitor {
                 resolve(stmt.superclass);
             }
 
+            // "super" is a local of the enclosing code that methods capture.
             if (stmt.superclass) {
                 beginScope();
-                scopes.back()["super"] = true;
+                declare({IDENTIFIER, "super", stmt.name.line}, &stmt.superSlot);
+                define({IDENTIFIER, "super", stmt.name.line});
             }
 
-            beginScope();
-            scopes.back()["this"] = true;
-
+            std::vector<std::string>* enclosingFields = initFields;
             for (auto& method: stmt.methods) {
                 FunctionType declaration = FunctionType::METHOD;
                 if (method->name.lexeme == "init") {
                     declaration = FunctionType::INITIALIZER;
                 }
+                initFields = declaration == FunctionType::INITIALIZER ? &stmt.fields : nullptr;
                 resolveFunction(*method, declaration); // not sure if this is a good practice.
             }
-
-            endScope();
+            initFields = enclosingFields;
 
             if (stmt.superclass) endScope();
             currentClass = enclosingClass;
@@ -85,7 +93,8 @@ class Resolver : public ExprVisitor, public StmtVisitor {
         }
 
         void visitVarStmt(Var& stmt) override {
-            declare(stmt.name);
+            declare(stmt.name, &stmt.slot);
+            if (stmt.slot < 0) stmt.global = interpreter->globalIndex(stmt.name.lexeme);
             if (stmt.initializer) {
                 resolve(stmt.initializer);
             }
@@ -99,26 +108,27 @@ class Resolver : public ExprVisitor, public StmtVisitor {
             if (!scopes.empty() &&
                 scopes.back().find(expr.name.lexeme) != scopes.back().end() && 
                 scopes.back().at(expr.name.lexeme) == false) {
-                    Lox::error(expr.name, 
+                    errors.error(expr.name, 
                         "Can't read local variable in its own initializer");
             }
             if (!var_initializations.empty()) {
                 var_initializations.back()[expr.name.lexeme] = true;
             }
 
-            resolveLocal(expr, expr.name);
+            resolveLocal(expr.name, expr.slot, expr.upvalue, &expr.global);
             return LoxObject();
         }
 
         LoxObject visitAssignExpr(Assign& expr) override {
             resolve(expr.value);
-            resolveLocal(expr, expr.name);
+            resolveLocal(expr.name, expr.slot, expr.upvalue, &expr.global);
             return LoxObject();
         }
 
         void visitFunctionStmt(Function& stmt) override {
-            declare(stmt.name);
+            declare(stmt.name, &stmt.slot);
             define(stmt.name);
+            if (stmt.slot < 0) stmt.global = interpreter->globalIndex(stmt.name.lexeme);
 
             resolveFunction(stmt, FunctionType::FUNCTION);
         }
@@ -139,12 +149,15 @@ class Resolver : public ExprVisitor, public StmtVisitor {
 
         void visitReturnStmt(Return& stmt) override {
             if (currentFunction == FunctionType::NONE) {
-                Lox::error(stmt.keyword, "Cant return from top-level code.");
+                errors.error(stmt.keyword, "Cant return from top-level code.");
             }
             if (stmt.value) {
                 if (currentFunction == FunctionType::INITIALIZER) {
-                    Lox::error(stmt.keyword, "Can't return a value from an initlializer.");
+                    errors.error(stmt.keyword, "Can't return a value from an initlializer.");
                 }
+                // nothing is left to do in the frame once the call returns, 
+                // so the callee can reuse it.
+                stmt.tailCall = TypeIdentifier{}.identify(stmt.value) == Type::Call;
                 resolve(stmt.value);
             } 
         }
@@ -185,6 +198,16 @@ class Resolver : public ExprVisitor, public StmtVisitor {
             return LoxObject();
         }
 
+        LoxObject visitInlinedExpr(Inlined& expr) override {
+            // inlining comes after resolution, only the original was resolved.
+            return LoxObject();
+        }
+
+        LoxObject visitHoistedExpr(Hoisted& expr) override {
+            // so does hoisting.
+            return LoxObject();
+        }
+
         LoxObject visitLiteralExpr(Literal& expr) override {
             return LoxObject();
         }
@@ -198,27 +221,34 @@ class Resolver : public ExprVisitor, public StmtVisitor {
         LoxObject visitSetExpr(Set& expr) override {
             resolve(expr.value);
             resolve(expr.object);
+            // instances get a slot for each field their init sets.
+            if (currentFunction == FunctionType::INITIALIZER && initFields
+                && TypeIdentifier{}.identify(expr.object) == Type::This
+                && std::find(initFields->begin(), initFields->end(), expr.name.lexeme) == initFields->end()) {
+                initFields->push_back(expr.name.lexeme);
+            }
             return LoxObject();
         }
 
         LoxObject visitSuperExpr(Super& expr) {
             if (currentClass == ClassType::NONE) {
-                Lox::error(expr.keyword, "Can't use 'super' outside of a class.");
+                errors.error(expr.keyword, "Can't use 'super' outside of a class.");
             } else if (currentClass != ClassType::SUBCLASS) {
-                Lox::error(expr.keyword, "Can't use 'super' in a class with no super class.");
+                errors.error(expr.keyword, "Can't use 'super' in a class with no super class.");
             }
-            resolveLocal(expr, expr.keyword);
+            resolveLocal(expr.keyword, expr.slot, expr.upvalue);
+            resolveLocal({THIS, "this", expr.keyword.line}, expr.thisSlot, expr.thisUpvalue);
             return LoxObject();
         }
 
         LoxObject visitThisExpr(This& expr) override {
             if (currentClass == ClassType::NONE) {
-                Lox::error(expr.keyword, "Can't use 'this' outside of a class.");
+                errors.error(expr.keyword, "Can't use 'this' outside of a class.");
             }
             if (currentFunction == FunctionType::CLASS_METHOD) {
-                Lox::error(expr.keyword, "Can't use 'this' inside method class.");
+                errors.error(expr.keyword, "Can't use 'this' inside method class.");
             }
-            resolveLocal(expr, expr.keyword);
+            resolveLocal(expr.keyword, expr.slot, expr.upvalue);
             return LoxObject();
         }
 
@@ -249,11 +279,34 @@ class Resolver : public ExprVisitor, public StmtVisitor {
             CLASS_METHOD
         };
         
+        // Every local lives in a slot of the call frame of the function that 
+        // declares it. A nested function reaching into an enclosing frame
+        // gets an upvalue instead, described in its declaration so that the
+        // interpreter can capture the variable when it creates the closure.
+        struct Frame {
+            unsigned int next {0};
+            unsigned int size {0};
+            size_t firstScope {0};
+            std::vector<UpvalueDesc>* upvalues {nullptr};
+        };
+
+        struct Scope {
+            std::map<std::string, unsigned int> slots {};
+            bool captured {false};
+        };
+
         ClassType currentClass {ClassType::NONE};
         FunctionType currentFunction {FunctionType::NONE};
+        // fields of the class whose init is being resolved.
+        std::vector<std::string>* initFields {nullptr};
+        Frame scriptFrame {};
+        Frame* currentFrame {&scriptFrame};
         Interpreter* interpreter;
+        Errors& errors;
         std::vector<std::map<std::string, bool>> scopes {};
         std::vector<std::map<std::string, bool>>  var_initializations {};
+        std::vector<Scope> frameScopes {};
+        std::vector<Frame*> frames {&scriptFrame};
 
         void resolve(SExpr& stmt) {
             stmt->accept(*this);
@@ -266,19 +319,32 @@ class Resolver : public ExprVisitor, public StmtVisitor {
         void beginScope() {
             scopes.push_back({});
             var_initializations.push_back({});
+            frameScopes.push_back({});
         }
 
-        void endScope() {
+        bool endScope() {
+            // slots of a finished block are reused by the next one.
+            bool captured = frameScopes.back().captured;
+            currentFrame->next -= frameScopes.back().slots.size();
             scopes.pop_back();
+            frameScopes.pop_back();
+            return captured;
         }
 
-        void declare(Token name) {
+        void declare(Token name, int* slot = nullptr) {
             if (scopes.empty()) return;
 
             if (scopes.back().find(name.lexeme) != scopes.back().end()) {
-                Lox::error(name, "Already a variable with this name in this scope.");
+                errors.error(name, "Already a variable with this name in this scope.");
             }
             scopes.back()[name.lexeme] = false;
+
+            Scope& scope = frameScopes.back();
+            if (scope.slots.find(name.lexeme) == scope.slots.end()) {
+                scope.slots[name.lexeme] = currentFrame->next++;
+                currentFrame->size = std::max(currentFrame->size, currentFrame->next);
+            }
+            if (slot) *slot = scope.slots[name.lexeme];
         }
 
         void define(Token name) {
@@ -286,27 +352,72 @@ class Resolver : public ExprVisitor, public StmtVisitor {
             scopes.back()[name.lexeme] = true;
         }
 
-        void resolveLocal(Expr& expr, Token name) {
-            unsigned int scope_depth = 0; 
-            for (auto r_iter = scopes.rbegin(); r_iter != scopes.rend(); r_iter++) {
-                if (r_iter->find(name.lexeme) != r_iter->end()) {
-                    interpreter->resolve(&expr, scope_depth);
-                    return;
-                }  
-                scope_depth++;
+        // a name neither local nor captured is a global, whose index goes
+        // to global when the caller expects one.
+        void resolveLocal(Token name, int& slot, int& upvalue, int* global = nullptr) {
+            int scope = findLocal(frames.size() - 1, name);
+            if (scope >= 0) {
+                slot = frameScopes[scope].slots.at(name.lexeme);
+                return;
+            }
+            upvalue = resolveUpvalue(frames.size() - 1, name);
+            if (upvalue < 0 && global) *global = interpreter->globalIndex(name.lexeme);
+        }
+
+        // index of the innermost scope of the given frame declaring the name.
+        int findLocal(size_t frame, Token& name) {
+            size_t end = frame + 1 < frames.size() ? frames[frame + 1]->firstScope : scopes.size();
+            for (int i = end - 1; i >= static_cast<int>(frames[frame]->firstScope); i--) {
+                if (scopes[i].find(name.lexeme) != scopes[i].end()) return i;
             }
+            return -1;
+        }
+
+        int resolveUpvalue(size_t frame, Token& name) {
+            if (frame == 0) return -1;
+
+            int scope = findLocal(frame - 1, name);
+            if (scope >= 0) {
+                frameScopes[scope].captured = true;
+                return addUpvalue(frame, {true, frameScopes[scope].slots.at(name.lexeme)});
+            }
+
+            int upvalue = resolveUpvalue(frame - 1, name);
+            if (upvalue >= 0) return addUpvalue(frame, {false, static_cast<unsigned int>(upvalue)});
+            return -1;
+        }
+
+        int addUpvalue(size_t frame, UpvalueDesc desc) {
+            auto& upvalues = *frames[frame]->upvalues;
+            for (size_t i = 0; i < upvalues.size(); i++) {
+                if (upvalues[i].isLocal == desc.isLocal && upvalues[i].index == desc.index) return i;
+            }
+            upvalues.push_back(desc);
+            return upvalues.size() - 1;
         }
 
         void resolveFunction(Function& function, FunctionType type) {
             FunctionType enclosingFunction = currentFunction;
+            Frame* enclosingFrame = currentFrame;
+            Frame frame {0, 0, scopes.size(), &function.upvalues};
             currentFunction = type;
+            currentFrame = &frame;
+            frames.push_back(&frame);
             beginScope();
             for(auto param : function.params) {
                 declare(param);
                 define(param);
             }
+            // methods find their receiver in the slot following the parameters.
+            if (type != FunctionType::FUNCTION) {
+                declare({THIS, "this", function.name.line});
+                define({THIS, "this", function.name.line});
+            }
             resolve(function.body);
             endScope();
+            function.frameSize = frame.size;
+            frames.pop_back();
+            currentFrame = enclosingFrame;
             currentFunction = enclosingFunction;
         }
 
@@ -1,7 +1,7 @@
 #pragma once 
 
 #include "token.hpp"
-#include "lox.hpp"
+#include "errors.hpp"
 #include <vector>
 #include <map>
 #include <stack>
@@ -12,7 +12,7 @@ namespace lox {
 class Scanner {
 
     public:
-        Scanner(const std::string& source);
+        Scanner(const std::string& source, Errors& errors);
         std::vector<Token> scanTokens();
 
     private:
@@ -20,6 +20,7 @@ class Scanner {
         unsigned int current;
         unsigned int line;
         const std::string& source;
+        Errors& errors;
         std::vector<Token> tokens;
 
         inline bool isAtEnd() const { return current > source.length(); }
@@ -73,7 +74,7 @@ class Scanner {
                             advance();
                         }
                         if (!stack.empty()) { 
-                            Lox::error(line, "Unterminated comment");
+                            errors.error(line, "Unterminated comment");
                             return;
                         }
                     } else {
@@ -98,7 +99,7 @@ class Scanner {
                     } else if (isAlpha(c)) {
                         identifier();
                     } else {
-                        Lox::error(line, "Unexpected character");
+                        errors.error(line, "Unexpected character");
                     }
                     break;
             }
@@ -155,7 +156,7 @@ class Scanner {
             }
 
             if(isAtEnd()) {
-                Lox::error(line, "Unterminated string.");
+                errors.error(line, "Unterminated string.");
                 return;
             }
 
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include "interpreter.hpp"
+#include "loxCallable.hpp"
+
+namespace lox {
+namespace transpiled {
+
+/*
+Runtime of the C++ code written by --emit-cpp. Values are LoxObjects,
+functions CompiledFunctions and classes LoxClasses, owned by an Interpreter
+that only serves as their heap: nothing is parsed or walked at run time.
+The operands of an operator, or the callee and the arguments of a call,
+are passed as a braced list so that C++ evaluates them from left to right
+as Lox does.
+*/
+
+// a local captured by closures, shared by all of them.
+using Cell = std::shared_ptr<LoxObject>;
+
+class Global {
+    // A global variable of the script, which only exists once defined.
+    public:
+        explicit Global(const char* name_) : name{name_} {}
+
+        LoxObject& get(unsigned int line) {
+            if (!defined) undefined(line);
+            return value;
+        }
+
+        void define(const LoxObject& v) {
+            value = v;
+            defined = true;
+        }
+
+        LoxObject& assign(const LoxObject& v, unsigned int line) {
+            if (!defined) undefined(line);
+            return value = v;
+        }
+
+    private:
+        const char* name;
+        bool defined {false};
+        LoxObject value;
+
+        [[noreturn]] void undefined(unsigned int line) const {
+            throw std::runtime_error("Undefined variable '" + std::string(name)
+                                     + "' [line " + std::to_string(line) + "]");
+        }
+};
+
+inline bool truthy(const LoxObject& value) {
+    return static_cast<bool>(value);
+}
+
+inline bool numbers(const LoxObject (&operands)[2]) {
+    return operands[0].getLoxObjectType() == LoxType::Number
+        && operands[1].getLoxObjectType() == LoxType::Number;
+}
+
+// Numbers are computed right away, everything else goes through the
+// operators of LoxObject with their conversions and errors.
+inline LoxObject add(const LoxObject (&operands)[2]) {
+    if (numbers(operands)) return LoxObject(double(operands[0]) + double(operands[1]));
+    return operands[0] + operands[1];
+}
+
+inline LoxObject subtract(const LoxObject (&operands)[2]) {
+    if (numbers(operands)) return LoxObject(double(operands[0]) - double(operands[1]));
+    return operands[0] - operands[1];
+}
+
+inline LoxObject multiply(const LoxObject (&operands)[2]) {
+    if (numbers(operands)) return LoxObject(double(operands[0]) * double(operands[1]));
+    return operands[0] * operands[1];
+}
+
+inline LoxObject divide(const LoxObject (&operands)[2]) {
+    if (numbers(operands) && double(operands[1]) != 0.) {
+        return LoxObject(double(operands[0]) / double(operands[1]));
+    }
+    return operands[0] / operands[1];
+}
+
+inline LoxObject less(const LoxObject (&operands)[2]) {
+    if (numbers(operands)) return LoxObject(double(operands[0]) < double(operands[1]));
+    return LoxObject(operands[0] < operands[1]);
+}
+
+inline LoxObject lessEqual(const LoxObject (&operands)[2]) {
+    if (numbers(operands)) {
+        double a = operands[0], b = operands[1];
+        return LoxObject(a < b || a == b);
+    }
+    return LoxObject(operands[0] <= operands[1]);
+}
+
+inline LoxObject greater(const LoxObject (&operands)[2]) {
+    if (numbers(operands)) {
+        double a = operands[0], b = operands[1];
+        return LoxObject(!(a < b || a == b));
+    }
+    return LoxObject(operands[0] > operands[1]);
+}
+
+inline LoxObject greaterEqual(const LoxObject (&operands)[2]) {
+    if (numbers(operands)) return LoxObject(!(double(operands[0]) < double(operands[1])));
+    return LoxObject(operands[0] >= operands[1]);
+}
+
+inline LoxObject equal(const LoxObject (&operands)[2]) {
+    return LoxObject(operands[0] == operands[1]);
+}
+
+inline LoxObject notEqual(const LoxObject (&operands)[2]) {
+    return LoxObject(operands[0] != operands[1]);
+}
+
+inline LoxObject negate(LoxObject value) {
+    return -value;
+}
+
+inline LoxObject logicalNot(LoxObject value) {
+    return !value;
+}
+
+// values holds the callee followed by the arguments.
+template <size_t N>
+LoxObject call(Interpreter& in, const LoxObject (&values)[N]) {
+    const LoxObject& callee = values[0];
+    if (callee.getLoxObjectType() == LoxType::Callable) {
+        if (CompiledFunction* function = callee.getFunction()->asCompiled()) {
+            if (function->arity() != N - 1) {
+                throw std::runtime_error("Function argument count mismatch. Expected "
+                    + std::to_string(function->arity()) + ", got "
+                    + std::to_string(N - 1) + "\n");
+            }
+            return function->call(in, values + 1);
+        }
+    } else if (callee.getLoxObjectType() != LoxType::Class) {
+        throw std::runtime_error("Can only call functions and classes.");
+    }
+    LoxObject object = callee;
+    return object(in, std::vector<LoxObject>(values + 1, values + N));
+}
+
+// a call in tail position, made by the running call once it has returned.
+template <size_t N>
+LoxObject tailCall(Interpreter& in, const LoxObject (&values)[N]) {
+    const LoxObject& callee = values[0];
+    CompiledFunction* function = callee.getLoxObjectType() == LoxType::Callable
+                               ? callee.getFunction()->asCompiled() : nullptr;
+    if (!function || function->arity() != N - 1) return call(in, values);
+    CompiledFunction::tailCall(in, callee, std::vector<LoxObject>(values + 1, values + N));
+    return LoxObject();
+}
+
+inline LoxObject function(Interpreter& in, const char* name, size_t arity, bool getter,
+                          CompiledFunction::Body body) {
+    return in.createCallable(std::make_unique<CompiledFunction>(name, arity, getter, std::move(body)));
+}
+
+inline LoxObject superclass(const LoxObject& value) {
+    if (value.getLoxObjectType() != LoxType::Class) {
+        throw std::runtime_error("Superclass must be a class.");
+    }
+    return value;
+}
+
+inline LoxObject klass(Interpreter& in, const char* name, const LoxObject& superclass,
+                       std::map<std::string, LoxObject> methods) {
+    return in.createClass({IDENTIFIER, name, 0}, superclass, std::move(methods));
+}
+
+inline LoxObject get(LoxObject object, const Token& name) {
+    return object.get(name);
+}
+
+// operands holds the object and the value.
+inline LoxObject set(const LoxObject (&operands)[2], const Token& name) {
+    LoxObject object = operands[0];
+    return object.set(name, operands[1]);
+}
+
+inline LoxObject superMethod(const LoxObject& superclass, const LoxObject& receiver, const Token& method) {
+    return superclass.getLoxClass()->function(method, receiver.getInstance());
+}
+
+inline LoxObject nativeClock(Interpreter& in) {
+    return in.createCallable(std::make_unique<TimeFunction>());
+}
+
+// runs the translated script, with the exit status of the interpreter.
+inline int run(void (*script)()) {
+    try {
+        script();
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << '\n';
+        return 70;
+    }
+    return 0;
+}
+
+} // namespace transpiled
+} // namespace lox
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Expr.hpp"
+#include "Stmt.hpp"
+
+namespace lox {
+
+class Transpiler : public ExprVisitor, public StmtVisitor {
+    /*
+    Translates a resolved script to a C++ translation unit running on the
+    runtime of transpiled.hpp. Locals become C++ locals, or shared cells
+    when the resolver saw closures capture their slot, functions become
+    lambdas and globals variables of the unit that check they're defined
+    when used. The unit is then compiled by the system compiler and linked
+    with the interpreter's sources but main.cpp.
+    */
+    public:
+        using SExpr = std::unique_ptr<Stmt>;
+        using PExpr = std::unique_ptr<Expr>;
+
+        static void emit(std::vector<SExpr>& statements, std::ostream& out);
+
+        // Expr
+        LoxObject visitAssignExpr(Assign& expr) override;
+        LoxObject visitBinaryExpr(Binary& expr) override;
+        LoxObject visitCallExpr(Call& expr) override;
+        LoxObject visitCommaExprExpr(CommaExpr& expr) override;
+        LoxObject visitGetExpr(Get& expr) override;
+        LoxObject visitGroupingExpr(Grouping& expr) override;
+        LoxObject visitHoistedExpr(Hoisted& expr) override;
+        LoxObject visitInlinedExpr(Inlined& expr) override;
+        LoxObject visitLiteralExpr(Literal& expr) override;
+        LoxObject visitLogicalExpr(Logical& expr) override;
+        LoxObject visitSetExpr(Set& expr) override;
+        LoxObject visitSuperExpr(Super& expr) override;
+        LoxObject visitTernaryExpr(Ternary& expr) override;
+        LoxObject visitThisExpr(This& expr) override;
+        LoxObject visitUnaryExpr(Unary& expr) override;
+        LoxObject visitVariableExpr(Variable& expr) override;
+
+        // Stmt
+        void visitBlockStmt(Block& stmt) override;
+        void visitClassStmt(Class& stmt) override;
+        void visitExpressionStmt(Expression& stmt) override;
+        void visitFunctionStmt(Function& stmt) override;
+        void visitIfStmt(If& stmt) override;
+        void visitPrintStmt(Print& stmt) override;
+        void visitReturnStmt(Return& stmt) override;
+        void visitVarStmt(Var& stmt) override;
+        void visitWhileStmt(While& stmt) override;
+
+    private:
+        Transpiler() = default;
+
+        std::ostringstream out;
+        unsigned int indent {1};
+        // C++ code of the last expression translated.
+        std::string code;
+        // locals in scope, true for the captured ones living in cells.
+        std::vector<std::map<std::string, bool>> scopes;
+        // captured slots of the frames being translated.
+        std::vector<std::set<unsigned int>> captured;
+        // an initializer returns its receiver.
+        bool initializer {false};
+        std::set<std::string> globals;
+        std::set<std::string> properties;
+
+        std::string translate(PExpr& expr) {
+            expr->accept(*this);
+            return std::move(code);
+        }
+        void translate(SExpr& stmt) { stmt->accept(*this); }
+
+        void line(const std::string& text);
+        // translates stmt as the body of an if or a while.
+        void nested(SExpr& stmt);
+        void declare(const std::string& name, int slot, const std::string& value);
+        std::string local(const std::string& name);
+        std::string variable(const Token& name, int slot, int upvalue);
+        std::string global(const std::string& name);
+        std::string property(const Token& name);
+        // writes the closure of function, between prefix and suffix.
+        void function(Function& function, const std::string& prefix, const std::string& suffix);
+        std::string operands(PExpr& left, PExpr& right);
+        // the callee and the arguments of a call.
+        std::string callOperands(Call& expr);
+        static std::string literal(const LoxObject& value);
+        // slots of the frame running statements that closures capture.
+        static void capturedSlots(std::vector<SExpr>& statements, std::set<unsigned int>& slots);
+        static void capturedSlots(SExpr& stmt, std::set<unsigned int>& slots);
+};
+
+} // namespace lox
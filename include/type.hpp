@@ -8,7 +8,7 @@ namespace lox {
 
 enum class Type {
     Assign, Binary, Grouping, Literal, Unary, Variable, Logical, Call, 
-    Get, Set, This, Super, Ternary, CommaExpr,
+    Get, Set, This, Super, Ternary, CommaExpr, Inlined, Hoisted,
     Expression, If, Print, Var, Block, While, Function, Return, Class
 };
 
@@ -71,6 +71,12 @@ class TypeIdentifier : public StmtVisitor, public ExprVisitor {
         LoxObject visitTernaryExpr(Ternary& expr) override {
             type = Type::Ternary; return LoxObject();
         }
+        LoxObject visitInlinedExpr(Inlined& expr) override {
+            type = Type::Inlined; return LoxObject();
+        }
+        LoxObject visitHoistedExpr(Hoisted& expr) override {
+            type = Type::Hoisted; return LoxObject();
+        }
 
         void visitExpressionStmt(Expression& stmt) override {
             type = Type::Expression;
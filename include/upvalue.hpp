@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include "accounting.hpp"
+#include "loxObject.hpp"
+
+namespace lox {
+
+// Where a closure finds one of its captured variables when it is created:
+// a slot of the enclosing function's frame or one of that function's upvalues.
+struct UpvalueDesc {
+    bool isLocal;
+    unsigned int index;
+};
+
+class Upvalue {
+    /*
+    A variable captured by a closure. While the variable's scope is alive
+    the upvalue is open and refers to its slot in the frame stack. When the
+    scope exits, the value is moved into the upvalue which becomes closed.
+    */
+    public:
+        Upvalue(size_t slot_) : slot{slot_} {}
+        size_t slot;
+        bool open {true};
+        LoxObject closed {};
+};
+
+using PUpvalue = std::shared_ptr<Upvalue>;
+// the upvalues of a closure, charged with its function.
+using Upvalues = Accounting::Vector<PUpvalue, Accounting::Functions>;
+
+} // namespace lox
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include "chunk.hpp"
+#include "loxObject.hpp"
+
+namespace lox {
+
+class Interpreter;
+class LoxFunction;
+
+class VM {
+    /*
+    Runs compiled chunks, either stack code or register code. A Lox call
+    pushes a record on `frames` and the loop carries on with the callee
+    instead of nesting a native call, so the depth of Lox recursion is only
+    bounded by the stack limit. Frames keep their slots in the interpreter's
+    frame stack, with their temporaries right above them, and share its 
+    upvalues and globals.
+    */
+    public:
+        VM(Interpreter& intp);
+        void setStackLimit(size_t bytes);
+        // runs a script in a new frame on top of the interpreter's stack.
+        void interpret(Chunk& script, bool registers = false);
+        // runs function as stack code in the current frame, which the tree
+        // walker already filled with the arguments.
+        LoxObject call(LoxFunction* function);
+        // goes on with a loop compiled on its own in the current frame of
+        // the tree walker, until the loop ends or returns.
+        void enterLoop(Chunk& loop);
+
+    private:
+        struct Frame {
+            LoxFunction* function;   // nullptr for the script.
+            Chunk* chunk;
+            const uint8_t* ip;
+            size_t fp;
+            size_t ret;              // slot receiving the result, the callee's one for calls.
+            bool construct;          // an initializer run by a class call returns its receiver.
+            bool loop {false};       // a loop entered from the tree walker, which owns the locals.
+        };
+
+        Interpreter& interpreter;
+        Accounting::Vector<Frame, Accounting::Frames> frames;
+        size_t maxSlots;
+        // whether the running code is register code.
+        bool registers {false};
+
+        LoxObject run(size_t entry);
+        LoxObject runRegisters(size_t entry);
+        void unwind(size_t entry, size_t entryFp);
+        void pushFrame(LoxFunction* function, Chunk& chunk, size_t fp, size_t ret, bool construct);
+        void callFunction(LoxFunction* function, size_t fp, size_t ret, bool construct);
+        // calls the value in calleeSlot with the argc slots after it. Returns
+        // false when the result is already in the callee's slot.
+        bool callValue(size_t calleeSlot, size_t argc);
+        // calls the method name of the object in calleeSlot, same result as callValue.
+        bool invoke(size_t calleeSlot, const Token& name, size_t argc);
+        // runs a getter to completion, for results needed before the
+        // instruction can go on. Its frame starts at slot at.
+        LoxObject runGetter(LoxFunction* getter, size_t at);
+        // field, when given, tells whether an instance field was found.
+        LoxFunction* getProperty(LoxObject& object, const Token& name, bool* field = nullptr);
+        LoxFunction* bindMethod(LoxObject& object, LoxFunction* method, LoxObject receiver);
+};
+
+} // namespace lox
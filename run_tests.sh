@@ -1,11 +1,35 @@
 #!/bin/bash
+# Runs every test with the interpreter in ./build. A test that needs flags
+# names them at the start of its first line, "// run with --flag ...", and
+# is run with those up to the first word that isn't a flag. A test run
+# with --emit-cpp is translated, built against the runtime and run
+# instead, and one run "line by line" is given on the standard input,
+# where each line is compiled as a program of its own. Fails if a test
+# crashes.
 
-for f in $(find ./tests -type f)
-do 
-    if [[ $f == *.lox ]]
+status=0
+for f in $(find ./tests -type f -name '*.lox' | sort)
+do
+    flags=$(head -1 $f | sed -nE 's#^// run with ((--[^ :,]+[ :,]*)+).*#\1#p' | tr -d ':,')
+    echo -e "==== Running test for $f $flags====\n"
+    if [[ $flags == *--emit-cpp* ]]
     then
-        echo -e "==== Running test for $f====\n"
-        ./build/interpreter $f 
-        echo -e "\n"
+        program=./build/$(basename $f .lox)
+        ./build/interpreter --emit-cpp $f > $program.cpp &&
+            c++ -std=c++17 -O2 -Iinclude $program.cpp ./build/liblox.a -o $program &&
+            $program
+    elif head -1 $f | grep -q "line by line"
+    then
+        ./build/interpreter $flags < $f
+    else
+        ./build/interpreter $flags $f
+    fi
+    # killed by a signal.
+    if [ $? -gt 128 ]
+    then
+        echo "$f crashed"
+        status=1
     fi
+    echo -e "\n"
 done
+exit $status
@@ -69,6 +69,7 @@ void define_type(std::ofstream& out,
                 std::string basename, 
                 std::string classname, 
                 std::vector<std::string> fieldList,
+                std::vector<std::string> annotationList,
                 std::string return_type) {
 
     out << "class " + classname + ": public " + basename + " {\n";
@@ -116,6 +117,12 @@ void define_type(std::ofstream& out,
             else 
                 out << "\t\t" + field + ";\n";
     }
+    // annotations are filled by the resolver, not by the parser.
+    if (!annotationList.empty()) {
+        out << "\t\t// resolver annotations\n";
+        for (const auto& annotation: annotationList)
+            out << "\t\t" + annotation + ";\n";
+    }
     out << "};\n\n";
     
 }
@@ -124,8 +131,10 @@ void defineAST(
         std::string output_dir, 
         std::string basename,
         std::map<std::string,std::string> map,
+        std::map<std::string,std::string> annotations,
         std::vector<std::string>& includes,
-        std::string return_type
+        std::string return_type,
+        std::vector<std::string> forwards = {}
     ) { 
 
     std::string path = output_dir + "/" + basename + ".hpp";
@@ -141,6 +150,9 @@ void defineAST(
     for (const auto& include_ : includes) 
         out << "#include " << include_ << '\n'; 
     out << "\nnamespace lox { \n\n";
+    // classes of the other tree the annotations point to.
+    for (const auto& forward : forwards)
+        out << "class " << forward << ";\n";
     // declare classes
     declare_classes(out, map);
     // Define visitor class 
@@ -156,7 +168,10 @@ void defineAST(
     for (auto& e: map) {
         std::string classname = e.first;
         std::vector<std::string> fields = split(e.second, ", ");
-        define_type(out, basename, classname, fields, return_type);
+        std::vector<std::string> annotationList;
+        if (annotations.find(classname) != annotations.end())
+            annotationList = split(annotations.at(classname), ", ");
+        define_type(out, basename, classname, fields, annotationList, return_type);
     }
     
     //out << "} // AST namespace\n";
@@ -178,6 +193,8 @@ int main(int argc, char *argv[]) {
         {"Get", "Expr* object, Token name"},
         {"Assign", "Token name, Expr* value"},
         {"Grouping", "Expr* expression"},
+        {"Hoisted", "Expr* expression"},
+        {"Inlined", "Expr* original, Expr* body"},
         {"Literal", "LoxObject value"},
         {"Logical", "Expr* left, Token operator_, Expr* right"},
         {"Set", "Expr* object, Token name, Expr* value"},
@@ -188,8 +205,25 @@ int main(int argc, char *argv[]) {
         {"Variable", "Token name"}
     };
 
+    // Resolution results stored on the nodes themselves: a variable lives either
+    // in `slot` of the current call frame or behind `upvalue` of the running 
+    // closure. Both left to -1 mean the variable is the `global` of that
+    // index in the interpreter's table of globals. A call or a getter
+    // the inliner replaced by a copy of the body of `function` runs the
+    // copy with the arguments, then the receiver, in the frame slots from
+    // firstSlot on. A loop invariant keeps its value in `slot` of the frame
+    // once computed, which slot + 1 tells.
+    std::map<std::string, std::string> expr_annotations {
+        {"Assign", "int slot = -1, int upvalue = -1, int global = -1"},
+        {"Hoisted", "int slot = -1"},
+        {"Inlined", "Function* function = nullptr, int firstSlot = -1"},
+        {"Super", "int slot = -1, int upvalue = -1, int thisSlot = -1, int thisUpvalue = -1"},
+        {"This", "int slot = -1, int upvalue = -1"},
+        {"Variable", "int slot = -1, int upvalue = -1, int global = -1"}
+    };
+
     std::vector<std::string> includes {"\"token.hpp\"", "\"loxObject.hpp\"", "<memory>", "<vector>"};
-    defineAST(output_dir, "Expr", expr_map, includes, "LoxObject");
+    defineAST(output_dir, "Expr", expr_map, expr_annotations, includes, "LoxObject", {"Function"});
 
     std::map<std::string, std::string> stmt_map {
         {"Block", "std::vector<std::unique_ptr<Stmt>> statements"},
@@ -203,8 +237,29 @@ int main(int argc, char *argv[]) {
         {"While", "Expr* condition, Stmt* body"}
     };
 
+    // a function also keeps its bytecode once a bytecode engine compiled it,
+    // and the tiered engine counts its calls and loop iterations. A loop
+    // compiled on its own by the tiered engine keeps its chunk too, and the
+    // JIT leaves its machine code on functions it tried to compile. The
+    // invariants hoisted out of a loop are computed again each time it starts,
+    // at each iteration once a getter may be one of the properties it `reads`:
+    // `getters` is how many getter names were known when that was last told.
+    // Declarations at the top level define the `global` of that index. A
+    // class lists the `fields` its init assigns to this, in order.
+    std::map<std::string, std::string> stmt_annotations {
+        {"Block", "bool captured = false, unsigned int firstSlot = 0"},
+        {"Class", "int slot = -1, int superSlot = -1, int global = -1, std::vector<std::string> fields"},
+        {"Function", "unsigned int frameSize = 0, int slot = -1, int global = -1, std::vector<UpvalueDesc> upvalues, std::shared_ptr<Chunk> chunk, std::shared_ptr<Chunk> registerChunk, unsigned int calls = 0, unsigned int loops = 0, std::shared_ptr<NativeCode> native"},
+        {"Return", "bool tailCall = false"},
+        {"Var", "int slot = -1, int global = -1"},
+        {"While", "unsigned int backEdges = 0, std::shared_ptr<Chunk> chunk, std::vector<int> hoisted, std::vector<std::string> reads, size_t getters = 0, bool hoisting = true"}
+    };
+
     includes.push_back("\"Expr.hpp\"");
+    includes.push_back("\"upvalue.hpp\"");
+    includes.push_back("\"chunk.hpp\"");
+    includes.push_back("\"jit.hpp\"");
 
-    defineAST (output_dir, "Stmt", stmt_map, includes, "void");
+    defineAST (output_dir, "Stmt", stmt_map, stmt_annotations, includes, "void");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include "accounting.hpp"
+
+namespace lox {
+
+thread_local Accounting::Account* Accounting::active {nullptr};
+thread_local bool Accounting::checked {true};
+
+namespace {
+
+// placed before every block of Allocator.
+struct Block {
+    Accounting::Account* account;
+};
+constexpr size_t HEADER = alignof(std::max_align_t);
+static_assert(sizeof(Block) <= HEADER, "block header");
+
+constexpr size_t MB = 1024 * 1024;
+
+} // namespace
+
+void Accounting::charge(Account* account, Kind kind, size_t bytes) {
+    if (!account) return;
+    account->held.fetch_add(bytes, std::memory_order_relaxed);
+    account->bytes[kind].fetch_add(bytes, std::memory_order_relaxed);
+    size_t total = account->total.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = account->peak.load(std::memory_order_relaxed);
+    while (total > peak && !account->peak.compare_exchange_weak(peak, total, std::memory_order_relaxed)) {}
+}
+
+void Accounting::discharge(Account* account, Kind kind, size_t bytes) {
+    // nothing to give back may come after the account is freed.
+    if (!account || !bytes) return;
+    account->bytes[kind].fetch_sub(bytes, std::memory_order_relaxed);
+    account->total.fetch_sub(bytes, std::memory_order_relaxed);
+    release(account, bytes);
+}
+
+void Accounting::release(Account* account, size_t bytes) {
+    if (account->held.fetch_sub(bytes, std::memory_order_acq_rel) == bytes) delete account;
+}
+
+void Accounting::exceeded(size_t limit) {
+    throw std::runtime_error("Memory limit of " + std::to_string(limit / MB) + " MB exceeded.");
+}
+
+const char* Accounting::name(Kind kind) {
+    static const char* const names[KINDS] = {
+        "instances", "functions", "classes", "upvalues", "strings", "frames", "code"
+    };
+    return names[kind];
+}
+
+void Accounting::print(const Account& account, std::ostream& out) {
+    size_t total = account.total;
+    out << "memory: " << total << " bytes in use, " << account.peak << " at peak, ";
+    if (account.limit) {
+        out << "limit " << account.limit / MB << " MB\n";
+    } else {
+        out << "no limit\n";
+    }
+    for (size_t kind = 0; kind < KINDS; kind++) {
+        size_t bytes = account.bytes[kind];
+        if (!bytes) continue;
+        out << "  " << name(static_cast<Kind>(kind)) << ": " << bytes << " bytes, "
+            << static_cast<int>(100.0 * bytes / total + 0.5) << "%\n";
+    }
+}
+
+void* Accounting::allocate(size_t bytes, Kind kind) {
+    check(bytes + HEADER);
+    void* base = std::malloc(bytes + HEADER);
+    if (!base) throw std::bad_alloc();
+    Block* block = static_cast<Block*>(base);
+    block->account = active;
+    charge(active, kind, bytes + HEADER);
+    return static_cast<char*>(base) + HEADER;
+}
+
+void Accounting::deallocate(void* memory, size_t bytes, Kind kind) {
+    if (!memory) return;
+    Block* block = reinterpret_cast<Block*>(static_cast<char*>(memory) - HEADER);
+    discharge(block->account, kind, bytes + HEADER);
+    std::free(block);
+}
+
+} // namespace lox
@@ -0,0 +1,637 @@
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+#include <unordered_set>
+#include "collector.hpp"
+#include "interpreter.hpp"
+
+namespace lox {
+
+Collector::Collector(Interpreter& interpreter_) : interpreter{interpreter_} {
+    for (Header* list : {&young, &old, &promoted, &candidates, &recounted}) {
+        list->prev = list->next = list;
+    }
+}
+
+void Collector::link(Header& list, Header* header) {
+    header->prev = list.prev;
+    header->next = &list;
+    list.prev->next = header;
+    list.prev = header;
+}
+
+void Collector::unlink(Header* header) {
+    header->prev->next = header->next;
+    header->next->prev = header->prev;
+}
+
+void Collector::splice(Header& to, Header& from) {
+    if (from.next == &from) return;
+    from.next->prev = to.prev;
+    to.prev->next = from.next;
+    from.prev->next = &to;
+    to.prev = from.prev;
+    from.prev = from.next = &from;
+}
+
+void Collector::track(Header* header, Kind kind) {
+    if (!collecting) {
+        if (youngCount >= youngLimit) collectYoung();
+        if (phase != Phase::Idle && ++allocations % SLICE_ALLOCATIONS == 0) slice();
+    }
+    if (compaction && kind == Kind::Instance
+        && ++created >= std::max(liveAfterCompaction, MIN_TURNOVER)) {
+        due = true;
+    }
+    header->kind = kind;
+    header->generation = 0;
+    header->marked = false;
+    header->epoch = 0;
+    link(young, header);
+    youngCount++;
+}
+
+void Collector::untrack(Header* header) {
+    if (header == cursor) cursor = header->next;
+    // the block may be reused, it mustn't pass for a gray object any more.
+    header->epoch = 0;
+    unlink(header);
+    (header->generation ? oldCount : youngCount)--;
+}
+
+void Collector::setPauseBudget(double milliseconds) {
+    budget = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(milliseconds));
+}
+
+void Collector::abandon() {
+    held.clear();
+    heldIndex.clear();
+    pending.clear();
+    cursor = nullptr;
+    phase = Phase::Idle;
+}
+
+Collector::Header* Collector::header(const LoxObject& value) {
+    switch (value.getLoxObjectType()) {
+        case LoxType::Instance:
+            return &Tracked<LoxInstance>::of(value.getInstance())->header;
+        case LoxType::Class:
+            return &Tracked<LoxClass>::of(value.getLoxClass())->header;
+        case LoxType::Callable:
+            // the other callables aren't tracked, what they refer to is
+            // held from outside.
+            if (LoxFunction* function = value.getFunction()->asFunction()) {
+                return &Tracked<LoxFunction>::of(function)->header;
+            }
+            return nullptr;
+        default:
+            return nullptr;
+    }
+}
+
+size_t Collector::users(Header* header) {
+    switch (header->kind) {
+        case Kind::Instance:
+            return static_cast<LoxInstance*>(object(header))->users;
+        case Kind::Function:
+            return static_cast<LoxCallable*>(static_cast<LoxFunction*>(object(header)))->users;
+        default:
+            return static_cast<LoxCallable*>(static_cast<LoxClass*>(object(header)))->users;
+    }
+}
+
+template <class F>
+void Collector::references(Header* header, F visit) {
+    // the upvalues of functions are shared, collect() goes through them.
+    auto instance = [&visit](LoxInstance* instance) {
+        visit(instance->klassObject);
+        for (auto& slot : instance->slots) visit(slot);
+        for (auto& [name, field] : instance->fields) visit(field);
+    };
+    switch (header->kind) {
+        case Kind::Instance:
+            instance(static_cast<LoxInstance*>(object(header)));
+            break;
+        case Kind::Function:
+            visit(static_cast<LoxFunction*>(object(header))->receiver);
+            break;
+        case Kind::Class: {
+            auto* klass = static_cast<LoxClass*>(object(header));
+            instance(klass);
+            visit(klass->superObject);
+            for (auto& [name, method] : klass->methods) visit(method);
+            for (auto& [name, method] : klass->table) visit(method);
+            for (auto& [name, field] : klass->class_fields) visit(field);
+            break;
+        }
+    }
+}
+
+void Collector::clear(Header* header) {
+    // the class of an instance and the superclass of a class stay, they
+    // are never part of a cycle and the objects use them until freed.
+    auto instance = [](LoxInstance* instance) {
+        instance->slots.clear();
+        instance->present = 0;
+        instance->fields.clear();
+    };
+    switch (header->kind) {
+        case Kind::Instance:
+            instance(static_cast<LoxInstance*>(object(header)));
+            break;
+        case Kind::Function: {
+            auto* function = static_cast<LoxFunction*>(object(header));
+            function->receiver = LoxObject();
+            function->upvalues.clear();
+            break;
+        }
+        case Kind::Class: {
+            auto* klass = static_cast<LoxClass*>(object(header));
+            instance(klass);
+            klass->methods.clear();
+            klass->table.clear();
+            klass->class_fields.clear();
+            break;
+        }
+    }
+}
+
+void Collector::hold(Header* header) {
+    switch (header->kind) {
+        case Kind::Instance:
+            interpreter.addUser(static_cast<LoxInstance*>(object(header)));
+            break;
+        case Kind::Function:
+            interpreter.addUser(static_cast<LoxCallable*>(static_cast<LoxFunction*>(object(header))));
+            break;
+        case Kind::Class:
+            interpreter.addUser(static_cast<LoxClass*>(object(header)));
+            break;
+    }
+}
+
+void Collector::release(Header* header) {
+    switch (header->kind) {
+        case Kind::Instance:
+            interpreter.removeUser(static_cast<LoxInstance*>(object(header)));
+            break;
+        case Kind::Function:
+            interpreter.removeUser(static_cast<LoxCallable*>(static_cast<LoxFunction*>(object(header))));
+            break;
+        case Kind::Class:
+            interpreter.removeUser(static_cast<LoxClass*>(object(header)));
+            break;
+    }
+}
+
+
+void Collector::collect(Header& list, uint8_t generation, Header& to) {
+    auto collected = [generation](Header* header) {
+        return header && header->generation == generation;
+    };
+
+    // objects without users are being created or freed, they stay.
+    for (Header* h = list.next; h != &list; h = h->next) {
+        size_t count = users(h);
+        h->refs = count ? static_cast<long>(count) : 1;
+    }
+
+    // closed upvalues count as objects too: the functions collected
+    // sharing one are part of its users.
+    std::unordered_map<Upvalue*, long> upvalues;
+    for (Header* h = list.next; h != &list; h = h->next) {
+        references(h, [&](const LoxObject& value) {
+            if (Header* target = header(value); collected(target)) target->refs--;
+        });
+        if (h->kind != Kind::Function) continue;
+        for (auto& upvalue : static_cast<LoxFunction*>(object(h))->upvalues) {
+            if (upvalue->open) continue;
+            auto [it, added] = upvalues.emplace(upvalue.get(), upvalue.use_count());
+            it->second--;
+            if (!added) continue;
+            if (Header* target = header(upvalue->closed); collected(target)) target->refs--;
+        }
+    }
+
+    // everything the roots reach is live.
+    std::vector<Header*> gray;
+    auto reach = [&](const LoxObject& value) {
+        if (Header* target = header(value); collected(target) && target->refs != REACHED) {
+            gray.push_back(target);
+        }
+    };
+    for (Header* h = list.next; h != &list; h = h->next) {
+        if (h->refs > 0) gray.push_back(h);
+    }
+    for (auto& [upvalue, refs] : upvalues) {
+        if (refs > 0) {
+            refs = REACHED;
+            reach(upvalue->closed);
+        }
+    }
+    while (!gray.empty()) {
+        Header* h = gray.back();
+        gray.pop_back();
+        if (h->refs == REACHED) continue;
+        h->refs = REACHED;
+        references(h, reach);
+        if (h->kind != Kind::Function) continue;
+        for (auto& upvalue : static_cast<LoxFunction*>(object(h))->upvalues) {
+            auto it = upvalues.find(upvalue.get());
+            if (it == upvalues.end() || it->second == REACHED) continue;
+            it->second = REACHED;
+            reach(upvalue->closed);
+        }
+    }
+
+    // survivors are old.
+    std::vector<Header*> garbage;
+    for (Header* h = list.next; h != &list;) {
+        Header* next = h->next;
+        if (h->refs != REACHED) {
+            garbage.push_back(h);
+        } else {
+            unlink(h);
+            if (h->generation == 0) {
+                youngCount--;
+                oldCount++;
+            }
+            h->generation = 1;
+            link(to, h);
+        }
+        h = next;
+    }
+
+    // garbage is held while its references are cleared, so that none is
+    // freed while another still refers to it.
+    for (Header* h : garbage) hold(h);
+    for (Header* h : garbage) clear(h);
+    for (Header* h : garbage) release(h);
+    freed += garbage.size();
+}
+
+void Collector::collectYoung() {
+    // what the collector allocates can't stop it halfway.
+    Accounting::Unchecked unchecked;
+    auto start = Clock::now();
+    collecting = true;
+    // a cycle marks the old objects it started with, not the promoted.
+    collect(young, 0, phase == Phase::Idle ? old : promoted);
+    collecting = false;
+    youngCollections++;
+    auto pause = Clock::now() - start;
+    record(YoungPause, pause);
+
+    // the young generation shrinks until collecting it fits in the budget.
+    if (pause > budget && youngLimit > MIN_YOUNG_LIMIT) {
+        youngLimit /= 2;
+    } else if (pause < budget / 4 && youngLimit < YOUNG_LIMIT) {
+        youngLimit = std::min(youngLimit * 2, YOUNG_LIMIT);
+    }
+    if (phase == Phase::Idle && oldCount > oldAfterCycle + std::max(oldAfterCycle / 4, YOUNG_LIMIT)) {
+        startCycle();
+    }
+}
+
+void Collector::startCycle() {
+    phase = Phase::Stamp;
+    if (++epoch == 0) epoch = 1;
+    cursor = old.next;
+    allocations = 0;
+}
+
+void Collector::mark(Header* header) {
+    header->marked = true;
+    pending.push_back(header);
+}
+
+void Collector::reach(const LoxObject& value) {
+    Header* target = header(value);
+    if (target && target->epoch == epoch && !target->marked) mark(target);
+}
+
+void Collector::shadeValue(const LoxObject& value) {
+    reach(value);
+}
+
+void Collector::scan(Header* header) {
+    references(header, [this](const LoxObject& value) { reach(value); });
+    if (header->kind != Kind::Function) return;
+    for (auto& upvalue : static_cast<LoxFunction*>(object(header))->upvalues) {
+        if (upvalue->open) continue;
+        // the upvalues closed since Subtract have no entry.
+        auto it = heldIndex.find(upvalue.get());
+        if (it != heldIndex.end()) {
+            if (held[it->second].refs == REACHED) continue;
+            held[it->second].refs = REACHED;
+        }
+        reach(upvalue->closed);
+    }
+}
+
+size_t Collector::step() {
+    // a unit of the cycle, returns the objects it went through, 0 once
+    // the cycle is over.
+    switch (phase) {
+        case Phase::Stamp:
+            if (cursor == &old) {
+                phase = Phase::Subtract;
+                cursor = old.next;
+            } else {
+                Header* h = cursor;
+                cursor = h->next;
+                size_t count = users(h);
+                h->refs = count ? static_cast<long>(count) : 1;
+                h->marked = false;
+                h->epoch = epoch;
+            }
+            return 1;
+        case Phase::Subtract:
+            if (cursor == &old) {
+                phase = Phase::Mark;
+                cursor = old.next;
+                heldCursor = 0;
+                return 1;
+            }
+            {
+                Header* h = cursor;
+                cursor = h->next;
+                references(h, [this](const LoxObject& value) {
+                    if (Header* target = header(value); target && target->epoch == epoch) target->refs--;
+                });
+                if (h->kind != Kind::Function) return 1;
+                for (auto& upvalue : static_cast<LoxFunction*>(object(h))->upvalues) {
+                    if (upvalue->open) continue;
+                    auto [it, added] = heldIndex.emplace(upvalue.get(), held.size());
+                    if (added) {
+                        // the collector's own reference isn't a user.
+                        held.push_back({upvalue, upvalue.use_count() - 1});
+                        Header* target = header(upvalue->closed);
+                        if (target && target->epoch == epoch) target->refs--;
+                    }
+                    held[it->second].refs--;
+                }
+            }
+            return 1;
+        case Phase::Mark:
+            if (!pending.empty()) {
+                Header* h = pending.back();
+                pending.pop_back();
+                // the objects freed since they were shaded are skipped.
+                if (h->epoch == epoch) scan(h);
+            } else if (heldCursor < held.size()) {
+                Held& upvalue = held[heldCursor++];
+                if (upvalue.refs > 0) {
+                    upvalue.refs = REACHED;
+                    reach(upvalue.upvalue->closed);
+                }
+            } else if (cursor != &old) {
+                Header* h = cursor;
+                cursor = h->next;
+                if (h->refs > 0 && !h->marked) {
+                    h->marked = true;
+                    scan(h);
+                }
+            } else {
+                // dropping the upvalues may free objects, before the sweep.
+                heldIndex.clear();
+                held.clear();
+                phase = Phase::Sweep;
+                cursor = old.next;
+            }
+            return 1;
+        case Phase::Sweep:
+            if (cursor == &old) {
+                phase = Phase::Recount;
+                cursor = nullptr;
+                return 1;
+            }
+            {
+                Header* h = cursor;
+                cursor = h->next;
+                if (h->epoch == epoch && !h->marked) {
+                    unlink(h);
+                    h->generation = CANDIDATES;
+                    link(candidates, h);
+                }
+            }
+            return 1;
+        case Phase::Recount:
+            return candidates.next == &candidates ? 0 : recount();
+        default:
+            return 0;
+    }
+}
+
+size_t Collector::recount() {
+    // takes candidates along with the ones they refer to until there are
+    // enough to be worth a collection.
+    size_t count = 0;
+    auto take = [this, &count](Header* h) {
+        unlink(h);
+        h->generation = RECOUNTED;
+        link(recounted, h);
+        pending.push_back(h);
+        count++;
+    };
+    auto visit = [&take](const LoxObject& value) {
+        if (Header* target = header(value); target && target->generation == CANDIDATES) take(target);
+    };
+    while (count < MIN_RECOUNT && candidates.next != &candidates) {
+        take(candidates.next);
+        while (!pending.empty()) {
+            Header* h = pending.back();
+            pending.pop_back();
+            references(h, visit);
+            if (h->kind != Kind::Function) continue;
+            for (auto& upvalue : static_cast<LoxFunction*>(object(h))->upvalues) {
+                if (!upvalue->open) visit(upvalue->closed);
+            }
+        }
+    }
+    collect(recounted, RECOUNTED, old);
+    return count;
+}
+
+void Collector::slice() {
+    Accounting::Unchecked unchecked;
+    auto start = Clock::now();
+    auto deadline = start + budget;
+    collecting = true;
+    // the clock is read every few objects, it costs more than one.
+    size_t work = 0;
+    size_t checked = 0;
+    while (size_t done = step()) {
+        work += done;
+        if (work - checked < 64) continue;
+        checked = work;
+        if (Clock::now() >= deadline) break;
+    }
+    if (phase == Phase::Recount && candidates.next == &candidates) finishCycle();
+    collecting = false;
+    slices++;
+    record(SlicePause, Clock::now() - start);
+}
+
+void Collector::finishCycle() {
+    phase = Phase::Idle;
+    splice(old, promoted);
+    oldAfterCycle = oldCount;
+    cycles++;
+}
+
+Collector::Header* Collector::instance(const LoxObject& value) {
+    if (value.getLoxObjectType() != LoxType::Instance) return nullptr;
+    return &Tracked<LoxInstance>::of(value.getInstance())->header;
+}
+
+template <class F>
+void Collector::forEachReference(F visit) {
+    for (LoxObject& value : interpreter.m_stack) visit(value);
+    visit(interpreter.m_returnValue);
+    visit(interpreter.m_tailCallee);
+    interpreter.globals.forEach(visit);
+    std::unordered_set<Upvalue*> upvalues;
+    for (Header* list : {&young, &old}) {
+        for (Header* h = list->next; h != list; h = h->next) {
+            references(h, visit);
+            if (h->kind != Kind::Function) continue;
+            for (auto& upvalue : static_cast<LoxFunction*>(object(h))->upvalues) {
+                if (!upvalue->open && upvalues.insert(upvalue.get()).second) visit(upvalue->closed);
+            }
+        }
+    }
+}
+
+void Collector::compact() {
+    Accounting::Unchecked unchecked;
+    auto start = Clock::now();
+    due = false;
+    collecting = true;
+
+    // the references found to each instance.
+    for (Header* list : {&young, &old}) {
+        for (Header* h = list->next; h != list; h = h->next) {
+            h->refs = 0;
+            h->marked = false;
+        }
+    }
+    forEachReference([](LoxObject& value) {
+        if (Header* h = instance(value)) h->refs++;
+    });
+
+    // instances in the order a depth-first walk from the roots reaches
+    // them, then the ones only reached from functions and classes.
+    std::vector<Tracked<LoxInstance>*> order;
+    std::vector<Header*> gray;
+    auto reach = [&gray](LoxObject& value) {
+        Header* h = instance(value);
+        if (!h || h->marked) return;
+        h->marked = true;
+        gray.push_back(h);
+    };
+    auto walk = [&]() {
+        while (!gray.empty()) {
+            Header* h = gray.back();
+            gray.pop_back();
+            if (h->refs == static_cast<long>(users(h))) {
+                order.push_back(reinterpret_cast<Tracked<LoxInstance>*>(h));
+            } else {
+                pinned++;
+            }
+            // the first field is visited first.
+            size_t from = gray.size();
+            references(h, reach);
+            std::reverse(gray.begin() + from, gray.end());
+        }
+    };
+    for (LoxObject& value : interpreter.m_stack) reach(value);
+    reach(interpreter.m_returnValue);
+    reach(interpreter.m_tailCallee);
+    interpreter.globals.forEach(reach);
+    walk();
+    forEachReference(reach);
+    walk();
+
+    std::unordered_map<LoxInstance*, LoxInstance*> forward;
+    forward.reserve(order.size());
+    interpreter.m_instances.compact(order, [&forward](Tracked<LoxInstance>* from, Tracked<LoxInstance>* to) {
+        to->header = from->header;
+        to->header.prev->next = &to->header;
+        to->header.next->prev = &to->header;
+        forward[&from->object] = &to->object;
+    });
+    forEachReference([&forward](LoxObject& value) {
+        if (value.getLoxObjectType() != LoxType::Instance) return;
+        auto it = forward.find(value.instance);
+        if (it != forward.end()) value.instance = it->second;
+    });
+    // the slots of the instances follow each other too, allocated before
+    // the old ones are freed so as not to take their place.
+    using Slots = decltype(LoxInstance::slots);
+    std::vector<Slots> previous;
+    previous.reserve(order.size());
+    for (Tracked<LoxInstance>* from : order) {
+        LoxInstance* object = forward[&from->object];
+        if (object->slots.empty()) continue;
+        Slots slots(object->slots);
+        previous.push_back(std::move(object->slots));
+        object->slots = std::move(slots);
+    }
+    previous.clear();
+    moved += order.size();
+    compactions++;
+    created = 0;
+    liveAfterCompaction = interpreter.m_instances.stats().live;
+
+    collecting = false;
+    record(CompactPause, Clock::now() - start);
+}
+
+void Collector::record(Pause kind, Clock::duration pause) {
+    paused += pause;
+    longestPause = std::max(longestPause, pause);
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(pause).count();
+    size_t bucket = 0;
+    for (long long bound = 64; micros >= bound && bucket < BUCKETS - 1; bound *= 2) bucket++;
+    histogram[kind][bucket]++;
+    // a slice ends at the first clock read past its deadline, a little
+    // after it.
+    if (pause > budget + budget / 8) overruns[kind]++;
+}
+
+void Collector::printStats(std::ostream& out) const {
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    out << "collector: " << youngCollections << " young collections, "
+        << cycles << " old cycles in " << slices << " slices, "
+        << freed << " objects freed, "
+        << Milliseconds(paused).count() << " ms paused, longest "
+        << Milliseconds(longestPause).count() << " ms\n";
+    if (compaction) {
+        out << "compaction: " << compactions << " runs, "
+            << moved << " instances moved, " << pinned << " pinned\n";
+    }
+    if (!youngCollections && !slices && !compactions) return;
+    // the last bucket has no upper bound.
+    out << "pauses (ms)      young    slice  compact\n";
+    for (size_t bucket = 0; bucket < BUCKETS; bucket++) {
+        const size_t* counts[] = {&histogram[YoungPause][bucket], &histogram[SlicePause][bucket],
+                                  &histogram[CompactPause][bucket]};
+        if (!*counts[0] && !*counts[1] && !*counts[2]) continue;
+        char row[64];
+        double bound = 0.064 * (1 << bucket);
+        std::snprintf(row, sizeof row, "%s %-9g %8zu %8zu %8zu\n", bucket < BUCKETS - 1 ? "  <" : " >=",
+                      bucket < BUCKETS - 1 ? bound : bound / 2, *counts[0], *counts[1], *counts[2]);
+        out << row;
+    }
+    // only the slices are bounded by the budget.
+    char label[32];
+    char row[64];
+    std::snprintf(label, sizeof label, "over %g", Milliseconds(budget).count());
+    std::snprintf(row, sizeof row, "%-13s %8zu %8zu %8zu\n", label, overruns[YoungPause],
+                  overruns[SlicePause], overruns[CompactPause]);
+    out << row;
+}
+
+} // namespace lox
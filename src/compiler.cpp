@@ -0,0 +1,554 @@
+#include "compiler.hpp"
+#include "type.hpp"
+#include "accounting.hpp"
+#include <stdexcept>
+#include <algorithm>
+
+namespace lox {
+
+static constexpr size_t MAX_OPERAND = UINT16_MAX;
+
+// slot of a local variable read, -1 for any other expression.
+static int localSlot(std::unique_ptr<Expr>& expr) {
+    if (TypeIdentifier{}.identify(expr) != Type::Variable) return -1;
+    return static_cast<Variable&>(*expr).slot;
+}
+
+static bool isNumber(std::unique_ptr<Expr>& expr) {
+    return TypeIdentifier{}.identify(expr) == Type::Literal
+        && static_cast<Literal&>(*expr).value.getLoxObjectType() == LoxType::Number;
+}
+
+// expressions whose evaluation has no side effect for a property lookup
+// to be moved after them.
+static bool isPure(std::unique_ptr<Expr>& expr) {
+    switch (TypeIdentifier{}.identify(expr)) {
+        case Type::Literal:
+        case Type::Variable:
+        case Type::This:
+            return true;
+        case Type::Grouping:
+            return isPure(static_cast<Grouping&>(*expr).expression);
+        case Type::Unary:
+            return isPure(static_cast<Unary&>(*expr).right);
+        case Type::Binary: {
+            auto& binary = static_cast<Binary&>(*expr);
+            return isPure(binary.left) && isPure(binary.right);
+        }
+        default:
+            return false;
+    }
+}
+
+static int comparison(TokenType type) {
+    switch (type) {
+        case TokenType::GREATER: return OP_GREATER;
+        case TokenType::GREATER_EQUAL: return OP_GREATER_EQUAL;
+        case TokenType::LESS: return OP_LESS;
+        case TokenType::LESS_EQUAL: return OP_LESS_EQUAL;
+        case TokenType::BANG_EQUAL: return OP_NOT_EQUAL;
+        case TokenType::EQUAL_EQUAL: return OP_EQUAL;
+        default: return -1;
+    }
+}
+
+Chunk& Compiler::compile(Function& function) {
+    // a chunk left half compiled would run.
+    Accounting::Unchecked unchecked;
+    function.chunk = std::make_shared<Chunk>();
+    Chunk& chunk = *function.chunk;
+    chunk.frameSize = function.frameSize;
+
+    // an initializer's bare "return;" hands back its receiver.
+    int receiver = -1;
+    if (function.kind != "function" && function.name.lexeme == "init") {
+        receiver = function.params.size();
+    }
+    Compiler compiler(chunk, receiver);
+    for (auto& stmt : function.body) {
+        compiler.compile(stmt);
+    }
+    compiler.emit(OP_NIL, 1);
+    compiler.emit(OP_RETURN, -1);
+    return chunk;
+}
+
+std::unique_ptr<Chunk> Compiler::compile(std::vector<SExpr>& statements, unsigned int frameSize) {
+    Accounting::Unchecked unchecked;
+    auto chunk = std::make_unique<Chunk>();
+    chunk->frameSize = frameSize;
+
+    Compiler compiler(*chunk);
+    for (auto& stmt : statements) {
+        compiler.compile(stmt);
+    }
+    compiler.emit(OP_NIL, 1);
+    compiler.emit(OP_RETURN, -1);
+    return chunk;
+}
+
+std::unique_ptr<Chunk> Compiler::compile(While& loop, unsigned int frameSize) {
+    Accounting::Unchecked unchecked;
+    auto chunk = std::make_unique<Chunk>();
+    chunk->frameSize = frameSize;
+
+    Compiler compiler(*chunk);
+    compiler.visitWhileStmt(loop);
+    compiler.emit(OP_END_LOOP, 0);
+    return chunk;
+}
+
+void Compiler::emit(OpCode op, int effect) {
+    chunk.code.push_back(op);
+    setDepth(depth + effect);
+}
+
+void Compiler::emit(OpCode op, size_t operand, int effect) {
+    emit(op, {operand}, effect);
+}
+
+void Compiler::emit(OpCode op, std::initializer_list<size_t> operands, int effect) {
+    chunk.code.push_back(op);
+    for (size_t operand : operands) {
+        if (operand > MAX_OPERAND) {
+            throw std::runtime_error("Too many locals, constants or names in one function.");
+        }
+        chunk.code.push_back((operand >> 8) & 0xff);
+        chunk.code.push_back(operand & 0xff);
+    }
+    setDepth(depth + effect);
+}
+
+void Compiler::setDepth(unsigned int d) {
+    depth = d;
+    chunk.maxStack = std::max(chunk.maxStack, depth);
+}
+
+size_t Compiler::emitJump(OpCode op) {
+    emit(op, 0, 0);
+    return chunk.code.size() - 2;
+}
+
+void Compiler::patchJump(size_t jump) {
+    size_t offset = chunk.code.size() - jump - 2;
+    if (offset > MAX_OPERAND) {
+        throw std::runtime_error("Too much code to jump over.");
+    }
+    chunk.code[jump] = (offset >> 8) & 0xff;
+    chunk.code[jump + 1] = offset & 0xff;
+}
+
+void Compiler::emitLoop(size_t start) {
+    // the offset is counted from the end of the loop instruction.
+    emit(OP_LOOP, chunk.code.size() + 3 - start, 0);
+}
+
+size_t Compiler::name(const Token& token) {
+    // shared by the uses of a name on one line only: the token gives the
+    // line runtime errors report.
+    auto it = std::find_if(chunk.names.begin(), chunk.names.end(),
+        [&](const Token& t) { return t.lexeme == token.lexeme && t.line == token.line; });
+    if (it != chunk.names.end()) return it - chunk.names.begin();
+    chunk.names.push_back(token);
+    return chunk.names.size() - 1;
+}
+
+size_t Compiler::constant(const LoxObject& value) {
+    chunk.constants.push_back(value);
+    return chunk.constants.size() - 1;
+}
+
+size_t Compiler::site(OpCode op) {
+    chunk.feedback.emplace_back(op);
+    return chunk.feedback.size() - 1;
+}
+
+size_t Compiler::compareLocalJump(PExpr& condition) {
+    // "local < constant" conditions test and branch in one instruction
+    // that leaves nothing on the stack. Returns the jump to patch, 0 when
+    // the condition has another shape.
+    if (TypeIdentifier{}.identify(condition) != Type::Binary) return 0;
+    auto& binary = static_cast<Binary&>(*condition);
+    int op = comparison(binary.operator_.token_type);
+    int slot = localSlot(binary.left);
+    if (op < 0 || slot < 0 || !isNumber(binary.right)) return 0;
+
+    size_t value = constant(static_cast<Literal&>(*binary.right).value);
+    emit(OP_COMPARE_LOCAL_JUMP, {(size_t)slot, value, (size_t)op, 0}, 0);
+    return chunk.code.size() - 2;
+}
+
+void Compiler::getVariable(int slot, int upvalue, const Token& token, int global) {
+    if (slot >= 0) {
+        emit(OP_GET_LOCAL, slot, 1);
+    } else if (upvalue >= 0) {
+        emit(OP_GET_UPVALUE, upvalue, 1);
+    } else {
+        // the name only serves the error of an undefined global.
+        emit(OP_GET_GLOBAL, {(size_t)global, name(token)}, 1);
+    }
+}
+
+void Compiler::setVariable(int slot, int upvalue, const Token& token, int global) {
+    if (slot >= 0) {
+        emit(OP_SET_LOCAL, slot, 0);
+    } else if (upvalue >= 0) {
+        emit(OP_SET_UPVALUE, upvalue, 0);
+    } else {
+        emit(OP_SET_GLOBAL, {(size_t)global, name(token)}, 0);
+    }
+}
+
+// Expr
+LoxObject Compiler::visitAssignExpr(Assign& expr) {
+    compile(expr.value);
+    setVariable(expr.slot, expr.upvalue, expr.name, expr.global);
+    return LoxObject();
+}
+
+LoxObject Compiler::visitBinaryExpr(Binary& expr) {
+    int left = localSlot(expr.left);
+    int right = localSlot(expr.right);
+    if (expr.operator_.token_type == TokenType::PLUS && left >= 0 && right >= 0) {
+        emit(OP_ADD_LOCALS, {(size_t)left, (size_t)right}, 1);
+        return LoxObject();
+    }
+
+    compile(expr.left);
+    compile(expr.right);
+
+    OpCode op;
+    switch(expr.operator_.token_type) {
+        case TokenType::GREATER: op = OP_GREATER; break;
+        case TokenType::GREATER_EQUAL: op = OP_GREATER_EQUAL; break;
+        case TokenType::LESS: op = OP_LESS; break;
+        case TokenType::LESS_EQUAL: op = OP_LESS_EQUAL; break;
+        case TokenType::MINUS: op = OP_SUBTRACT; break;
+        case TokenType::PLUS: op = OP_ADD; break;
+        case TokenType::SLASH: op = OP_DIVIDE; break;
+        case TokenType::STAR: op = OP_MULTIPLY; break;
+        case TokenType::BANG_EQUAL: op = OP_NOT_EQUAL; break;
+        case TokenType::EQUAL_EQUAL: op = OP_EQUAL; break;
+        default:
+            throw std::runtime_error("unknown binary expression");
+    }
+    emit(op, site(op), -1);
+    return LoxObject();
+}
+
+LoxObject Compiler::visitCallExpr(Call& expr) {
+    // a method called right away is looked up once the arguments are on
+    // the stack and runs without a bound method.
+    if (TypeIdentifier{}.identify(expr.callee) == Type::Get
+        && std::all_of(expr.arguments.begin(), expr.arguments.end(), isPure)) {
+        auto& get = static_cast<Get&>(*expr.callee);
+        compile(get.object);
+        for (auto& argument : expr.arguments) {
+            compile(argument);
+        }
+        emit(OP_INVOKE, {name(get.name), expr.arguments.size()}, -(int)expr.arguments.size());
+        return LoxObject();
+    }
+
+    compile(expr.callee);
+    for (auto& argument : expr.arguments) {
+        compile(argument);
+    }
+    emit(OP_CALL, {expr.arguments.size(), site(OP_CALL)}, -(int)expr.arguments.size());
+    return LoxObject();
+}
+
+LoxObject Compiler::visitCommaExprExpr(CommaExpr& expr) {
+    for (size_t i = 0; i < expr.expressions.size() - 1; i++) {
+        compile(expr.expressions[i]);
+        emit(OP_POP, -1);
+    }
+    compile(expr.expressions.back());
+    return LoxObject();
+}
+
+LoxObject Compiler::visitGetExpr(Get& expr) {
+    compile(expr.object);
+    emit(OP_GET_PROPERTY, {name(expr.name), site(OP_GET_PROPERTY)}, 0);
+    return LoxObject();
+}
+
+LoxObject Compiler::visitGroupingExpr(Grouping& expr) {
+    compile(expr.expression);
+    return LoxObject();
+}
+
+LoxObject Compiler::visitHoistedExpr(Hoisted& expr) {
+    // skips the computation once the value is in its slot.
+    emit(OP_GET_HOISTED, {(size_t)expr.slot, 0}, 0);
+    size_t computed = chunk.code.size() - 2;
+    compile(expr.expression);
+    emit(OP_SET_HOISTED, expr.slot, 0);
+    patchJump(computed);
+    return LoxObject();
+}
+
+LoxObject Compiler::visitInlinedExpr(Inlined& expr) {
+    // the guard jumps to the original call, with the callee or the object
+    // on the stack, when it doesn't hold.
+    chunk.functions.push_back(expr.function);
+    size_t function = chunk.functions.size() - 1;
+    Call* call = nullptr;
+    Get* get;
+    if (TypeIdentifier{}.identify(expr.original) == Type::Get) {
+        get = static_cast<Get*>(expr.original.get());
+    } else {
+        call = static_cast<Call*>(expr.original.get());
+        get = TypeIdentifier{}.identify(call->callee) == Type::Get ? static_cast<Get*>(call->callee.get()) : nullptr;
+    }
+
+    size_t fallback;
+    if (get) {
+        compile(get->object);
+        emit(OP_CHECK_METHOD, {name(get->name), function, 0}, 0);
+        fallback = chunk.code.size() - 2;
+        emit(OP_SET_LOCAL, expr.firstSlot + (call ? call->arguments.size() : 0), 0);
+    } else {
+        compile(call->callee);
+        emit(OP_CHECK_FUNCTION, {function, 0}, 0);
+        fallback = chunk.code.size() - 2;
+    }
+    emit(OP_POP, -1);
+    if (call) {
+        for (size_t i = 0; i < call->arguments.size(); i++) {
+            compile(call->arguments[i]);
+            emit(OP_SET_LOCAL, expr.firstSlot + i, 0);
+            emit(OP_POP, -1);
+        }
+    }
+    compile(expr.body);
+    size_t end = emitJump(OP_JUMP);
+
+    patchJump(fallback);
+    if (get) emit(OP_GET_PROPERTY, {name(get->name), site(OP_GET_PROPERTY)}, 0);
+    if (call) {
+        for (auto& argument : call->arguments) {
+            compile(argument);
+        }
+        emit(OP_CALL, {call->arguments.size(), site(OP_CALL)}, -(int)call->arguments.size());
+    }
+    patchJump(end);
+    return LoxObject();
+}
+
+LoxObject Compiler::visitLiteralExpr(Literal& expr) {
+    switch (expr.value.getLoxObjectType()) {
+        case LoxType::Nil:
+            emit(OP_NIL, 1);
+            break;
+        case LoxType::Bool:
+            emit(expr.value ? OP_TRUE : OP_FALSE, 1);
+            break;
+        default:
+            emit(OP_CONSTANT, constant(expr.value), 1);
+    }
+    return LoxObject();
+}
+
+LoxObject Compiler::visitLogicalExpr(Logical& expr) {
+    // the left operand stays as the result when it decides the outcome.
+    compile(expr.left);
+    size_t end = emitJump(expr.operator_.token_type == OR ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE);
+    emit(OP_POP, -1);
+    compile(expr.right);
+    patchJump(end);
+    return LoxObject();
+}
+
+LoxObject Compiler::visitSetExpr(Set& expr) {
+    compile(expr.object);
+    compile(expr.value);
+    emit(OP_SET_PROPERTY, {name(expr.name), site(OP_SET_PROPERTY)}, -1);
+    return LoxObject();
+}
+
+LoxObject Compiler::visitSuperExpr(Super& expr) {
+    getVariable(expr.thisSlot, expr.thisUpvalue, expr.keyword);
+    getVariable(expr.slot, expr.upvalue, expr.keyword);
+    emit(OP_GET_SUPER, name(expr.method), -1);
+    return LoxObject();
+}
+
+LoxObject Compiler::visitTernaryExpr(Ternary& expr) {
+    compile(expr.condition);
+    size_t elseJump = emitJump(OP_JUMP_IF_FALSE);
+    emit(OP_POP, -1);
+    compile(expr.thenBranch);
+    size_t end = emitJump(OP_JUMP);
+
+    // the condition is still on the stack when the else branch starts, 
+    // in place of the value of the then branch.
+    patchJump(elseJump);
+    emit(OP_POP, -1);
+    compile(expr.elseBranch);
+    patchJump(end);
+    return LoxObject();
+}
+
+LoxObject Compiler::visitThisExpr(This& expr) {
+    getVariable(expr.slot, expr.upvalue, expr.keyword);
+    return LoxObject();
+}
+
+LoxObject Compiler::visitUnaryExpr(Unary& expr) {
+    compile(expr.right);
+    switch(expr.operator_.token_type) {
+        case TokenType::BANG: emit(OP_NOT, 0); break;
+        case TokenType::MINUS: emit(OP_NEGATE, 0); break;
+        default:
+            throw std::runtime_error("Invalid unary expression.");
+    }
+    return LoxObject();
+}
+
+LoxObject Compiler::visitVariableExpr(Variable& expr) {
+    getVariable(expr.slot, expr.upvalue, expr.name, expr.global);
+    return LoxObject();
+}
+
+// Stmt
+void Compiler::visitBlockStmt(Block& stmt) {
+    for (auto& statement : stmt.statements) {
+        compile(statement);
+    }
+    if (stmt.captured) emit(OP_CLOSE_UPVALUES, stmt.firstSlot, 0);
+}
+
+void Compiler::visitClassStmt(Class& stmt) {
+    if (stmt.superclass) {
+        compile(stmt.superclass);
+    } else {
+        emit(OP_NIL, 1);
+    }
+    chunk.classes.push_back(&stmt);
+    emit(OP_CLASS, chunk.classes.size() - 1, 0);
+
+    // a global class is already defined when its methods are created.
+    setVariable(stmt.slot, -1, stmt.name, stmt.global);
+    emit(OP_POP, -1);
+}
+
+void Compiler::visitExpressionStmt(Expression& stmt) {
+    // "i = i + 1;" adds to the local in place.
+    if (TypeIdentifier{}.identify(stmt.expression) == Type::Assign) {
+        auto& assign = static_cast<Assign&>(*stmt.expression);
+        if (assign.slot >= 0 && TypeIdentifier{}.identify(assign.value) == Type::Binary) {
+            auto& sum = static_cast<Binary&>(*assign.value);
+            if (sum.operator_.token_type == TokenType::PLUS && localSlot(sum.left) == assign.slot
+                && isNumber(sum.right)) {
+                size_t value = constant(static_cast<Literal&>(*sum.right).value);
+                emit(OP_INCREMENT_LOCAL, {(size_t)assign.slot, value}, 0);
+                return;
+            }
+        }
+    }
+    compile(stmt.expression);
+    emit(OP_POP, -1);
+}
+
+void Compiler::visitFunctionStmt(Function& stmt) {
+    chunk.functions.push_back(&stmt);
+    emit(OP_CLOSURE, chunk.functions.size() - 1, 1);
+    if (stmt.slot >= 0) {
+        emit(OP_SET_LOCAL, stmt.slot, 0);
+        emit(OP_POP, -1);
+    } else {
+        emit(OP_DEFINE_GLOBAL, stmt.global, -1);
+    }
+}
+
+void Compiler::visitIfStmt(If& stmt) {
+    if (size_t elseJump = compareLocalJump(stmt.condition)) {
+        compile(stmt.thenBranch);
+        if (stmt.elseBranch) {
+            size_t end = emitJump(OP_JUMP);
+            patchJump(elseJump);
+            compile(stmt.elseBranch);
+            patchJump(end);
+        } else {
+            patchJump(elseJump);
+        }
+        return;
+    }
+
+    compile(stmt.condition);
+    size_t elseJump = emitJump(OP_JUMP_IF_FALSE);
+    emit(OP_POP, -1);
+    compile(stmt.thenBranch);
+    size_t end = emitJump(OP_JUMP);
+
+    patchJump(elseJump);
+    setDepth(depth + 1);
+    emit(OP_POP, -1);
+    if (stmt.elseBranch) compile(stmt.elseBranch);
+    patchJump(end);
+}
+
+void Compiler::visitPrintStmt(Print& stmt) {
+    compile(stmt.expression);
+    emit(OP_PRINT, -1);
+}
+
+void Compiler::visitReturnStmt(Return& stmt) {
+    if (stmt.tailCall) {
+        auto& call = *static_cast<Call*>(stmt.value.get());
+        compile(call.callee);
+        for (auto& argument : call.arguments) {
+            compile(argument);
+        }
+        // the return only runs when the callee can't take over the frame.
+        emit(OP_TAIL_CALL, call.arguments.size(), -(int)call.arguments.size());
+    } else if (stmt.value) {
+        compile(stmt.value);
+    } else if (receiver >= 0) {
+        emit(OP_GET_LOCAL, receiver, 1);
+    } else {
+        emit(OP_NIL, 1);
+    }
+    emit(OP_RETURN, -1);
+}
+
+void Compiler::visitVarStmt(Var& stmt) {
+    if (stmt.initializer) {
+        compile(stmt.initializer);
+    } else {
+        emit(OP_NIL, 1);
+    }
+    if (stmt.slot >= 0) {
+        emit(OP_SET_LOCAL, stmt.slot, 0);
+        emit(OP_POP, -1);
+    } else {
+        emit(OP_DEFINE_GLOBAL, stmt.global, -1);
+    }
+}
+
+void Compiler::visitWhileStmt(While& stmt) {
+    if (!stmt.hoisted.empty()) {
+        chunk.loops.push_back(&stmt);
+        emit(OP_START_HOISTED, chunk.loops.size() - 1, 0);
+    }
+    size_t start = chunk.code.size();
+    if (size_t exit = compareLocalJump(stmt.condition)) {
+        compile(stmt.body);
+        emitLoop(start);
+        patchJump(exit);
+        return;
+    }
+
+    compile(stmt.condition);
+    size_t exit = emitJump(OP_JUMP_IF_FALSE);
+    emit(OP_POP, -1);
+    compile(stmt.body);
+    emitLoop(start);
+
+    patchJump(exit);
+    setDepth(depth + 1);
+    emit(OP_POP, -1);
+}
+
+} // namespace lox
@@ -0,0 +1,101 @@
+#include "context.hpp"
+#include "scanner.hpp"
+#include "parser.hpp"
+#include "interpreter.hpp"
+#include "resolver.hpp"
+#include "transpiler.hpp"
+#include "inliner.hpp"
+#include "loopOptimizer.hpp"
+
+namespace lox {
+
+struct Program {
+    std::vector<std::unique_ptr<Stmt>> statements;
+    unsigned int frameSize {0};
+};
+
+Context::Context(Options options_)
+    : options{options_}, errors{*options_.err}, interpreter{std::make_unique<Interpreter>()} {
+    interpreter->setEngine(options.engine);
+    interpreter->setStackLimit(options.stackLimit);
+    interpreter->setTierUp(options.tierUp);
+    interpreter->setJit(options.jit);
+    interpreter->setPauseBudget(options.pauseBudget);
+    interpreter->setCompaction(options.compaction);
+    interpreter->setHeapLimit(options.heapLimit);
+    interpreter->setOutput(*options.out, *options.err);
+}
+
+Context::~Context() = default;
+
+std::unique_ptr<Program> Context::parse(const std::string& source, std::ostream& warnings) {
+    errors.clear();
+    Scanner scanner(source, errors);
+    std::vector<Token> tokens = scanner.scanTokens();
+    Parser parser{tokens, errors};
+    auto program = std::make_unique<Program>();
+    program->statements = parser.parse();
+    // Stop if there was a syntax error.
+    if (errors.found()) return nullptr;
+
+    Resolver resolver(interpreter.get(), errors);
+    resolver.resolve(program->statements);
+    resolver.reportUnusedVariables(warnings);
+    // Stop if there was a resolution error.
+    if (errors.found()) return nullptr;
+    program->frameSize = resolver.frameSize();
+    return program;
+}
+
+Program* Context::compile(const std::string& source) {
+    // the program's constants are charged to the interpreter too.
+    Accounting::Charge charge{interpreter->account()};
+    Accounting::Unchecked unchecked;
+    auto program = parse(source, *options.out);
+    if (!program) return nullptr;
+    if (options.inlining) {
+        program->frameSize = Inliner::optimize(program->statements, program->frameSize);
+    }
+    if (options.hoisting) {
+        program->frameSize = LoopOptimizer::optimize(program->statements, program->frameSize,
+                                                       interpreter->getters());
+    }
+    programs.push_back(std::move(program));
+    return programs.back().get();
+}
+
+Context::Status Context::run(Program& program) {
+    return interpreter->interpret(program.statements, program.frameSize) ? Status::Ok
+                                                                         : Status::RuntimeError;
+}
+
+Context::Status Context::run(const std::string& source) {
+    Program* program = compile(source);
+    return program ? run(*program) : Status::CompileError;
+}
+
+bool Context::translate(const std::string& source, std::ostream& out) {
+    // stdout gets the C++ code.
+    auto program = parse(source, *options.err);
+    if (!program) return false;
+    Transpiler::emit(program->statements, out);
+    return true;
+}
+
+LoxObject Context::get(const std::string& name) {
+    return interpreter->global(name);
+}
+
+LoxObject Context::call(const LoxObject& callee, std::vector<LoxObject> args) {
+    return interpreter->invoke(callee, std::move(args));
+}
+
+LoxObject Context::call(const std::string& function, std::vector<LoxObject> args) {
+    return interpreter->invoke(interpreter->global(function), std::move(args));
+}
+
+void Context::printHeapStats(std::ostream& out) const {
+    interpreter->printHeapStats(out);
+}
+
+} // namespace lox
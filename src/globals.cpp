@@ -0,0 +1,23 @@
+#include <stdexcept>
+#include "globals.hpp"
+
+namespace lox {
+
+unsigned int Globals::index(const std::string& name) {
+    auto [it, added] = indexes.emplace(name, values.size());
+    if (added) values.emplace_back();
+    return it->second;
+}
+
+int Globals::find(const std::string& name) const {
+    auto it = indexes.find(name);
+    return it != indexes.end() ? static_cast<int>(it->second) : -1;
+}
+
+void Globals::undefined(const Token& name) {
+    throw std::runtime_error("Undefined variable '" 
+                            + name.lexeme + 
+                            "' [line " + std::to_string(name.line) + "]");
+}
+
+} // namespace lox
@@ -0,0 +1,375 @@
+#include "inliner.hpp"
+#include "loxCallable.hpp"
+#include "type.hpp"
+#include <algorithm>
+
+namespace lox {
+
+// nodes of the biggest body copied at a call site.
+static constexpr unsigned int MAX_NODES = 16;
+
+unsigned int Inliner::optimize(std::vector<SExpr>& statements, unsigned int frameSize) {
+    Inliner inliner;
+    inliner.collect(statements, true);
+    inliner.frameSize = &frameSize;
+    inliner.top = frameSize;
+    inliner.rewrite(statements);
+    return frameSize;
+}
+
+bool Inliner::isFunction(const LoxObject& callee, const Function* function) {
+    if (callee.getLoxObjectType() != LoxType::Callable) return false;
+    LoxFunction* closure = callee.getFunction()->asFunction();
+    return closure && closure->getDeclaration() == function;
+}
+
+bool Inliner::isMethod(const LoxObject& object, const Token& name, const Function* function) {
+    // a field of the same name hides the method.
+    if (object.getLoxObjectType() != LoxType::Instance) return false;
+    LoxInstance* instance = object.getInstance();
+    LoxObject field;
+    if (instance->getField(name.lexeme, field)) return false;
+    LoxFunction* method = instance->getClass()->findMethod(name.lexeme);
+    return method && method->getDeclaration() == function;
+}
+
+void Inliner::collect(std::vector<SExpr>& statements, bool global) {
+    for (auto& stmt : statements) {
+        collect(stmt, global);
+    }
+}
+
+void Inliner::collect(SExpr& stmt, bool global) {
+    // global functions come from the top level, methods from classes
+    // declared anywhere.
+    switch (TypeIdentifier{}.identify(stmt)) {
+        case Type::Function: {
+            auto& function = static_cast<Function&>(*stmt);
+            if (global) {
+                auto [it, added] = functions.emplace(function.name.lexeme, &function);
+                if (!added || !inlinable(function)) it->second = nullptr;
+            }
+            collect(function.body, false);
+            break;
+        }
+        case Type::Class:
+            for (auto& method : static_cast<Class&>(*stmt).methods) {
+                auto [it, added] = methods.emplace(method->name.lexeme, method.get());
+                if (!added || !inlinable(*method)) it->second = nullptr;
+                collect(method->body, false);
+            }
+            break;
+        case Type::Block:
+            collect(static_cast<Block&>(*stmt).statements, false);
+            break;
+        case Type::If: {
+            auto& branch = static_cast<If&>(*stmt);
+            collect(branch.thenBranch, false);
+            if (branch.elseBranch) collect(branch.elseBranch, false);
+            break;
+        }
+        case Type::While:
+            collect(static_cast<While&>(*stmt).body, false);
+            break;
+        default:
+            break;
+    }
+}
+
+bool Inliner::inlinable(Function& function) {
+    if (function.kind != "function" && function.kind != "method" && function.kind != "getter") return false;
+    if (function.name.lexeme == "init" || !function.upvalues.empty() || function.body.size() != 1) return false;
+    if (TypeIdentifier{}.identify(function.body[0]) != Type::Return) return false;
+    auto& ret = static_cast<Return&>(*function.body[0]);
+    if (!ret.value) return false;
+    // the parameters, then the receiver of a method.
+    unsigned int slots = function.params.size() + (function.kind != "function");
+    unsigned int budget = MAX_NODES;
+    return small(ret.value, slots, budget);
+}
+
+bool Inliner::small(PExpr& expr, unsigned int slots, unsigned int& budget) {
+    if (budget-- == 0) return false;
+    switch (TypeIdentifier{}.identify(expr)) {
+        case Type::Literal:
+            return true;
+        case Type::Variable: {
+            auto& variable = static_cast<Variable&>(*expr);
+            if (variable.upvalue >= 0) return false;
+            return variable.slot < (int)slots;
+        }
+        case Type::This: {
+            auto& self = static_cast<This&>(*expr);
+            return self.upvalue < 0 && self.slot >= 0 && self.slot < (int)slots;
+        }
+        case Type::Grouping:
+            return small(static_cast<Grouping&>(*expr).expression, slots, budget);
+        case Type::Unary:
+            return small(static_cast<Unary&>(*expr).right, slots, budget);
+        case Type::Binary: {
+            auto& binary = static_cast<Binary&>(*expr);
+            return small(binary.left, slots, budget) && small(binary.right, slots, budget);
+        }
+        case Type::Logical: {
+            auto& logical = static_cast<Logical&>(*expr);
+            return small(logical.left, slots, budget) && small(logical.right, slots, budget);
+        }
+        case Type::Ternary: {
+            auto& ternary = static_cast<Ternary&>(*expr);
+            return small(ternary.condition, slots, budget) && small(ternary.thenBranch, slots, budget)
+                && small(ternary.elseBranch, slots, budget);
+        }
+        case Type::Get:
+            return small(static_cast<Get&>(*expr).object, slots, budget);
+        default:
+            return false;
+    }
+}
+
+Inliner::PExpr Inliner::copy(PExpr& expr, unsigned int firstSlot) {
+    switch (TypeIdentifier{}.identify(expr)) {
+        case Type::Literal:
+            return std::make_unique<Literal>(static_cast<Literal&>(*expr).value);
+        case Type::Variable: {
+            auto& variable = static_cast<Variable&>(*expr);
+            auto result = std::make_unique<Variable>(variable.name);
+            if (variable.slot >= 0) result->slot = firstSlot + variable.slot;
+            result->global = variable.global;
+            return result;
+        }
+        case Type::This: {
+            auto& self = static_cast<This&>(*expr);
+            auto result = std::make_unique<This>(self.keyword);
+            result->slot = firstSlot + self.slot;
+            return result;
+        }
+        case Type::Grouping:
+            return std::make_unique<Grouping>(copy(static_cast<Grouping&>(*expr).expression, firstSlot));
+        case Type::Unary: {
+            auto& unary = static_cast<Unary&>(*expr);
+            return std::make_unique<Unary>(unary.operator_, copy(unary.right, firstSlot));
+        }
+        case Type::Binary: {
+            auto& binary = static_cast<Binary&>(*expr);
+            return std::make_unique<Binary>(copy(binary.left, firstSlot), binary.operator_,
+                                            copy(binary.right, firstSlot));
+        }
+        case Type::Logical: {
+            auto& logical = static_cast<Logical&>(*expr);
+            return std::make_unique<Logical>(copy(logical.left, firstSlot), logical.operator_,
+                                             copy(logical.right, firstSlot));
+        }
+        case Type::Ternary: {
+            auto& ternary = static_cast<Ternary&>(*expr);
+            return std::make_unique<Ternary>(copy(ternary.condition, firstSlot),
+                                             copy(ternary.thenBranch, firstSlot),
+                                             copy(ternary.elseBranch, firstSlot));
+        }
+        case Type::Get: {
+            auto& get = static_cast<Get&>(*expr);
+            return std::make_unique<Get>(copy(get.object, firstSlot), get.name);
+        }
+        case Type::Inlined:
+            // a getter read inlined in the body being copied.
+            return copy(static_cast<Inlined&>(*expr).original, firstSlot);
+        default:
+            throw std::logic_error("Copy of a body that isn't inlinable.");
+    }
+}
+
+Function* Inliner::target(PExpr& expr) {
+    Function* function = nullptr;
+    switch (TypeIdentifier{}.identify(expr)) {
+        case Type::Call: {
+            auto& call = static_cast<Call&>(*expr);
+            Type callee = TypeIdentifier{}.identify(call.callee);
+            if (callee == Type::Variable) {
+                auto& variable = static_cast<Variable&>(*call.callee);
+                if (variable.slot >= 0 || variable.upvalue >= 0) return nullptr;
+                auto it = functions.find(variable.name.lexeme);
+                if (it != functions.end()) function = it->second;
+            } else if (callee == Type::Get) {
+                auto it = methods.find(static_cast<Get&>(*call.callee).name.lexeme);
+                if (it != methods.end() && it->second && it->second->kind == "method") function = it->second;
+            }
+            if (function && function->params.size() != call.arguments.size()) return nullptr;
+            break;
+        }
+        case Type::Get: {
+            auto it = methods.find(static_cast<Get&>(*expr).name.lexeme);
+            if (it != methods.end() && it->second && it->second->kind == "getter") function = it->second;
+            break;
+        }
+        default:
+            return nullptr;
+    }
+    if (std::find(inlining.begin(), inlining.end(), function) != inlining.end()) return nullptr;
+    return function;
+}
+
+void Inliner::replace(PExpr& expr, Function* function) {
+    // the slots of the copy are taken before the arguments are rewritten,
+    // whose own copies run while some of them are already set.
+    unsigned int firstSlot = top;
+    top += function->params.size() + (function->kind != "function");
+    *frameSize = std::max(*frameSize, top);
+
+    if (TypeIdentifier{}.identify(expr) == Type::Call) {
+        auto& call = static_cast<Call&>(*expr);
+        if (function->kind == "function") {
+            rewrite(call.callee);
+        } else {
+            rewrite(static_cast<Get&>(*call.callee).object);
+        }
+        for (auto& argument : call.arguments) {
+            rewrite(argument);
+        }
+    } else {
+        rewrite(static_cast<Get&>(*expr).object);
+    }
+
+    auto& ret = static_cast<Return&>(*function->body[0]);
+    auto inlined = std::make_unique<Inlined>(std::move(expr), copy(ret.value, firstSlot));
+    inlined->function = function;
+    inlined->firstSlot = firstSlot;
+    // getters read in the copy are inlined in turn.
+    inlining.push_back(function);
+    rewrite(inlined->body);
+    inlining.pop_back();
+    expr = std::move(inlined);
+    top = firstSlot;
+}
+
+void Inliner::rewrite(std::vector<SExpr>& statements) {
+    for (auto& stmt : statements) {
+        rewrite(stmt);
+    }
+}
+
+void Inliner::rewrite(Function& function) {
+    unsigned int* enclosingFrame = frameSize;
+    unsigned int enclosingTop = top;
+    frameSize = &function.frameSize;
+    top = function.frameSize;
+    inlining.push_back(&function);
+    rewrite(function.body);
+    inlining.pop_back();
+    frameSize = enclosingFrame;
+    top = enclosingTop;
+}
+
+void Inliner::rewrite(SExpr& stmt) {
+    switch (TypeIdentifier{}.identify(stmt)) {
+        case Type::Block:
+            rewrite(static_cast<Block&>(*stmt).statements);
+            break;
+        case Type::Class: {
+            auto& klass = static_cast<Class&>(*stmt);
+            if (klass.superclass) rewrite(klass.superclass);
+            for (auto& method : klass.methods) {
+                rewrite(*method);
+            }
+            break;
+        }
+        case Type::Expression:
+            rewrite(static_cast<Expression&>(*stmt).expression);
+            break;
+        case Type::Function:
+            rewrite(static_cast<Function&>(*stmt));
+            break;
+        case Type::If: {
+            auto& branch = static_cast<If&>(*stmt);
+            rewrite(branch.condition);
+            rewrite(branch.thenBranch);
+            if (branch.elseBranch) rewrite(branch.elseBranch);
+            break;
+        }
+        case Type::Print:
+            rewrite(static_cast<Print&>(*stmt).expression);
+            break;
+        case Type::Return: {
+            auto& ret = static_cast<Return&>(*stmt);
+            if (!ret.value) break;
+            rewrite(ret.value);
+            // a copy has nothing left to call in tail position.
+            if (ret.tailCall) ret.tailCall = TypeIdentifier{}.identify(ret.value) == Type::Call;
+            break;
+        }
+        case Type::Var: {
+            auto& var = static_cast<Var&>(*stmt);
+            if (var.initializer) rewrite(var.initializer);
+            break;
+        }
+        case Type::While: {
+            auto& loop = static_cast<While&>(*stmt);
+            rewrite(loop.condition);
+            rewrite(loop.body);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void Inliner::rewrite(PExpr& expr) {
+    if (Function* function = target(expr)) {
+        replace(expr, function);
+        return;
+    }
+    switch (TypeIdentifier{}.identify(expr)) {
+        case Type::Assign:
+            rewrite(static_cast<Assign&>(*expr).value);
+            break;
+        case Type::Binary: {
+            auto& binary = static_cast<Binary&>(*expr);
+            rewrite(binary.left);
+            rewrite(binary.right);
+            break;
+        }
+        case Type::Call: {
+            auto& call = static_cast<Call&>(*expr);
+            rewrite(call.callee);
+            for (auto& argument : call.arguments) {
+                rewrite(argument);
+            }
+            break;
+        }
+        case Type::CommaExpr:
+            for (auto& expression : static_cast<CommaExpr&>(*expr).expressions) {
+                rewrite(expression);
+            }
+            break;
+        case Type::Get:
+            rewrite(static_cast<Get&>(*expr).object);
+            break;
+        case Type::Grouping:
+            rewrite(static_cast<Grouping&>(*expr).expression);
+            break;
+        case Type::Logical: {
+            auto& logical = static_cast<Logical&>(*expr);
+            rewrite(logical.left);
+            rewrite(logical.right);
+            break;
+        }
+        case Type::Set: {
+            auto& set = static_cast<Set&>(*expr);
+            rewrite(set.object);
+            rewrite(set.value);
+            break;
+        }
+        case Type::Ternary: {
+            auto& ternary = static_cast<Ternary&>(*expr);
+            rewrite(ternary.condition);
+            rewrite(ternary.thenBranch);
+            rewrite(ternary.elseBranch);
+            break;
+        }
+        case Type::Unary:
+            rewrite(static_cast<Unary&>(*expr).right);
+            break;
+        default:
+            break;
+    }
+}
+
+} // namespace lox
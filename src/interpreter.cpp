@@ -1,16 +1,32 @@
 #include "interpreter.hpp"
-#include "return.hpp"
+#include "compiler.hpp"
+#include "registerCompiler.hpp"
+#include "inliner.hpp"
+#include "type.hpp"
+#include <cstdint>
+// the bounds of a thread's stack are in libc from glibc 2.34 on.
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 34)
+#define LOX_STACK_BOUNDS
+#include <pthread.h>
+#endif
 
 namespace lox {
 
+static constexpr size_t STACK_INITIAL_SLOTS = 1024;
+// native stack left to the code between two calls of the tree walker.
+static constexpr uintptr_t NATIVE_STACK_MARGIN = 256 << 10;
+// what the tree walker may use when the bounds of the stack aren't known.
+static constexpr uintptr_t NATIVE_STACK_FALLBACK = 1 << 20;
+
 Interpreter::Interpreter() {
+    Accounting::Charge charge{m_account};
     m_destroying = false;
-    globals = std::make_shared<Environment>();
-    environment = globals;
     std::unique_ptr<LoxCallable> clock {static_cast<LoxCallable*>(new TimeFunction())}; 
     auto* clockPtr = clock.get();
-    m_callables[clockPtr] = {std::move(clock), 0};
-    globals->define("clock", LoxObject(clockPtr, this));
+    m_callables[clockPtr] = std::move(clock);
+    globals.define(globals.index("clock"), LoxObject(clockPtr, this));
+    reserveStack(STACK_INITIAL_SLOTS);
+    m_vm = std::make_unique<VM>(*this);
 }
 
 Interpreter::~Interpreter() {
@@ -19,85 +35,132 @@ Interpreter::~Interpreter() {
     
     // Note: the m_destroying is a hack to avoid double-destruction
     m_destroying = true;
+    m_collector.abandon();
     m_instances.clear();
     m_classes.clear();
+    m_functions.clear();
     m_callables.clear();
-    m_funcenvs.clear();
+    m_openUpvalues.clear();
+    m_stack.clear();
+    // the members left free their blocks after.
+    Accounting::close(m_account);
 }
 
 void Interpreter::addUser(LoxCallable* func) {
-    ++m_callables[func].second;
+    ++func->users;
 }
 
 void Interpreter::addUser(LoxClass* klass) {
-    ++m_classes[klass].second;
+    // a class is also an instance, its count is the callable's.
+    ++klass->LoxCallable::users;
 }
 
 void Interpreter::addUser(LoxInstance* inst) {
-    ++m_instances[inst].second;
+    ++inst->users;
 }
 
 void Interpreter::removeUser(LoxCallable* func) {
-    if (m_destroying) return;
-    --m_callables[func].second;
-    if(!m_callables[func].second){
-        m_callables.erase(func);
-    }
+    if (m_destroying || --func->users) return;
+    free({LoxType::Callable, func, nullptr, nullptr});
 }
 
 void Interpreter::removeUser(LoxClass* klass) {
-    if (m_destroying) return;
-    --m_classes[klass].second;
-    if (!m_classes[klass].second) {
-        m_classes.erase(klass);
-    }
+    if (m_destroying || --klass->LoxCallable::users) return;
+    free({LoxType::Class, nullptr, klass, nullptr});
 }
 
 void Interpreter::removeUser(LoxInstance* inst) {
-    if (m_destroying) return;
-    --m_instances[inst].second;
-    if (!m_instances[inst].second) {
-        m_instances.erase(inst);
+    if (m_destroying || --inst->users) return;
+    free({LoxType::Instance, nullptr, nullptr, inst});
+}
+
+void Interpreter::free(Unused object) {
+    // freeing an object releases the ones its fields refer to: they wait
+    // until it's done, so that dropping a long chain of objects doesn't
+    // nest a destructor per link on the native stack.
+    m_unused.push_back(object);
+    if (m_freeing) return;
+    m_freeing = true;
+    while (!m_unused.empty()) {
+        Unused next = m_unused.back();
+        m_unused.pop_back();
+        switch (next.type) {
+            case LoxType::Callable:
+                if (LoxFunction* function = next.function->asFunction()) {
+                    destroy(m_functions, function);
+                } else {
+                    m_callables.erase(next.function);
+                }
+                break;
+            case LoxType::Class:
+                destroy(m_classes, next.klass);
+                break;
+            default:
+                destroy(m_instances, next.instance);
+        }
     }
+    m_freeing = false;
 }
 
-LoxFunction* Interpreter::createFunction(LoxFunction* fun, PEnvironment env) {
-    auto func = std::make_unique<LoxFunction>(*fun, env);
-    auto* callablePtr = func.get();
-    m_callables[callablePtr] = {std::move(func), 0};
-    return callablePtr;
+template <class T, class... Args>
+T* Interpreter::create(Pool<Tracked<T>>& pool, Collector::Kind kind, Args&&... args) {
+    Accounting::check();
+    auto* tracked = pool.create(std::forward<Args>(args)...);
+    m_collector.track(&tracked->header, kind);
+    return &tracked->object;
 }
 
-LoxFunction* Interpreter::createFunction(Function* stmt, PEnvironment env, bool initClass) {
-    auto func = std::make_unique<LoxFunction>(stmt, this, env, initClass);
-    auto* callablePtr = func.get();
-    m_callables[callablePtr] = {std::move(func), 0};
-    return callablePtr;
+template <class T>
+void Interpreter::destroy(Pool<Tracked<T>>& pool, T* object) {
+    auto* tracked = Tracked<T>::of(object);
+    m_collector.untrack(&tracked->header);
+    pool.destroy(tracked);
 }
 
-void Interpreter::registerFunction(LoxFunction* func, PEnvironment env) {
-    if (m_funcenvs.find(func) != m_funcenvs.end()) {
-        throw std::runtime_error("Function already registered.");
-    }
-    m_funcenvs[func] = env;
+LoxFunction* Interpreter::createFunction(LoxFunction* fun, LoxObject receiver) {
+    return create(m_functions, Collector::Kind::Function, *fun, receiver);
 }
 
-void Interpreter::deleteFunction(LoxFunction* func) {
-    if (m_funcenvs.find(func) == m_funcenvs.end()) {
-        throw std::runtime_error("Failed to find function to delete.\n");
+LoxFunction* Interpreter::createFunction(Function* stmt, bool initClass) {
+    // capture the variables the closure uses, as described by the resolver.
+    Upvalues upvalues;
+    upvalues.reserve(stmt->upvalues.size());
+    for (auto& desc : stmt->upvalues) {
+        if (desc.isLocal) {
+            upvalues.push_back(captureUpvalue(m_fp + desc.index));
+        } else {
+            upvalues.push_back(m_closure->getUpvalues()[desc.index]);
+        }
     }
-    m_funcenvs.erase(func);
+    return create(m_functions, Collector::Kind::Function, stmt, this, std::move(upvalues), initClass);
 }
 
 LoxInstance* Interpreter::createInstance(LoxClass* loxklass) {
-    std::unique_ptr<LoxInstance> instance = std::make_unique<LoxInstance>(loxklass);
-    auto* instancePtr = instance.get();
-    m_instances[instancePtr] = {std::move(instance), 0};
-    return instancePtr;
+    return create(m_instances, Collector::Kind::Instance, loxklass);
 }
 
-void Interpreter::resolve(Expr* expr, unsigned int depth) {
-    locals.insert({expr, depth});
+PUpvalue Interpreter::captureUpvalue(size_t slot) {
+    // closures capturing the same variable share its upvalue.
+    auto it = m_openUpvalues.end();
+    while (it != m_openUpvalues.begin() && (*(it - 1))->slot >= slot) {
+        --it;
+        if ((*it)->slot == slot) return *it;
+    }
+    return *m_openUpvalues.insert(it, std::allocate_shared<Upvalue>(PoolAllocator<Upvalue>(m_upvalues), slot));
+}
+
+void Interpreter::closeUpvalues(size_t from) {
+    while (!m_openUpvalues.empty() && m_openUpvalues.back()->slot >= from) {
+        auto& upvalue = m_openUpvalues.back();
+        upvalue->closed = m_stack[upvalue->slot];
+        upvalue->open = false;
+        m_openUpvalues.pop_back();
+    }
+}
+
+LoxObject& Interpreter::upvalue(int index) {
+    auto& upvalue = *m_closure->getUpvalues()[index];
+    return upvalue.open ? m_stack[upvalue.slot] : upvalue.closed;
 }
 
 LoxObject Interpreter::visitLiteralExpr(Literal& expr) {
@@ -123,14 +186,13 @@ LoxObject Interpreter::visitSetExpr(Set& expr) {
 }
 
 LoxObject Interpreter::visitSuperExpr(Super& expr) {
-    auto distance = locals[&expr];
-    auto superclass = environment->getAt(distance, "super");
-    auto object = environment->getAt(distance - 1, "this");
+    auto superclass = lookUpVariable(expr.keyword, expr.slot, expr.upvalue);
+    auto object = lookUpVariable(expr.keyword, expr.thisSlot, expr.thisUpvalue);
     return superclass.getLoxClass()->function(expr.method, object.getInstance());
 }
 
 LoxObject Interpreter::visitThisExpr(This& expr) {
-    return lookUpVariable(expr.keyword, &expr);
+    return lookUpVariable(expr.keyword, expr.slot, expr.upvalue);
 }
 
 LoxObject Interpreter::visitTernaryExpr(Ternary& expr) {
@@ -142,6 +204,51 @@ LoxObject Interpreter::visitGroupingExpr(Grouping& expr) {
     return evaluate(expr.expression);
 }
 
+LoxObject Interpreter::visitHoistedExpr(Hoisted& expr) {
+    // the flag of the value is in the next slot, false when the value is
+    // computed at each iteration.
+    if (m_stack[m_fp + expr.slot + 1]) return m_stack[m_fp + expr.slot];
+    LoxObject value = evaluate(expr.expression);
+    if (m_stack[m_fp + expr.slot + 1].getLoxObjectType() == LoxType::Nil) {
+        m_stack[m_fp + expr.slot] = value;
+        m_stack[m_fp + expr.slot + 1] = LoxObject(true);
+    }
+    return value;
+}
+
+LoxObject Interpreter::visitInlinedExpr(Inlined& expr) {
+    // the copy runs where the guard holds, the original call otherwise.
+    // Its arguments and receiver go to the slots from firstSlot on.
+    size_t first = m_fp + expr.firstSlot;
+    if (TypeIdentifier{}.identify(expr.original) == Type::Get) {
+        auto& get = static_cast<Get&>(*expr.original);
+        LoxObject object = evaluate(get.object);
+        if (!Inliner::isMethod(object, get.name, expr.function)) return object.get(get.name);
+        m_stack[first] = object;
+        return evaluate(expr.body);
+    }
+
+    auto& call = static_cast<Call&>(*expr.original);
+    size_t arity = call.arguments.size();
+    if (TypeIdentifier{}.identify(call.callee) == Type::Get) {
+        auto& get = static_cast<Get&>(*call.callee);
+        LoxObject object = evaluate(get.object);
+        if (!Inliner::isMethod(object, get.name, expr.function)) {
+            LoxObject callee = object.get(get.name);
+            return this->call(callee, call);
+        }
+        m_stack[first + arity] = object;
+    } else {
+        LoxObject callee = evaluate(call.callee);
+        if (!Inliner::isFunction(callee, expr.function)) return this->call(callee, call);
+    }
+    for (size_t i = 0; i < arity; i++) {
+        LoxObject argument = evaluate(call.arguments[i]);
+        m_stack[first + i] = argument;
+    }
+    return evaluate(expr.body);
+}
+
 LoxObject Interpreter::visitUnaryExpr(Unary& expr) {
     LoxObject right = evaluate(expr.right);
 
@@ -187,6 +294,50 @@ LoxObject Interpreter::visitBinaryExpr(Binary& expr) {
 
 LoxObject Interpreter::visitCallExpr(Call& expr) {
     LoxObject callee = evaluate(expr.callee);
+    return call(callee, expr);
+}
+
+void Interpreter::checkNativeStack(const void* here) {
+    // the lowest address the calls of this thread may reach, found once
+    // per thread since contexts can move between threads.
+    static thread_local uintptr_t end = 0;
+    uintptr_t address = reinterpret_cast<uintptr_t>(here);
+    if (!end) {
+#if defined(LOX_STACK_BOUNDS)
+        pthread_attr_t attributes;
+        void* low;
+        size_t size;
+        if (pthread_getattr_np(pthread_self(), &attributes) == 0) {
+            if (pthread_attr_getstack(&attributes, &low, &size) == 0) {
+                end = reinterpret_cast<uintptr_t>(low) + NATIVE_STACK_MARGIN;
+            }
+            pthread_attr_destroy(&attributes);
+        }
+#endif
+        if (!end) end = address - NATIVE_STACK_FALLBACK;
+    }
+    if (address < end) throw std::runtime_error("Stack overflow.");
+}
+
+LoxObject Interpreter::call(LoxObject& callee, Call& expr) {
+    // Lox functions get their arguments evaluated straight into the slots
+    // of the frame being prepared for them.
+    LoxFunction* function = callee.getLoxObjectType() == LoxType::Callable
+                          ? callee.getFunction()->asFunction() : nullptr;
+    if (function) {
+        if (expr.arguments.size() != function->arity()) {
+            throw std::runtime_error("Function argument count mismatch. Expected "
+                + std::to_string(function->arity()) + ", got " 
+                + std::to_string(expr.arguments.size()) + "\n");
+        }
+        CallFrame frame(*this, function->getDeclaration()->frameSize);
+        for (size_t i = 0; i < expr.arguments.size(); i++) {
+            frame[i] = evaluate(expr.arguments[i]);
+        }
+        LoxObject result;
+        if (m_jit && m_jit->call(function, frame.slots(), result)) return result;
+        return function->call(*this, frame);
+    }
 
     std::vector<LoxObject> arguments {};
     for (auto& argument : expr.arguments){
@@ -211,16 +362,17 @@ LoxObject Interpreter::visitGetExpr(Get& expr) {
 }
 
 LoxObject Interpreter::visitVariableExpr(Variable& expr) {
-    return lookUpVariable(expr.name, &expr); 
+    return lookUpVariable(expr.name, expr.slot, expr.upvalue, expr.global); 
 }
 
 LoxObject Interpreter::visitAssignExpr(Assign& expr) {
     LoxObject value = evaluate(expr.value);
-    if (locals.find(&expr) != locals.end()) {
-        unsigned int distance = locals[&expr];
-        environment->assignAt(distance, expr.name, value);
+    if (expr.slot >= 0) {
+        m_stack[m_fp + expr.slot] = value;
+    } else if (expr.upvalue >= 0) {
+        upvalue(expr.upvalue) = value;
     } else {
-        globals->assign(expr.name, value);
+        globals.get(expr.global, expr.name) = value;
     }
     return value;
 }
@@ -231,8 +383,12 @@ void Interpreter::visitExpressionStmt(Expression& stmt) {
 }
 
 void Interpreter::visitFunctionStmt(Function& stmt) {
-    auto* function = createFunction(&stmt, environment);
-    environment->define(stmt.name.lexeme, LoxObject(function, this));
+    auto* function = createFunction(&stmt);
+    if (stmt.slot >= 0) {
+        m_stack[m_fp + stmt.slot] = LoxObject(function, this);
+    } else {
+        globals.define(stmt.global, LoxObject(function, this));
+    }
 }
 
 void Interpreter::visitIfStmt(If& stmt) {
@@ -245,16 +401,41 @@ void Interpreter::visitIfStmt(If& stmt) {
 
 void Interpreter::visitPrintStmt(Print& stmt) {
     LoxObject value = evaluate(stmt.expression);
-    std::cout << value << '\n';
+    *m_out << value << '\n';
 }
 
 void Interpreter::visitReturnStmt(Return& stmt) {
-    LoxObject value;
-    if (stmt.value) {
-        value = evaluate(stmt.value);
+    m_returnValue = LoxObject();
+    if (stmt.tailCall) {
+        auto& expr = *static_cast<Call*>(stmt.value.get());
+        LoxObject callee = evaluate(expr.callee);
+        LoxFunction* function = callee.getLoxObjectType() == LoxType::Callable
+                              ? callee.getFunction()->asFunction() : nullptr;
+        if (function && expr.arguments.size() == function->arity()) {
+            // arguments are evaluated above the frame, which stays untouched 
+            // until the call loop moves them down into the parameter slots.
+            size_t args = m_sp;
+            reserveStack(args + expr.arguments.size());
+            m_sp = args + expr.arguments.size();
+            try {
+                for (size_t i = 0; i < expr.arguments.size(); i++) {
+                    m_stack[args + i] = evaluate(expr.arguments[i]);
+                }
+            } catch (...) {
+                for (size_t i = args; i < m_sp; i++) m_stack[i] = LoxObject();
+                m_sp = args;
+                throw;
+            }
+            m_sp = args;
+            m_tailCallee = callee;
+        } else {
+            m_returnValue = call(callee, expr);
+        }
+    } else if (stmt.value) {
+        m_returnValue = evaluate(stmt.value);
     }
 
-    throw ReturnExcept(value); // ugly but author gives reasonable excuses.
+    m_returning = true;
 }
 
 void Interpreter::visitVarStmt(Var& stmt) {
@@ -262,26 +443,72 @@ void Interpreter::visitVarStmt(Var& stmt) {
     if (stmt.initializer) {
         value = evaluate(stmt.initializer);
     }
-    environment->define(stmt.name.lexeme, value); 
+    if (stmt.slot >= 0) {
+        m_stack[m_fp + stmt.slot] = value;
+    } else {
+        globals.define(stmt.global, value);
+    }
 }
 
 void Interpreter::visitWhileStmt(While& stmt) {
-    while (evaluate(stmt.condition)) {
+    // iterations count towards tiering up the function running the loop,
+    // and the loop itself goes on in the VM once it's hot.
+    bool tiered = m_engine == Engine::Tiered;
+    unsigned int* loops = tiered && m_closure ? &m_closure->getDeclaration()->loops : nullptr;
+    if (!stmt.hoisted.empty()) {
+        LoxObject flag = hoists(stmt) ? LoxObject() : LoxObject(false);
+        for (int slot : stmt.hoisted) {
+            m_stack[m_fp + slot + 1] = flag;
+        }
+    }
+    for (;;) {
+        if (tiered && enterCompiledLoop(stmt)) return;
+        if (!evaluate(stmt.condition)) return;
         execute(stmt.body); 
+        if (m_returning) return;
+        if (!m_closure) safePoint();
+        if (loops && *loops < m_tierUp.loops) ++*loops;
+        if (tiered && stmt.backEdges < m_tierUp.loops) stmt.backEdges++;
     }
-    
 }
 
-void Interpreter::executeBlock(std::vector<std::unique_ptr<Stmt>>& statements, PEnvironment newEnv) {
-    ScopeEnvironment newScope(environment, newEnv);
+bool Interpreter::hoists(While& loop) {
+    // a getter declared by a program compiled after the loop may be read
+    // by it, the loop then calls code which can change its invariants.
+    if (loop.getters != m_getters.size()) {
+        loop.getters = m_getters.size();
+        loop.hoisting = std::none_of(loop.reads.begin(), loop.reads.end(),
+                                     [this](const std::string& name) { return m_getters.count(name); });
+    }
+    return loop.hoisting;
+}
+
+bool Interpreter::enterCompiledLoop(While& loop) {
+    if (!loop.chunk) {
+        if (loop.backEdges < m_tierUp.loops) return false;
+        // locals are where the tree walker left them, in the frame
+        // which ends at m_sp while its statements run.
+        loop.chunk = Compiler::compile(loop, m_sp - m_fp);
+        if (m_tierUp.log) {
+            *m_err << "[tier-up] loop in " << (m_closure ? m_closure->getDeclaration()->name.lexeme : "script")
+                   << " after " << loop.backEdges << " iterations" << std::endl;
+        }
+    }
+    m_vm->enterLoop(*loop.chunk);
+    return true;
+}
+
+void Interpreter::executeBlock(std::vector<std::unique_ptr<Stmt>>& statements) {
     for (auto& statement: statements) {
         execute(statement);
+        if (m_returning) return;
     }
 }
 
 void Interpreter::visitBlockStmt(Block& stmt) {
-    auto newEnv = std::make_shared<Environment>(environment); 
-    executeBlock(stmt.statements, newEnv);
+    // locals of the block already have their slots in the current frame.
+    executeBlock(stmt.statements);
+    if (stmt.captured) closeUpvalues(m_fp + stmt.firstSlot);
 }
 
 void Interpreter::visitClassStmt(Class& stmt) {
@@ -289,40 +516,150 @@ void Interpreter::visitClassStmt(Class& stmt) {
     LoxObject superclass;
     if (stmt.superclass) {
         superclass = evaluate(stmt.superclass);
-        if (superclass.getLoxObjectType() != LoxType::Class) {
-            throw std::runtime_error("Superclass must be a class.");
-        }
     }
-    environment->define(stmt.name.lexeme, LoxObject());
+    LoxObject klass = createClass(stmt, superclass);
+
+    if (stmt.slot >= 0) {
+        m_stack[m_fp + stmt.slot] = klass;
+    } else {
+        globals.define(stmt.global, klass);
+    }
+}
+
+LoxObject Interpreter::createClass(Class& stmt, LoxObject superclass) {
+    if (stmt.superclass && superclass.getLoxObjectType() != LoxType::Class) {
+        throw std::runtime_error("Superclass must be a class.");
+    }
+    if (stmt.slot < 0) globals.define(stmt.global, LoxObject());
 
     if(stmt.superclass) {
-        environment = std::make_shared<Environment>(environment);
-        environment->define("super", superclass);
-        // will allow methods closure to capture environment containing super.  
+        // methods capture "super" from its own slot when they are created.
+        m_stack[m_fp + stmt.superSlot] = superclass;
+    }
+    LoxClass* classyPtr = create(m_classes, Collector::Kind::Class, &stmt, superclass.getLoxClass(), this);
+
+    if (stmt.superclass) {
+        closeUpvalues(m_fp + stmt.superSlot);
+        m_stack[m_fp + stmt.superSlot] = LoxObject();
+    }
+    return LoxObject(classyPtr, this);
+}
+
+LoxObject Interpreter::createCallable(std::unique_ptr<LoxCallable> callable) {
+    auto* callablePtr = callable.get();
+    m_callables[callablePtr] = std::move(callable);
+    return LoxObject(callablePtr, this);
+}
+
+LoxObject Interpreter::createClass(Token name, LoxObject superclass, std::map<std::string, LoxObject> methods) {
+    // superclass is nil for a class without one.
+    LoxClass* classyPtr = create(m_classes, Collector::Kind::Class, name, superclass.getLoxClass(), this, std::move(methods));
+    return LoxObject(classyPtr, this);
+}
+
+void Interpreter::printHeapStats(std::ostream& out) const {
+    auto print = [&out](const char* pool, const PoolStats& stats) {
+        out << pool << ": " << stats.live << " live, " 
+            << stats.live * stats.blockSize << " bytes in use, "
+            << stats.slabs << " slabs of " << Slabs::SLAB_BYTES / 1024 << " KiB, "
+            << static_cast<int>(stats.utilization() * 100 + 0.5) << "% used\n";
+    };
+    print("instances", m_instances.stats());
+    print("functions", m_functions.stats());
+    print("classes", m_classes.stats());
+    print("upvalues", m_upvalues.stats());
+    m_collector.printStats(out);
+    Accounting::print(*m_account, out);
+}
+
+CallFrame::CallFrame(Interpreter& intp, unsigned int size_)
+    : interpreter{intp}, base{intp.m_sp}, size{size_}, 
+      previousFp{intp.m_fp}, previousClosure{intp.m_closure} {
+    interpreter.reserveStack(base + size);
+    interpreter.m_sp = base + size;
+}
+
+void CallFrame::reuse(unsigned int size_, size_t arity) {
+    // the pending arguments of a tail call sit right above the frame.
+    size_t args = base + size;
+    interpreter.closeUpvalues(base);
+    for (size_t i = 0; i < arity; i++) {
+        interpreter.m_stack[base + i] = interpreter.m_stack[args + i];
+    }
+    for (size_t i = base + arity; i < args + arity; i++) {
+        interpreter.m_stack[i] = LoxObject();
     }
-    auto classy = std::make_unique<LoxClass>(&stmt, superclass.getLoxClass(), this, environment);
-    auto* classyPtr = classy.get();
-    m_classes[classyPtr] = {std::move(classy), 0};
+    size = size_;
+    interpreter.reserveStack(base + size);
+    interpreter.m_sp = base + size;
+}
 
+CallFrame::~CallFrame() {
+    interpreter.closeUpvalues(base);
+    // drop what the slots hold so that objects aren't kept alive by a dead frame.
+    for (size_t i = base; i < base + size; i++) {
+        interpreter.m_stack[i] = LoxObject();
+    }
+    interpreter.m_sp = base;
+    interpreter.m_fp = previousFp;
+    interpreter.m_closure = previousClosure;
+}
+
+bool Interpreter::tierUp(Function& function) {
+    if (function.chunk) return true;
+    if (function.calls < m_tierUp.calls) function.calls++;
+    if (function.calls < m_tierUp.calls && function.loops < m_tierUp.loops) return false;
 
-    if (superclass.getLoxObjectType() != LoxType::Nil) {
-        environment = environment->enclosing;
+    Compiler::compile(function);
+    if (m_tierUp.log) {
+        *m_err << "[tier-up] " << function.name.lexeme << " after " << function.calls 
+               << " calls and " << function.loops << " loop iterations" << std::endl;
     }
+    return true;
+}
 
-    environment->assign(stmt.name, LoxObject(classyPtr, this));
+LoxObject Interpreter::invoke(const LoxObject& callee, std::vector<LoxObject> args) {
+    Accounting::Charge charge{m_account};
+    if (callee.getLoxObjectType() != LoxType::Callable && callee.getLoxObjectType() != LoxType::Class) {
+        throw std::runtime_error("Can only call functions and classes.");
+    }
+    LoxObject function = callee;
+    return function(*this, std::move(args));
 }
 
-void Interpreter::interpret(std::vector<std::unique_ptr<Stmt>>& statements) {
+LoxObject Interpreter::global(const std::string& name) {
+    int index = globals.find(name);
+    if (index < 0 || !globals.defined(index)) {
+        throw std::runtime_error("Undefined variable '" + name + "'.");
+    }
+    return globals.get(index, Token(IDENTIFIER, name, 0));
+}
+
+bool Interpreter::interpret(std::vector<std::unique_ptr<Stmt>>& statements, unsigned int frameSize) {
+    Accounting::Charge charge{m_account};
     try
     {
+        if (m_engine == Engine::Stackless) {
+            auto script = Compiler::compile(statements, frameSize);
+            m_vm->interpret(*script);
+            return true;
+        }
+        if (m_engine == Engine::Registers) {
+            auto script = RegisterCompiler::compile(statements, frameSize);
+            m_vm->interpret(*script, true);
+            return true;
+        }
+        CallFrame script(*this, frameSize);
+        script.enter(nullptr);
         for (auto& stmt : statements) {
             execute(stmt);
         }
+        return true;
     }
     catch(const std::runtime_error& e)
     {
-        std::cerr << e.what() << '\n';
-        Lox::runtimeError();
+        *m_err << e.what() << '\n';
+        return false;
     }
 }
 
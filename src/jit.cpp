@@ -0,0 +1,502 @@
+#include "jit.hpp"
+#include "interpreter.hpp"
+#include "type.hpp"
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+
+namespace lox {
+
+#ifdef LOX_JIT
+
+// a function bailing out that often isn't worth running natively anymore.
+static constexpr unsigned int MAX_BAILS = 8;
+static constexpr size_t MAX_ARGS = 256;
+// native stack the compiled code may use below the call that enters it.
+static constexpr uintptr_t STACK_BUDGET = 512 << 10;
+
+NativeCode::NativeCode(const std::vector<uint8_t>& code) {
+    size = code.size();
+    memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        memory = nullptr;
+        return;
+    }
+    std::memcpy(memory, code.data(), size);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) return;
+    entry = reinterpret_cast<Entry>(memory);
+}
+
+NativeCode::~NativeCode() {
+    if (memory) munmap(memory, size);
+}
+
+namespace {
+
+enum Condition : uint8_t {
+    BELOW = 0x82, ABOVE_EQUAL = 0x83, EQUAL = 0x84, NOT_EQUAL = 0x85,
+    BELOW_EQUAL = 0x86, ABOVE = 0x87, PARITY = 0x8a
+};
+
+class Assembler {
+    /*
+    The handful of x86-64 instructions the templates need. Doubles live in
+    xmm0 and xmm1, frame slots are addressed from rsp which doesn't move
+    once the prologue is done.
+    */
+    public:
+        std::vector<uint8_t> code;
+
+        void bytes(std::initializer_list<uint8_t> bs) { code.insert(code.end(), bs); }
+        void int32(int32_t v) { for (int i = 0; i < 4; i++) code.push_back((v >> (8 * i)) & 0xff); }
+        void int64(uint64_t v) { for (int i = 0; i < 8; i++) code.push_back((v >> (8 * i)) & 0xff); }
+
+        void load(int xmm, unsigned int slot) {      // movsd xmm, [rsp + 8 * slot]
+            bytes({0xf2, 0x0f, 0x10, (uint8_t)(0x84 | xmm << 3), 0x24});
+            int32(8 * slot);
+        }
+        void store(unsigned int slot, int xmm) {     // movsd [rsp + 8 * slot], xmm
+            bytes({0xf2, 0x0f, 0x11, (uint8_t)(0x84 | xmm << 3), 0x24});
+            int32(8 * slot);
+        }
+        void loadConstant(int xmm, double value) {   // mov rax, imm64; movq xmm, rax
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof bits);
+            loadBits(xmm, bits);
+        }
+        void loadBits(int xmm, uint64_t bits) {
+            bytes({0x48, 0xb8});
+            int64(bits);
+            bytes({0x66, 0x48, 0x0f, 0x6e, (uint8_t)(0xc0 | xmm << 3)});
+        }
+        void arithmetic(uint8_t op) { bytes({0xf2, 0x0f, op, 0xc1}); }   // op xmm0, xmm1
+        void xorpd(int a, int b) { bytes({0x66, 0x0f, 0x57, (uint8_t)(0xc0 | a << 3 | b)}); }
+        void ucomisd(int a, int b) { bytes({0x66, 0x0f, 0x2e, (uint8_t)(0xc0 | a << 3 | b)}); }
+
+        size_t label() {
+            labels.push_back(-1);
+            return labels.size() - 1;
+        }
+        void bind(size_t label) { labels[label] = code.size(); }
+        void jump(size_t label) {
+            code.push_back(0xe9);
+            fixup(label);
+        }
+        void jump(Condition cc, size_t label) {
+            bytes({0x0f, cc});
+            fixup(label);
+        }
+        void patch() {
+            for (auto& [at, label] : fixups) {
+                int32_t offset = labels[label] - (long)(at + 4);
+                std::memcpy(&code[at], &offset, sizeof offset);
+            }
+        }
+
+    private:
+        std::vector<long> labels;
+        std::vector<std::pair<size_t, size_t>> fixups;
+
+        void fixup(size_t label) {
+            fixups.push_back({code.size(), label});
+            int32(0);
+        }
+};
+
+// thrown on what the templates don't cover, the function stays interpreted.
+struct Unsupported {};
+
+class JitCompiler : public ExprVisitor, public StmtVisitor {
+    /*
+    Emits a template of machine code per node, leaving the value of every
+    expression in xmm0. Locals keep the slots the resolver assigned and
+    temporaries are allocated above them.
+    */
+    public:
+        JitCompiler(Function& function_, const uintptr_t& stackLimit_)
+            : function{function_}, stackLimit{stackLimit_}, top{function_.frameSize},
+              maxSlots{function_.frameSize} {}
+
+        std::vector<uint8_t> compile(bool& recursive) {
+            if (function.kind != "function" || function.params.size() >= MAX_ARGS) throw Unsupported{};
+            bail = a.label();
+
+            // push rbp; mov rbp, rsp; sub rsp, frame; mov [rbp - 8], rsi
+            a.bytes({0x55, 0x48, 0x89, 0xe5, 0x48, 0x81, 0xec});
+            size_t frame = a.code.size();
+            a.int32(0);
+            a.bytes({0x48, 0x89, 0x75, 0xf8});
+            // mov rax, &stackLimit; cmp rsp, [rax]; jb bail
+            a.bytes({0x48, 0xb8});
+            a.int64(reinterpret_cast<uint64_t>(&stackLimit));
+            a.bytes({0x48, 0x3b, 0x20});
+            a.jump(BELOW, bail);
+            for (unsigned int i = 0; i < function.params.size(); i++) {
+                // movsd xmm0, [rdi + 8 * i]
+                a.bytes({0xf2, 0x0f, 0x10, 0x87});
+                a.int32(8 * i);
+                a.store(i, 0);
+            }
+
+            for (auto& stmt : function.body) {
+                stmt->accept(*this);
+            }
+            // falling off the end returns nil, left to the interpreter.
+            a.bind(bail);
+            a.bytes({0x31, 0xc0, 0xc9, 0xc3});  // xor eax, eax; leave; ret
+
+            int32_t size = (8 * maxSlots + 8 + 15) & ~15;
+            std::memcpy(&a.code[frame], &size, sizeof size);
+            a.patch();
+            recursive = this->recursive;
+            return a.code;
+        }
+
+        // Expr
+        LoxObject visitAssignExpr(Assign& expr) override {
+            if (expr.slot < 0) throw Unsupported{};
+            expr.value->accept(*this);
+            a.store(expr.slot, 0);
+            return LoxObject();
+        }
+
+        LoxObject visitBinaryExpr(Binary& expr) override {
+            uint8_t op;
+            switch (expr.operator_.token_type) {
+                case TokenType::PLUS: op = 0x58; break;
+                case TokenType::MINUS: op = 0x5c; break;
+                case TokenType::STAR: op = 0x59; break;
+                case TokenType::SLASH: op = 0x5e; break;
+                default: throw Unsupported{};   // booleans have no unboxed form.
+            }
+            operands(expr);
+            if (op == 0x5e) {
+                // the interpreter reports divisions by zero.
+                a.xorpd(2, 2);
+                a.ucomisd(1, 2);
+                a.jump(EQUAL, bail);
+            }
+            a.arithmetic(op);
+            return LoxObject();
+        }
+
+        LoxObject visitCallExpr(Call& expr) override {
+            // only calls to the function itself, through its global.
+            if (TypeIdentifier{}.identify(expr.callee) != Type::Variable) throw Unsupported{};
+            auto& callee = static_cast<Variable&>(*expr.callee);
+            if (callee.slot >= 0 || callee.upvalue >= 0 || function.slot >= 0
+                || callee.name.lexeme != function.name.lexeme
+                || expr.arguments.size() != function.params.size()) {
+                throw Unsupported{};
+            }
+            recursive = true;
+
+            unsigned int base = allocate(std::max<size_t>(expr.arguments.size(), 1));
+            for (size_t i = 0; i < expr.arguments.size(); i++) {
+                expr.arguments[i]->accept(*this);
+                a.store(base + i, 0);
+            }
+            // lea rdi, [rsp + 8 * base]; lea rsi, [rsp + 8 * base]; call function
+            a.bytes({0x48, 0x8d, 0xbc, 0x24});
+            a.int32(8 * base);
+            a.bytes({0x48, 0x8d, 0xb4, 0x24});
+            a.int32(8 * base);
+            a.code.push_back(0xe8);
+            a.int32(-(int32_t)(a.code.size() + 4));
+            // test eax, eax; jz bail
+            a.bytes({0x85, 0xc0});
+            a.jump(EQUAL, bail);
+            a.load(0, base);
+            top = base;
+            return LoxObject();
+        }
+
+        LoxObject visitGroupingExpr(Grouping& expr) override {
+            expr.expression->accept(*this);
+            return LoxObject();
+        }
+
+        LoxObject visitInlinedExpr(Inlined& expr) override {
+            // the guard has no template, the call is compiled or refused as is.
+            return expr.original->accept(*this);
+        }
+
+        LoxObject visitHoistedExpr(Hoisted& expr) override {
+            // machine code computes the invariant again, in registers.
+            return expr.expression->accept(*this);
+        }
+
+        LoxObject visitLiteralExpr(Literal& expr) override {
+            if (expr.value.getLoxObjectType() != LoxType::Number) throw Unsupported{};
+            a.loadConstant(0, (double)expr.value);
+            return LoxObject();
+        }
+
+        LoxObject visitUnaryExpr(Unary& expr) override {
+            if (expr.operator_.token_type != TokenType::MINUS) throw Unsupported{};
+            expr.right->accept(*this);
+            a.loadBits(1, 0x8000000000000000);
+            a.xorpd(0, 1);
+            return LoxObject();
+        }
+
+        LoxObject visitVariableExpr(Variable& expr) override {
+            if (expr.slot < 0) throw Unsupported{};
+            a.load(0, expr.slot);
+            return LoxObject();
+        }
+
+        LoxObject visitCommaExprExpr(CommaExpr&) override { throw Unsupported{}; }
+        LoxObject visitGetExpr(Get&) override { throw Unsupported{}; }
+        LoxObject visitLogicalExpr(Logical&) override { throw Unsupported{}; }
+        LoxObject visitSetExpr(Set&) override { throw Unsupported{}; }
+        LoxObject visitSuperExpr(Super&) override { throw Unsupported{}; }
+        LoxObject visitTernaryExpr(Ternary&) override { throw Unsupported{}; }
+        LoxObject visitThisExpr(This&) override { throw Unsupported{}; }
+
+        // Stmt
+        void visitBlockStmt(Block& stmt) override {
+            if (stmt.captured) throw Unsupported{};
+            for (auto& statement : stmt.statements) {
+                statement->accept(*this);
+            }
+        }
+
+        void visitExpressionStmt(Expression& stmt) override {
+            stmt.expression->accept(*this);
+        }
+
+        void visitIfStmt(If& stmt) override {
+            size_t elseBranch = a.label();
+            branch(stmt.condition, false, elseBranch);
+            stmt.thenBranch->accept(*this);
+            if (stmt.elseBranch) {
+                size_t end = a.label();
+                a.jump(end);
+                a.bind(elseBranch);
+                stmt.elseBranch->accept(*this);
+                a.bind(end);
+            } else {
+                a.bind(elseBranch);
+            }
+        }
+
+        void visitReturnStmt(Return& stmt) override {
+            if (!stmt.value) throw Unsupported{};
+            stmt.value->accept(*this);
+            // mov rsi, [rbp - 8]; movsd [rsi], xmm0; mov eax, 1; leave; ret
+            a.bytes({0x48, 0x8b, 0x75, 0xf8, 0xf2, 0x0f, 0x11, 0x06});
+            a.bytes({0xb8, 0x01, 0x00, 0x00, 0x00, 0xc9, 0xc3});
+        }
+
+        void visitVarStmt(Var& stmt) override {
+            if (stmt.slot < 0 || !stmt.initializer) throw Unsupported{};
+            stmt.initializer->accept(*this);
+            a.store(stmt.slot, 0);
+        }
+
+        void visitWhileStmt(While& stmt) override {
+            size_t start = a.label();
+            size_t exit = a.label();
+            a.bind(start);
+            branch(stmt.condition, false, exit);
+            stmt.body->accept(*this);
+            a.jump(start);
+            a.bind(exit);
+        }
+
+        void visitClassStmt(Class&) override { throw Unsupported{}; }
+        void visitFunctionStmt(Function&) override { throw Unsupported{}; }
+        void visitPrintStmt(Print&) override { throw Unsupported{}; }
+
+    private:
+        Function& function;
+        // the lowest the stack pointer may go, set by the Jit for each call.
+        const uintptr_t& stackLimit;
+        Assembler a;
+        unsigned int top;
+        unsigned int maxSlots;
+        size_t bail {0};
+        bool recursive {false};
+
+        unsigned int allocate(size_t count = 1) {
+            unsigned int slot = top;
+            top += count;
+            maxSlots = std::max(maxSlots, top);
+            return slot;
+        }
+
+        bool isSimple(std::unique_ptr<Expr>& expr) {
+            Type type = TypeIdentifier{}.identify(expr);
+            return (type == Type::Variable && static_cast<Variable&>(*expr).slot >= 0)
+                || (type == Type::Literal && static_cast<Literal&>(*expr).value.getLoxObjectType() == LoxType::Number);
+        }
+
+        // left operand in xmm0, right one in xmm1.
+        void operands(Binary& expr) {
+            expr.left->accept(*this);
+            if (isSimple(expr.right)) {
+                if (TypeIdentifier{}.identify(expr.right) == Type::Variable) {
+                    a.load(1, static_cast<Variable&>(*expr.right).slot);
+                } else {
+                    a.loadConstant(1, (double)static_cast<Literal&>(*expr.right).value);
+                }
+                return;
+            }
+            unsigned int left = allocate();
+            a.store(left, 0);
+            expr.right->accept(*this);
+            a.bytes({0x66, 0x0f, 0x28, 0xc8});  // movapd xmm1, xmm0
+            a.load(0, left);
+            top = left;
+        }
+
+        // jumps to target when the truth of condition is when. Comparisons
+        // follow LoxObject's: > and >= are the negations of <= and <.
+        void branch(std::unique_ptr<Expr>& condition, bool when, size_t target) {
+            switch (TypeIdentifier{}.identify(condition)) {
+                case Type::Grouping:
+                    branch(static_cast<Grouping&>(*condition).expression, when, target);
+                    return;
+                case Type::Unary: {
+                    auto& unary = static_cast<Unary&>(*condition);
+                    if (unary.operator_.token_type == TokenType::BANG) {
+                        branch(unary.right, !when, target);
+                        return;
+                    }
+                    break;
+                }
+                case Type::Logical: {
+                    auto& logical = static_cast<Logical&>(*condition);
+                    bool isAnd = logical.operator_.token_type == TokenType::AND;
+                    if (isAnd != when) {
+                        // the left operand alone decides.
+                        branch(logical.left, when, target);
+                        branch(logical.right, when, target);
+                    } else {
+                        size_t skip = a.label();
+                        branch(logical.left, !when, skip);
+                        branch(logical.right, when, target);
+                        a.bind(skip);
+                    }
+                    return;
+                }
+                case Type::Literal: {
+                    auto& literal = static_cast<Literal&>(*condition);
+                    if (literal.value.getLoxObjectType() == LoxType::Bool) {
+                        if ((bool)literal.value == when) a.jump(target);
+                        return;
+                    }
+                    break;
+                }
+                case Type::Binary: {
+                    auto& binary = static_cast<Binary&>(*condition);
+                    TokenType op = binary.operator_.token_type;
+                    if (op == TokenType::EQUAL_EQUAL || op == TokenType::BANG_EQUAL) {
+                        operands(binary);
+                        a.ucomisd(0, 1);
+                        equal(when == (op == TokenType::EQUAL_EQUAL), target);
+                        return;
+                    }
+                    Condition yes, no;
+                    if (order(op, yes, no)) {
+                        // compares the right operand with the left one, so
+                        // that unordered operands are neither below nor above.
+                        operands(binary);
+                        a.ucomisd(1, 0);
+                        a.jump(when ? yes : no, target);
+                        return;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+            // any other value is a number, true unless it's zero.
+            condition->accept(*this);
+            a.xorpd(1, 1);
+            a.ucomisd(0, 1);
+            equal(!when, target);
+        }
+
+        // conditions of "right ? left" for an ordering "left op right".
+        static bool order(TokenType op, Condition& yes, Condition& no) {
+            switch (op) {
+                case TokenType::LESS: yes = ABOVE; no = BELOW_EQUAL; return true;
+                case TokenType::LESS_EQUAL: yes = ABOVE_EQUAL; no = BELOW; return true;
+                case TokenType::GREATER: yes = BELOW; no = ABOVE_EQUAL; return true;
+                case TokenType::GREATER_EQUAL: yes = BELOW_EQUAL; no = ABOVE; return true;
+                default: return false;
+            }
+        }
+
+        // jumps when the last comparison found equal operands, or when it
+        // didn't with when false. Unordered operands are never equal.
+        void equal(bool when, size_t target) {
+            if (when) {
+                size_t skip = a.label();
+                a.jump(PARITY, skip);
+                a.jump(EQUAL, target);
+                a.bind(skip);
+            } else {
+                a.jump(PARITY, target);
+                a.jump(NOT_EQUAL, target);
+            }
+        }
+};
+
+} // namespace
+
+bool Jit::call(LoxFunction* function, const LoxObject* args, LoxObject& result) {
+    Function& declaration = *function->getDeclaration();
+    if (!declaration.native) {
+        try {
+            bool recursive = false;
+            std::vector<uint8_t> code = JitCompiler(declaration, stackLimit).compile(recursive);
+            declaration.native = std::make_shared<NativeCode>(code);
+            declaration.native->recursive = recursive;
+        } catch (const Unsupported&) {
+            declaration.native = std::make_shared<NativeCode>();
+        }
+    }
+    NativeCode& native = *declaration.native;
+    if (!native.entry || function->getUpvalues().size() > 0) return false;
+
+    // the recursive calls are only right while the global is this function.
+    if (native.recursive) {
+        int index = interpreter.globals.find(declaration.name.lexeme);
+        if (index < 0) return false;
+        LoxObject global = interpreter.globals.get(index, declaration.name);
+        if (global.getLoxObjectType() != LoxType::Callable) return false;
+        LoxFunction* current = global.getFunction()->asFunction();
+        if (!current || current->getDeclaration() != &declaration) return false;
+    }
+
+    double numbers[MAX_ARGS];
+    for (size_t i = 0; i < declaration.params.size(); i++) {
+        if (args[i].getLoxObjectType() != LoxType::Number) return false;
+        numbers[i] = (double)args[i];
+    }
+
+    stackLimit = reinterpret_cast<uintptr_t>(&numbers) - STACK_BUDGET;
+    double value;
+    if (!native.entry(numbers, &value)) {
+        if (++native.bails >= MAX_BAILS) native.entry = nullptr;
+        return false;
+    }
+    result = LoxObject(value);
+    return true;
+}
+
+#else
+
+NativeCode::NativeCode(const std::vector<uint8_t>&) {}
+NativeCode::~NativeCode() {}
+
+bool Jit::call(LoxFunction*, const LoxObject*, LoxObject&) {
+    return false;
+}
+
+#endif
+
+} // namespace lox
@@ -0,0 +1,405 @@
+#include "loopOptimizer.hpp"
+#include "type.hpp"
+
+namespace lox {
+
+unsigned int LoopOptimizer::optimize(std::vector<SExpr>& statements, unsigned int frameSize,
+                                     std::set<std::string>& getters) {
+    LoopOptimizer optimizer;
+    optimizer.getters = &getters;
+    optimizer.collect(statements);
+    optimizer.frameSize = &frameSize;
+    optimizer.optimize(statements);
+    return frameSize;
+}
+
+void LoopOptimizer::collect(std::vector<SExpr>& statements) {
+    for (auto& stmt : statements) {
+        collect(stmt);
+    }
+}
+
+void LoopOptimizer::collect(SExpr& stmt) {
+    switch (TypeIdentifier{}.identify(stmt)) {
+        case Type::Class:
+            for (auto& method : static_cast<Class&>(*stmt).methods) {
+                if (method->kind == "getter") getters->insert(method->name.lexeme);
+                collect(method->body);
+            }
+            break;
+        case Type::Function:
+            collect(static_cast<Function&>(*stmt).body);
+            break;
+        case Type::Block:
+            collect(static_cast<Block&>(*stmt).statements);
+            break;
+        case Type::If: {
+            auto& branch = static_cast<If&>(*stmt);
+            collect(branch.thenBranch);
+            if (branch.elseBranch) collect(branch.elseBranch);
+            break;
+        }
+        case Type::While:
+            collect(static_cast<While&>(*stmt).body);
+            break;
+        default:
+            break;
+    }
+}
+
+void LoopOptimizer::optimize(std::vector<SExpr>& statements) {
+    for (auto& stmt : statements) {
+        optimize(stmt);
+    }
+}
+
+void LoopOptimizer::optimize(Function& function) {
+    unsigned int* enclosingFrame = frameSize;
+    frameSize = &function.frameSize;
+    optimize(function.body);
+    frameSize = enclosingFrame;
+}
+
+void LoopOptimizer::optimize(SExpr& stmt) {
+    switch (TypeIdentifier{}.identify(stmt)) {
+        case Type::Block:
+            optimize(static_cast<Block&>(*stmt).statements);
+            break;
+        case Type::Class:
+            for (auto& method : static_cast<Class&>(*stmt).methods) {
+                optimize(*method);
+            }
+            break;
+        case Type::Function:
+            optimize(static_cast<Function&>(*stmt));
+            break;
+        case Type::If: {
+            auto& branch = static_cast<If&>(*stmt);
+            optimize(branch.thenBranch);
+            if (branch.elseBranch) optimize(branch.elseBranch);
+            break;
+        }
+        case Type::While: {
+            // the outer loop first: its invariants are invariants of the
+            // nested loops too, which then take what is left.
+            auto& loop = static_cast<While&>(*stmt);
+            Writes writes;
+            scan(loop.condition, writes);
+            scan(loop.body, writes);
+            if (!writes.calls) {
+                hoist(loop.condition, loop, writes);
+                hoist(loop.body, loop, writes);
+                // a later program may declare a getter the loop reads.
+                loop.reads.assign(writes.reads.begin(), writes.reads.end());
+                loop.getters = getters->size();
+            }
+            optimize(loop.body);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void LoopOptimizer::scan(SExpr& stmt, Writes& writes) const {
+    switch (TypeIdentifier{}.identify(stmt)) {
+        case Type::Block:
+            for (auto& statement : static_cast<Block&>(*stmt).statements) {
+                scan(statement, writes);
+            }
+            break;
+        case Type::Class:
+        case Type::Function:
+            // closures are made, and a class may call its superclass' init.
+            writes.calls = true;
+            break;
+        case Type::Expression:
+            scan(static_cast<Expression&>(*stmt).expression, writes);
+            break;
+        case Type::If: {
+            auto& branch = static_cast<If&>(*stmt);
+            scan(branch.condition, writes);
+            scan(branch.thenBranch, writes);
+            if (branch.elseBranch) scan(branch.elseBranch, writes);
+            break;
+        }
+        case Type::Print:
+            scan(static_cast<Print&>(*stmt).expression, writes);
+            break;
+        case Type::Return: {
+            auto& ret = static_cast<Return&>(*stmt);
+            if (ret.value) scan(ret.value, writes);
+            break;
+        }
+        case Type::Var: {
+            auto& var = static_cast<Var&>(*stmt);
+            if (var.initializer) scan(var.initializer, writes);
+            if (var.slot >= 0) {
+                writes.slots.insert(var.slot);
+            } else {
+                writes.globals.insert(var.name.lexeme);
+            }
+            break;
+        }
+        case Type::While: {
+            auto& loop = static_cast<While&>(*stmt);
+            scan(loop.condition, writes);
+            scan(loop.body, writes);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void LoopOptimizer::scan(PExpr& expr, Writes& writes) const {
+    switch (TypeIdentifier{}.identify(expr)) {
+        case Type::Assign: {
+            auto& assign = static_cast<Assign&>(*expr);
+            scan(assign.value, writes);
+            if (assign.slot >= 0) {
+                writes.slots.insert(assign.slot);
+            } else if (assign.upvalue >= 0) {
+                writes.upvalues.insert(assign.upvalue);
+            } else {
+                writes.globals.insert(assign.name.lexeme);
+            }
+            break;
+        }
+        case Type::Binary: {
+            auto& binary = static_cast<Binary&>(*expr);
+            scan(binary.left, writes);
+            scan(binary.right, writes);
+            break;
+        }
+        case Type::Call:
+        case Type::Inlined:
+        case Type::Super:
+            // an inlined copy falls back to the call when its guard fails.
+            writes.calls = true;
+            break;
+        case Type::CommaExpr:
+            for (auto& expression : static_cast<CommaExpr&>(*expr).expressions) {
+                scan(expression, writes);
+            }
+            break;
+        case Type::Get: {
+            auto& get = static_cast<Get&>(*expr);
+            if (getters->count(get.name.lexeme)) writes.calls = true;
+            writes.reads.insert(get.name.lexeme);
+            scan(get.object, writes);
+            break;
+        }
+        case Type::Grouping:
+            scan(static_cast<Grouping&>(*expr).expression, writes);
+            break;
+        case Type::Logical: {
+            auto& logical = static_cast<Logical&>(*expr);
+            scan(logical.left, writes);
+            scan(logical.right, writes);
+            break;
+        }
+        case Type::Set: {
+            auto& set = static_cast<Set&>(*expr);
+            scan(set.object, writes);
+            scan(set.value, writes);
+            writes.properties.insert(set.name.lexeme);
+            break;
+        }
+        case Type::Ternary: {
+            auto& ternary = static_cast<Ternary&>(*expr);
+            scan(ternary.condition, writes);
+            scan(ternary.thenBranch, writes);
+            scan(ternary.elseBranch, writes);
+            break;
+        }
+        case Type::Unary:
+            scan(static_cast<Unary&>(*expr).right, writes);
+            break;
+        default:
+            break;
+    }
+}
+
+void LoopOptimizer::hoist(SExpr& stmt, While& loop, const Writes& writes) {
+    switch (TypeIdentifier{}.identify(stmt)) {
+        case Type::Block:
+            for (auto& statement : static_cast<Block&>(*stmt).statements) {
+                hoist(statement, loop, writes);
+            }
+            break;
+        case Type::Expression:
+            hoist(static_cast<Expression&>(*stmt).expression, loop, writes);
+            break;
+        case Type::If: {
+            auto& branch = static_cast<If&>(*stmt);
+            hoist(branch.condition, loop, writes);
+            hoist(branch.thenBranch, loop, writes);
+            if (branch.elseBranch) hoist(branch.elseBranch, loop, writes);
+            break;
+        }
+        case Type::Print:
+            hoist(static_cast<Print&>(*stmt).expression, loop, writes);
+            break;
+        case Type::Return: {
+            auto& ret = static_cast<Return&>(*stmt);
+            if (ret.value) hoist(ret.value, loop, writes);
+            break;
+        }
+        case Type::Var: {
+            auto& var = static_cast<Var&>(*stmt);
+            if (var.initializer) hoist(var.initializer, loop, writes);
+            break;
+        }
+        case Type::While: {
+            auto& nested = static_cast<While&>(*stmt);
+            hoist(nested.condition, loop, writes);
+            hoist(nested.body, loop, writes);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void LoopOptimizer::hoist(PExpr& expr, While& loop, const Writes& writes) {
+    if (worth(expr) && invariant(expr, writes)) {
+        auto hoisted = std::make_unique<Hoisted>(std::move(expr));
+        hoisted->slot = *frameSize;
+        *frameSize += 2;
+        loop.hoisted.push_back(hoisted->slot);
+        expr = std::move(hoisted);
+        return;
+    }
+    switch (TypeIdentifier{}.identify(expr)) {
+        case Type::Assign:
+            hoist(static_cast<Assign&>(*expr).value, loop, writes);
+            break;
+        case Type::Binary: {
+            auto& binary = static_cast<Binary&>(*expr);
+            hoist(binary.left, loop, writes);
+            hoist(binary.right, loop, writes);
+            break;
+        }
+        case Type::CommaExpr:
+            for (auto& expression : static_cast<CommaExpr&>(*expr).expressions) {
+                hoist(expression, loop, writes);
+            }
+            break;
+        case Type::Get:
+            hoist(static_cast<Get&>(*expr).object, loop, writes);
+            break;
+        case Type::Grouping:
+            hoist(static_cast<Grouping&>(*expr).expression, loop, writes);
+            break;
+        case Type::Logical: {
+            auto& logical = static_cast<Logical&>(*expr);
+            hoist(logical.left, loop, writes);
+            hoist(logical.right, loop, writes);
+            break;
+        }
+        case Type::Set: {
+            auto& set = static_cast<Set&>(*expr);
+            hoist(set.object, loop, writes);
+            hoist(set.value, loop, writes);
+            break;
+        }
+        case Type::Ternary: {
+            auto& ternary = static_cast<Ternary&>(*expr);
+            hoist(ternary.condition, loop, writes);
+            hoist(ternary.thenBranch, loop, writes);
+            hoist(ternary.elseBranch, loop, writes);
+            break;
+        }
+        case Type::Unary:
+            hoist(static_cast<Unary&>(*expr).right, loop, writes);
+            break;
+        default:
+            break;
+    }
+}
+
+bool LoopOptimizer::invariant(PExpr& expr, const Writes& writes) {
+    switch (TypeIdentifier{}.identify(expr)) {
+        case Type::Literal:
+        case Type::This:
+        case Type::Hoisted:
+            return true;
+        case Type::Variable: {
+            auto& variable = static_cast<Variable&>(*expr);
+            if (variable.slot >= 0) return !writes.slots.count(variable.slot);
+            if (variable.upvalue >= 0) return !writes.upvalues.count(variable.upvalue);
+            return !writes.globals.count(variable.name.lexeme);
+        }
+        case Type::Grouping:
+            return invariant(static_cast<Grouping&>(*expr).expression, writes);
+        case Type::Unary:
+            return invariant(static_cast<Unary&>(*expr).right, writes);
+        case Type::Binary: {
+            auto& binary = static_cast<Binary&>(*expr);
+            return invariant(binary.left, writes) && invariant(binary.right, writes);
+        }
+        case Type::Logical: {
+            auto& logical = static_cast<Logical&>(*expr);
+            return invariant(logical.left, writes) && invariant(logical.right, writes);
+        }
+        case Type::Ternary: {
+            auto& ternary = static_cast<Ternary&>(*expr);
+            return invariant(ternary.condition, writes) && invariant(ternary.thenBranch, writes)
+                && invariant(ternary.elseBranch, writes);
+        }
+        case Type::Get: {
+            // no getter is read in the loop, the field is the same until set.
+            // A getter declared later is looked for when the loop starts.
+            auto& get = static_cast<Get&>(*expr);
+            return !writes.properties.count(get.name.lexeme) && invariant(get.object, writes);
+        }
+        default:
+            return false;
+    }
+}
+
+bool LoopOptimizer::worth(PExpr& expr) {
+    switch (TypeIdentifier{}.identify(expr)) {
+        case Type::Grouping:
+            return worth(static_cast<Grouping&>(*expr).expression);
+        case Type::Get:
+            return true;
+        case Type::Unary:
+        case Type::Binary:
+        case Type::Logical:
+        case Type::Ternary:
+            // operations on constants only are left to the compilers.
+            return variable(expr);
+        default:
+            return false;
+    }
+}
+
+bool LoopOptimizer::variable(PExpr& expr) {
+    switch (TypeIdentifier{}.identify(expr)) {
+        case Type::Literal:
+            return false;
+        case Type::Grouping:
+            return variable(static_cast<Grouping&>(*expr).expression);
+        case Type::Unary:
+            return variable(static_cast<Unary&>(*expr).right);
+        case Type::Binary: {
+            auto& binary = static_cast<Binary&>(*expr);
+            return variable(binary.left) || variable(binary.right);
+        }
+        case Type::Logical: {
+            auto& logical = static_cast<Logical&>(*expr);
+            return variable(logical.left) || variable(logical.right);
+        }
+        case Type::Ternary: {
+            auto& ternary = static_cast<Ternary&>(*expr);
+            return variable(ternary.condition) || variable(ternary.thenBranch)
+                || variable(ternary.elseBranch);
+        }
+        default:
+            return true;
+    }
+}
+
+} // namespace lox
@@ -1,74 +1,12 @@
-#include <iostream> // for debugging
+#include <iostream>
 #include <fstream>
 #include <sstream>
-#include <memory>
-#include "scanner.hpp"
 #include "lox.hpp"
-#include "parser.hpp"
-#include "ASTprinter.hpp"
-#include "interpreter.hpp"
-#include "resolver.hpp"
 
 namespace lox
 {
 
-    bool Lox::hadError{false};
-    bool Lox::hadRuntimeError{false};
-
-    void Lox::report(int line, std::string where, std::string message)
-    {
-        std::cerr << "[line " << line
-                  << "] Error" << where
-                  << ": " << message << std::endl;
-        hadError = true;
-    }
-
-    void Lox::error(int line, std::string message)
-    {
-        report(line, "", message);
-    }
-
-    void Lox::error(Token token, std::string message) {
-        if (token.token_type == EOF)
-            report(token.line, " at end", message);
-        else 
-            report (token.line, " at '" + token.lexeme + "'", message);
-    }
-
-    void Lox::runtimeError(){
-        hadRuntimeError = true;
-    }    
-
-    void Lox::run(const std::string &source)
-    {
-        Scanner scanner(source);
-        std::vector<Token> tokens = scanner.scanTokens();
-
-        //for (Token token : tokens)
-        //{
-        //    std::cout << token << std::endl;
-        //}
-        Parser parser{tokens};
-        std::vector<std::unique_ptr<Stmt>> statements = parser.parse();
-
-        // Stop if there was a syntax error.
-        if (hadError) return;
-
-        //ASTprinter{}.print(expression);
-
-        //static interpreter to persist data accross different executions.
-        static Interpreter interpreter{};
-        Resolver resolver(&interpreter);
-
-        resolver.resolve(statements);
-        resolver.reportUnusedVariables(); 
-
-        // Stop if there was a resolution error.
-        if (hadError) return;
-        interpreter.interpret(statements);
-         
-    }
-    void Lox::runFile(std::string path)
+    static std::string readFile(const std::string& path)
     {
         std::ifstream in{path};
         if (!in)
@@ -78,14 +16,36 @@ namespace lox
         }
         std::stringstream sstr;
         sstr << in.rdbuf();
-        std::string content = sstr.str();
-        run(content);
+        return sstr.str();
+    }
+
+    Lox::Lox(Options options) : context{options} {}
+
+    void Lox::setHeapStats(bool enabled) {
+        heapStats = enabled;
+    }
+
+    Context::Status Lox::run(const std::string &source)
+    {
+        Context::Status status = context.run(source);
+        if (heapStats && status != Context::Status::CompileError) context.printHeapStats(std::cerr);
+        return status;
+    }
+
+    void Lox::runFile(const std::string& path)
+    {
+        Context::Status status = run(readFile(path));
 
         // exit if there's an syntax error
-        if (hadError) exit(65);
+        if (status == Context::Status::CompileError) exit(65);
 
         // exit if there's a runtime error
-        if (hadRuntimeError) exit(70);
+        if (status == Context::Status::RuntimeError) exit(70);
+    }
+
+    void Lox::emitCpp(const std::string& path)
+    {
+        if (!context.translate(readFile(path), std::cout)) exit(65);
     }
 
     void Lox::runPrompt()
@@ -98,9 +58,7 @@ namespace lox
                 break;
             //std::erase(std::find(line.begin(), line.end(), '\0'));
             run(line);
-            // reset-had-error
-            hadError = false;
         }
     }
 
-} // namespace lox
\ No newline at end of file
+} // namespace lox
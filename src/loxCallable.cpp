@@ -1,69 +1,154 @@
 #include "loxCallable.hpp"
 #include "interpreter.hpp"
-#include "environment.hpp"
-#include "return.hpp"
 
 
 namespace lox {
 
-LoxFunction::LoxFunction(Function* decl, Interpreter* intp, std::shared_ptr<Environment> encl, bool isInit) {
+// fields with a slot in instances, whose assignment a bit of `present` tells.
+static constexpr size_t MAX_SLOTS = 64;
+
+LoxFunction::LoxFunction(Function* decl, Interpreter* intp, Upvalues upvals, bool isInit) {
     declaration = decl;
-    enclosing = encl;
+    upvalues = std::move(upvals);
     isInitializer = isInit;
     getter = decl->kind == "getter" ? true : false;
+    method = decl->kind != "function";
     interpreter = intp;
-    interpreter->registerFunction(this, std::make_shared<Environment>(enclosing));
 }
 
-LoxFunction::LoxFunction(LoxFunction& other, std::shared_ptr<Environment> encl) {
+LoxFunction::LoxFunction(LoxFunction& other, LoxObject receiver_) {
     declaration = other.declaration;
-    enclosing = encl;
+    upvalues = other.upvalues;
+    receiver = receiver_;
     getter = other.getter;
+    method = other.method;
     isInitializer = other.isInitializer;
     interpreter = other.interpreter;
-    interpreter->registerFunction(this, enclosing);
 }
 
-LoxFunction::~LoxFunction() { interpreter->deleteFunction(this); }
-
 LoxObject LoxFunction::operator()(Interpreter& intp, std::vector<LoxObject> args) {
-    auto environment = std::make_shared<Environment>(enclosing);
-    for (int i = 0; i < declaration->params.size(); i++) {
-        environment->define(declaration->params[i].lexeme, args[i]);
+    CallFrame frame(intp, declaration->frameSize);
+    for (size_t i = 0; i < args.size(); i++) {
+        frame[i] = args[i];
+    }
+    return call(intp, frame);
+}
+
+LoxObject LoxFunction::call(Interpreter& intp, CallFrame& frame) {
+    // Tail calls loop here with the callee taking over the frame,
+    // instead of nesting a native call.
+    intp.checkNativeStack(&frame);
+    LoxFunction* function = this;
+    LoxObject callee;
+    for (;;) {
+        // parameters are already in the frame, the receiver of a method 
+        // goes right after them.
+        frame.enter(function);
+        if (function->method) frame[function->declaration->params.size()] = function->receiver;
+        if (intp.m_engine == Engine::Stackless || intp.m_engine == Engine::Registers
+            || (intp.m_engine == Engine::Tiered && intp.tierUp(*function->declaration))) {
+            // a hot function runs on the VM, along with everything it calls,
+            // and so does any function called from the host with the VM engines.
+            // An initializer's code returns its receiver on a bare "return;"
+            // and nil when it runs off its end, as below.
+            return intp.m_vm->call(function);
+        }
+        intp.executeBlock(function->declaration->body);
+        if (!intp.m_returning) return LoxObject();
+        intp.m_returning = false;
+
+        if (intp.m_tailCallee.getLoxObjectType() == LoxType::Nil) break;
+        callee = intp.m_tailCallee;
+        intp.m_tailCallee = LoxObject();
+        function = callee.getFunction()->asFunction();
+        frame.reuse(function->declaration->frameSize, function->arity());
     }
-    try {
-        intp.executeBlock(declaration->body, environment);
-    } catch (ReturnExcept& returnValue) {
-        if (isInitializer) return enclosing->getAt(0, "this");
-        return returnValue.get();
+
+    if (function->isInitializer) return function->receiver;
+    LoxObject value = intp.m_returnValue;
+    intp.m_returnValue = LoxObject();
+    return value;
+}
+
+CompiledFunction::CompiledFunction(std::string name, size_t arity, bool getter_, Body body_)
+    : fname{std::move(name)}, params{arity}, getter{getter_},
+      body{std::make_shared<Body>(std::move(body_))} {}
+
+CompiledFunction::CompiledFunction(CompiledFunction& other, LoxObject receiver_)
+    : fname{other.fname}, params{other.params}, getter{other.getter},
+      body{other.body}, receiver{receiver_} {}
+
+LoxObject CompiledFunction::call(Interpreter& in, const LoxObject* args) {
+    // translated calls nest native calls as the tree walker's do.
+    LoxObject result;
+    in.checkNativeStack(&result);
+    result = (*body)(args, receiver);
+    auto& pending = in.m_compiledTailCall;
+    while (pending.callee.getLoxObjectType() != LoxType::Nil) {
+        // the callee is kept alive until its body has run.
+        TailCall next = std::move(pending);
+        pending = TailCall{};
+        auto* function = next.callee.getFunction()->asCompiled();
+        result = (*function->body)(next.args.data(), function->receiver);
     }
+    return result;
+}
 
-    return LoxObject();
+void CompiledFunction::tailCall(Interpreter& in, const LoxObject& callee, std::vector<LoxObject> args) {
+    auto& pending = in.m_compiledTailCall;
+    pending.callee = callee;
+    pending.args = std::move(args);
 }
 
-LoxClass::LoxClass(Class* stmt, LoxClass* superClass, Interpreter* intp, PEnvironment encl) {
+LoxClass::LoxClass(Class* stmt, LoxClass* superClass, Interpreter* intp) {
     cname = stmt->name;
     super = superClass;
     interpreter = intp;
+    if (super) superObject = LoxObject(super, intp);
     bool isInit {false};
 
     for (auto& m: stmt->methods) {
         isInit = m->name.lexeme == "init" ? true : false;
-        auto* method = interpreter->createFunction(m.get(), encl, isInit);
+        auto* method = interpreter->createFunction(m.get(), isInit);
         methods[m->name.lexeme] = LoxObject(method, intp);
     }
+    flatten();
+
+    if (super) layout = super->layout;
+    for (auto& field : stmt->fields) {
+        if (layout.size() == MAX_SLOTS) break;
+        if (slot(field) < 0) layout.push_back(field);
+    }
+}
+
+LoxClass::LoxClass(Token name, LoxClass* superClass, Interpreter* intp, std::map<std::string, LoxObject> methods_)
+    : interpreter{intp}, super{superClass}, cname{name}, methods{std::move(methods_)} {
+    if (super) superObject = LoxObject(super, intp);
+    flatten();
+}
+
+void LoxClass::flatten() {
+    // classes never change once created, nor do their superclasses.
+    if (super) table = super->table;
+    for (auto& [name, method] : methods) {
+        table.insert_or_assign(name, method);
+    }
 }
 
 LoxObject LoxClass::function(Token name, LoxInstance* instance) {
     // possible leak in this function. Check later.
-    auto var = methods.find(name.lexeme);
-    if (var != methods.end()) {
-        LoxFunction* func = static_cast<LoxFunction*>(var->second.getFunction()); 
-        PEnvironment environment = std::make_shared<Environment>(func->getEnclosing());
+    auto var = table.find(name.lexeme);
+    if (var != table.end()) {
+        LoxObject receiver;
         if (auto obj = dynamic_cast<LoxClass *>(instance); obj == nullptr) { // if we got an instance instead of class.
-            environment->define("this", LoxObject(instance, interpreter));
+            receiver = LoxObject(instance, interpreter);
+        }
+        if (auto* compiled = var->second.getFunction()->asCompiled()) {
+            LoxObject bound = interpreter->createCallable(std::make_unique<CompiledFunction>(*compiled, receiver));
+            return compiled->isGetter() ? bound(*interpreter, {}) : bound;
         }
-        auto* new_method = interpreter->createFunction(func, environment); 
+        LoxFunction* func = static_cast<LoxFunction*>(var->second.getFunction()); 
+        auto* new_method = interpreter->createFunction(func, receiver); 
         if (new_method->isGetter()){
             // if it's a getter we call it directly.
             Arguments args;
@@ -71,7 +156,6 @@ LoxObject LoxClass::function(Token name, LoxInstance* instance) {
         } 
         return LoxObject(new_method, interpreter);
     }
-    if (super) return super->function(name, instance); 
     throw std::runtime_error("Undefined property '" + name.lexeme + "'.");
     // maybe create later a custom runtimeError in order to print
     // the line and/or the file along with the error message.
@@ -109,21 +193,70 @@ LoxObject LoxClass::get(Token name) {
 }
 
 LoxObject LoxClass::set(Token name, LoxObject value) {
-    return class_fields[name.lexeme] = value;
+    LoxObject& field = class_fields[name.lexeme];
+    interpreter->overwriting(field);
+    return field = value;
 }
 
-LoxInstance::LoxInstance(LoxClass* klass_): klass{klass_} { cname = klass->cname; }
+bool LoxClass::getField(const std::string& name, LoxObject& value) {
+    auto field = class_fields.find(name);
+    if (field == class_fields.end()) return false;
+    value = field->second;
+    return true;
+}
 
-LoxObject LoxInstance::get(Token name) {
-    auto value = fields.find(name.lexeme);
-    if (value != fields.end()) {
-        return value->second;
+LoxFunction* LoxClass::findMethod(const std::string& name) {
+    auto method = table.find(name);
+    if (method == table.end()) return nullptr;
+    return static_cast<LoxFunction*>(method->second.getFunction());
+}
+
+LoxFunction* LoxClass::initializer() {
+    auto init = methods.find("init");
+    if (init == methods.end()) return nullptr;
+    return static_cast<LoxFunction*>(init->second.getFunction());
+}
+
+int LoxClass::slot(const std::string& field) const {
+    // layouts are a handful of names, scanned faster than hashed.
+    for (size_t i = 0; i < layout.size(); i++) {
+        if (layout[i] == field) return i;
     }
+    return -1;
+}
+
+LoxInstance::LoxInstance(LoxClass* klass_)
+    : klass{klass_}, klassObject{klass_, klass_->interpreter}, slots(klass_->layout.size()) {}
+
+std::string LoxInstance::name() const {
+    return "<instance " + klass->cname.lexeme + ">";
+}
+
+LoxObject LoxInstance::get(Token name) {
+    LoxObject value;
+    if (getField(name.lexeme, value)) return value;
     return klass->function(name, this);
 }
 
 LoxObject LoxInstance::set(Token name, LoxObject value) {
-    return fields[name.lexeme] = value;
+    int slot = klass->slot(name.lexeme);
+    LoxObject& field = slot < 0 ? fields[name.lexeme] : slots[slot];
+    klass->interpreter->overwriting(field);
+    if (slot >= 0) present |= uint64_t(1) << slot;
+    return field = value;
+}
+
+bool LoxInstance::getField(const std::string& name, LoxObject& value) {
+    int slot = klass->slot(name);
+    if (slot >= 0) {
+        if (!(present & uint64_t(1) << slot)) return false;
+        value = slots[slot];
+        return true;
+    }
+    auto field = fields.find(name);
+    if (field == fields.end()) return false;
+    value = field->second;
+    return true;
 }
 
 
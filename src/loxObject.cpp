@@ -34,15 +34,30 @@ LoxObject::LoxObject(const LoxObject& o){
 }
 
 LoxObject& LoxObject::operator=(const LoxObject& o){
-    string = o.string;
-    number = o.number;
-    lox_type = o.lox_type;
-    boolean = o.boolean;
-    function = o.function;
-    instance = o.instance;
-    loxklass = o.loxklass;
-    interpreter = o.interpreter;
-    if (interpreter) saveCallableCopy();
+    if (!interpreter && !o.interpreter) {
+        // plain values, no count to update.
+        string = o.string;
+        number = o.number;
+        lox_type = o.lox_type;
+        boolean = o.boolean;
+        function = o.function;
+        instance = o.instance;
+        loxklass = o.loxklass;
+        return *this;
+    }
+    // o may be a field of the object this refers to, which releasing this
+    // can free: take a copy first.
+    LoxObject copy {o};
+    release();
+    string = std::move(copy.string);
+    number = copy.number;
+    lox_type = copy.lox_type;
+    boolean = copy.boolean;
+    function = copy.function;
+    instance = copy.instance;
+    loxklass = copy.loxklass;
+    interpreter = copy.interpreter;
+    copy.interpreter = nullptr;
     return *this;
 }
 
@@ -63,6 +78,10 @@ void LoxObject::saveCallableCopy() {
 }
 
 LoxObject::~LoxObject() {
+    release();
+}
+
+void LoxObject::release() {
     if (interpreter) {
         switch (lox_type) {
             case LoxType::Callable:
@@ -77,8 +96,9 @@ LoxObject::~LoxObject() {
             default:
                 throw std::logic_error("Lox Object has bad type when destroyed.");
         }
+        interpreter = nullptr;
     }
-} 
+}
 
 LoxObject LoxObject::get(Token name) {
     if (lox_type == LoxType::Instance) {
@@ -109,7 +129,7 @@ LoxObject LoxObject::operator()(Interpreter& in, std::vector<LoxObject> args) {
                 + std::to_string(args.size()) + "\n";
             throw std::runtime_error(msg);
         }
-        return (*loxklass)(in, args);
+        return (*loxklass)(in, std::move(args));
     }
     if (args.size() != function->arity()){
         std::string msg = "Function argument count mismatch. Expected "
@@ -117,7 +137,7 @@ LoxObject LoxObject::operator()(Interpreter& in, std::vector<LoxObject> args) {
             + std::to_string(args.size()) + "\n";
         throw std::runtime_error(msg);
     }
-    return (*function)(in, args);
+    return (*function)(in, std::move(args));
 }
 
 LoxObject::LoxObject(Token token) {
@@ -143,7 +163,7 @@ LoxObject::LoxObject(Token token) {
             break;
         case TokenType::STRING:
             lox_type = LoxType::String;
-            string = token.lexeme;
+            string.assign(token.lexeme.begin(), token.lexeme.end());
             break;
         default:
             throw std::runtime_error("Invalid Lox Object"); 
@@ -162,7 +182,7 @@ LoxObject::operator std::string() const {
             return ss.str();
         }
 
-        case LoxType::String: return string;
+        case LoxType::String: return std::string(string.begin(), string.end());
         case LoxType::Callable:
             return function->name();
         case LoxType::Class:
@@ -181,7 +201,7 @@ LoxObject::operator double() const {
         case LoxType::Number: return number;
         case LoxType::String: 
         {
-            std::stringstream ss(string);
+            std::stringstream ss(std::string(string.begin(), string.end()));
             double num;
             ss >> num;
             if (ss.fail() || ss.bad()) throw std::runtime_error("Bad cast.");
@@ -230,7 +250,7 @@ bool operator==(const LoxObject& a, const LoxObject& b) {
     switch(a.lox_type) {
         case LoxType::Bool: return a.boolean == (bool)b;
         case LoxType::Number: return a.number == (double)b;
-        case LoxType::String: return a.string == (std::string)b;
+        case LoxType::String: return std::string_view(a.string) == (std::string)b;
         default:
             throw std::runtime_error("Cannot compare objects for equality.");
     }
@@ -395,6 +415,11 @@ LoxObject operator!(LoxObject a) {
         case LoxType::Bool:
             a.boolean = !a.boolean;
             break;
+        case LoxType::Callable:
+        case LoxType::Class:
+        case LoxType::Instance:
+            // objects are true, as for conditions, "and" and "or".
+            return LoxObject(false);
         default:
             throw std::runtime_error("Cannot negate object.");
     }
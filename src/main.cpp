@@ -1,17 +1,105 @@
 #include <iostream> // for debugging purposes
+#include <string>
 #include "lox.hpp"
+#include "jit.hpp"
 
 using namespace lox;
 
+static void usage() {
+    std::cerr << "Usage: jlox [--stackless | --registers | --tiered] [--jit] [--no-inline]\n"
+              << "            [--no-hoist] [--max-stack=<MB>] [--tier-up-calls=<n>]\n"
+              << "            [--tier-up-loops=<n>] [--log-tiering] [--heap-stats]\n"
+              << "            [--gc-budget=<ms>] [--compact] [--max-heap=<MB>] [script]\n"
+              << "       jlox --emit-cpp script > script.cpp\n"
+              << "--gc-budget bounds the slices marking the old generation. Young collections\n"
+              << "run whole, the young generation shrinking while they take longer." << std::endl;
+    exit(64);
+}
+
+static unsigned int count(const std::string& arg) {
+    try {
+        return std::stoul(arg.substr(arg.find('=') + 1));
+    } catch (const std::exception&) {
+        usage();
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[]) {
-    if (argc > 2) {
-        std::cerr << "Usage: jlox [script]" << std::endl;
-        exit(64);
-    } else if (argc == 2){
-        Lox::runFile(argv[1]);
+    std::string script;
+    Options options;
+    bool heapStats = false;
+    bool emitCpp = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--stackless") {
+            options.engine = Engine::Stackless;
+        } else if (arg == "--registers") {
+            options.engine = Engine::Registers;
+        } else if (arg == "--tiered") {
+            options.engine = Engine::Tiered;
+        } else if (arg.rfind("--tier-up-calls=", 0) == 0) {
+            options.tierUp.calls = count(arg);
+        } else if (arg.rfind("--tier-up-loops=", 0) == 0) {
+            options.tierUp.loops = count(arg);
+        } else if (arg == "--log-tiering") {
+            options.tierUp.log = true;
+        } else if (arg == "--jit") {
+            if (!Jit::available) {
+                std::cerr << "This interpreter was built without the JIT." << std::endl;
+                exit(64);
+            }
+            options.jit = true;
+        } else if (arg == "--no-inline") {
+            options.inlining = false;
+        } else if (arg == "--no-hoist") {
+            options.hoisting = false;
+        } else if (arg == "--heap-stats") {
+            heapStats = true;
+        } else if (arg.rfind("--gc-budget=", 0) == 0) {
+            try {
+                double budget = std::stod(arg.substr(12));
+                if (!(budget > 0)) usage();
+                options.pauseBudget = budget;
+            } catch (const std::exception&) {
+                usage();
+            }
+        } else if (arg == "--compact") {
+            options.compaction = true;
+        } else if (arg == "--emit-cpp") {
+            emitCpp = true;
+        } else if (arg.rfind("--max-stack=", 0) == 0) {
+            try {
+                options.stackLimit = std::stoul(arg.substr(12)) << 20;
+            } catch (const std::exception&) {
+                usage();
+            }
+        } else if (arg.rfind("--max-heap=", 0) == 0) {
+            try {
+                size_t megabytes = std::stoul(arg.substr(11));
+                if (megabytes == 0) usage();
+                options.heapLimit = megabytes << 20;
+            } catch (const std::exception&) {
+                usage();
+            }
+        } else if (arg.rfind("--", 0) == 0 || !script.empty()) {
+            usage();
+        } else {
+            script = arg;
+        }
+    }
+
+    // a translation needs the whole script at once.
+    if (emitCpp && script.empty()) usage();
+
+    Lox lox{options};
+    lox.setHeapStats(heapStats);
+    if (emitCpp) {
+        lox.emitCpp(script);
+    } else if (!script.empty()) {
+        lox.runFile(script);
     } else {
-        Lox::runPrompt();
+        lox.runPrompt();
     }
     return 0;
-}
\ No newline at end of file
+}
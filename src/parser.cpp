@@ -2,7 +2,8 @@
 
 namespace lox {
 
-Parser::Parser(std::vector<Token>& tokens_ ): tokens{tokens_}, current{0} {}
+Parser::Parser(std::vector<Token>& tokens_, Errors& errors_)
+    : tokens{tokens_}, current{0}, errors{errors_} {}
 
 std::vector<std::unique_ptr<Stmt>> Parser::parse() {
     std::vector<std::unique_ptr<Stmt>> statements;
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include "pool.hpp"
+
+namespace lox {
+
+size_t PoolStats::bytes() const {
+    return slabs * Slabs::SLAB_BYTES;
+}
+
+Slabs::Slabs(Accounting::Account* account_, Accounting::Kind kind_, size_t blockSize_)
+    : blockSize{0}, account{account_}, kind{kind_} {
+    if (blockSize_) setBlockSize(blockSize_);
+}
+
+void Slabs::setBlockSize(size_t size) {
+    // a free block holds the next one of the list.
+    constexpr size_t align = alignof(std::max_align_t);
+    blockSize = (std::max(size, sizeof(void*)) + align - 1) / align * align;
+    perSlab = (SLAB_BYTES - HEADER) / blockSize;
+    if (perSlab == 0) throw std::logic_error("Block too large for a slab.");
+}
+
+void* Slabs::allocate(size_t size) {
+    if (!blockSize) setBlockSize(size);
+    if (size > blockSize) throw std::logic_error("Block larger than the pool's.");
+    if (!freeList) grow();
+    void* block = freeList;
+    freeList = *static_cast<void**>(block);
+    size_t i = (static_cast<char*>(block) - reinterpret_cast<char*>(slabOf(block)) - HEADER) / blockSize;
+    slabOf(block)->live[i / 64] |= uint64_t{1} << (i % 64);
+    live++;
+    return block;
+}
+
+void Slabs::deallocate(void* block) {
+    size_t i = (static_cast<char*>(block) - reinterpret_cast<char*>(slabOf(block)) - HEADER) / blockSize;
+    slabOf(block)->live[i / 64] &= ~(uint64_t{1} << (i % 64));
+    *static_cast<void**>(block) = freeList;
+    freeList = block;
+    live--;
+}
+
+void Slabs::grow() {
+    void* memory = std::aligned_alloc(SLAB_BYTES, SLAB_BYTES);
+    if (!memory) throw std::bad_alloc();
+    Accounting::charge(account, kind, SLAB_BYTES);
+    Slab* slab = static_cast<Slab*>(memory);
+    std::memset(slab->live, 0, sizeof(slab->live));
+    slabs.push_back(slab);
+    // threaded backwards so that the first allocations go in address order.
+    for (size_t i = perSlab; i-- > 0;) {
+        void* free = block(slab, i);
+        *static_cast<void**>(free) = freeList;
+        freeList = free;
+    }
+}
+
+void Slabs::release() {
+    for (Slab* slab : slabs) std::free(slab);
+    Accounting::discharge(account, kind, slabs.size() * SLAB_BYTES);
+    slabs.clear();
+    freeList = nullptr;
+    live = 0;
+}
+
+void Slabs::trim() {
+    std::vector<Slab*> kept;
+    for (Slab* slab : slabs) {
+        bool used = std::any_of(std::begin(slab->live), std::end(slab->live),
+                                [](uint64_t word) { return word != 0; });
+        if (used) {
+            kept.push_back(slab);
+        } else {
+            std::free(slab);
+            Accounting::discharge(account, kind, SLAB_BYTES);
+        }
+    }
+    slabs = std::move(kept);
+    // the first slabs' holes are filled first.
+    freeList = nullptr;
+    for (size_t s = slabs.size(); s-- > 0;) {
+        for (size_t i = perSlab; i-- > 0;) {
+            if (slabs[s]->live[i / 64] & (uint64_t{1} << (i % 64))) continue;
+            void* free = block(slabs[s], i);
+            *static_cast<void**>(free) = freeList;
+            freeList = free;
+        }
+    }
+}
+
+PoolStats Slabs::stats() const {
+    PoolStats stats;
+    stats.live = live;
+    stats.capacity = slabs.size() * perSlab;
+    stats.slabs = slabs.size();
+    stats.blockSize = blockSize;
+    return stats;
+}
+
+} // namespace lox
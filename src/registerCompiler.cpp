@@ -0,0 +1,455 @@
+#include "registerCompiler.hpp"
+#include "type.hpp"
+#include "accounting.hpp"
+#include <stdexcept>
+#include <algorithm>
+
+namespace lox {
+
+static constexpr size_t MAX_OPERAND = UINT16_MAX;
+
+// expressions without side effects, which can't change a local read before them.
+static bool isSimple(std::unique_ptr<Expr>& expr) {
+    Type type = TypeIdentifier{}.identify(expr);
+    return type == Type::Literal || type == Type::Variable || type == Type::This;
+}
+
+// expressions only writing their destination with their last instruction.
+static bool writesLast(std::unique_ptr<Expr>& expr) {
+    Type type = TypeIdentifier{}.identify(expr);
+    return type == Type::Binary || type == Type::Unary || type == Type::Literal
+        || type == Type::Get || type == Type::Variable || type == Type::This;
+}
+
+Chunk& RegisterCompiler::compile(Function& function) {
+    // a chunk left half compiled would run.
+    Accounting::Unchecked unchecked;
+    function.registerChunk = std::make_shared<Chunk>();
+    Chunk& chunk = *function.registerChunk;
+    chunk.frameSize = function.frameSize;
+
+    // an initializer's bare "return;" hands back its receiver.
+    int receiver = -1;
+    if (function.kind != "function" && function.name.lexeme == "init") {
+        receiver = function.params.size();
+    }
+    RegisterCompiler compiler(chunk, receiver);
+    for (auto& stmt : function.body) {
+        compiler.statement(stmt);
+    }
+    unsigned int nil = compiler.allocate();
+    compiler.emit(R_LOADNIL, {nil});
+    compiler.emit(R_RETURN, {nil});
+    return chunk;
+}
+
+std::unique_ptr<Chunk> RegisterCompiler::compile(std::vector<SExpr>& statements, unsigned int frameSize) {
+    Accounting::Unchecked unchecked;
+    auto chunk = std::make_unique<Chunk>();
+    chunk->frameSize = frameSize;
+
+    RegisterCompiler compiler(*chunk);
+    for (auto& stmt : statements) {
+        compiler.statement(stmt);
+    }
+    unsigned int nil = compiler.allocate();
+    compiler.emit(R_LOADNIL, {nil});
+    compiler.emit(R_RETURN, {nil});
+    return chunk;
+}
+
+unsigned int RegisterCompiler::expr(PExpr& e, int destination) {
+    unsigned int saved = top;
+    int enclosing = target;
+    target = destination;
+    e->accept(*this);
+    target = enclosing;
+
+    unsigned int reg = result;
+    if (destination >= 0) {
+        if (reg != (unsigned int)destination) emit(R_MOVE, {(size_t)destination, reg});
+        top = saved;
+        return destination;
+    }
+    // a temporary holding the value stays allocated, the others are released.
+    top = reg >= saved ? reg + 1 : saved;
+    return reg;
+}
+
+void RegisterCompiler::statement(SExpr& stmt) {
+    stmt->accept(*this);
+    top = chunk.frameSize;
+}
+
+unsigned int RegisterCompiler::allocate() {
+    chunk.maxStack = std::max(chunk.maxStack, top + 1 - chunk.frameSize);
+    return top++;
+}
+
+void RegisterCompiler::emit(RegisterOp op, std::initializer_list<size_t> operands) {
+    chunk.code.push_back(op);
+    for (size_t operand : operands) {
+        if (operand > MAX_OPERAND) {
+            throw std::runtime_error("Too many locals, constants or names in one function.");
+        }
+        chunk.code.push_back((operand >> 8) & 0xff);
+        chunk.code.push_back(operand & 0xff);
+    }
+}
+
+size_t RegisterCompiler::emitJump(RegisterOp op, std::initializer_list<size_t> operands) {
+    emit(op, operands);
+    chunk.code.push_back(0);
+    chunk.code.push_back(0);
+    return chunk.code.size() - 2;
+}
+
+void RegisterCompiler::patchJump(size_t jump) {
+    size_t offset = chunk.code.size() - jump - 2;
+    if (offset > MAX_OPERAND) {
+        throw std::runtime_error("Too much code to jump over.");
+    }
+    chunk.code[jump] = (offset >> 8) & 0xff;
+    chunk.code[jump + 1] = offset & 0xff;
+}
+
+void RegisterCompiler::emitLoop(size_t start) {
+    // the offset is counted from the end of the loop instruction.
+    emit(R_LOOP, {chunk.code.size() + 3 - start});
+}
+
+size_t RegisterCompiler::name(const Token& token) {
+    // shared by the uses of a name on one line only: the token gives the
+    // line runtime errors report.
+    auto it = std::find_if(chunk.names.begin(), chunk.names.end(),
+        [&](const Token& t) { return t.lexeme == token.lexeme && t.line == token.line; });
+    if (it != chunk.names.end()) return it - chunk.names.begin();
+    chunk.names.push_back(token);
+    return chunk.names.size() - 1;
+}
+
+void RegisterCompiler::call(Call& expr, RegisterOp op) {
+    // the callee and its arguments take the highest registers, so that the
+    // frame of the call starts right above them.
+    unsigned int base = allocate();
+    this->expr(expr.callee, base);
+    for (auto& argument : expr.arguments) {
+        this->expr(argument, allocate());
+    }
+    emit(op, {base, expr.arguments.size()});
+    top = base + 1;
+    result = base;
+}
+
+// Expr
+LoxObject RegisterCompiler::visitAssignExpr(Assign& expr) {
+    if (expr.slot >= 0) {
+        if (writesLast(expr.value)) {
+            this->expr(expr.value, expr.slot);
+        } else {
+            unsigned int value = this->expr(expr.value);
+            if (value != (unsigned int)expr.slot) emit(R_MOVE, {(size_t)expr.slot, value});
+        }
+        result = expr.slot;
+        return LoxObject();
+    }
+
+    unsigned int value = this->expr(expr.value);
+    if (expr.upvalue >= 0) {
+        emit(R_SETUPVAL, {(size_t)expr.upvalue, value});
+    } else {
+        emit(R_SETGLOBAL, {(size_t)expr.global, name(expr.name), value});
+    }
+    result = value;
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitBinaryExpr(Binary& expr) {
+    unsigned int out = destination();
+    unsigned int left = this->expr(expr.left);
+    if (isLocal(left) && !isSimple(expr.right)) {
+        // the right operand could assign the local before it's used.
+        unsigned int copy = allocate();
+        emit(R_MOVE, {copy, left});
+        left = copy;
+    }
+    unsigned int right = this->expr(expr.right);
+
+    RegisterOp op;
+    switch(expr.operator_.token_type) {
+        case TokenType::GREATER: op = R_GT; break;
+        case TokenType::GREATER_EQUAL: op = R_GE; break;
+        case TokenType::LESS: op = R_LT; break;
+        case TokenType::LESS_EQUAL: op = R_LE; break;
+        case TokenType::MINUS: op = R_SUB; break;
+        case TokenType::PLUS: op = R_ADD; break;
+        case TokenType::SLASH: op = R_DIV; break;
+        case TokenType::STAR: op = R_MUL; break;
+        case TokenType::BANG_EQUAL: op = R_NE; break;
+        case TokenType::EQUAL_EQUAL: op = R_EQ; break;
+        default:
+            throw std::runtime_error("unknown binary expression");
+    }
+    emit(op, {out, left, right});
+    result = out;
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitCallExpr(Call& expr) {
+    call(expr, R_CALL);
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitCommaExprExpr(CommaExpr& expr) {
+    int destination = target;
+    for (size_t i = 0; i < expr.expressions.size() - 1; i++) {
+        unsigned int saved = top;
+        this->expr(expr.expressions[i]);
+        top = saved;
+    }
+    result = this->expr(expr.expressions.back(), destination);
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitGetExpr(Get& expr) {
+    unsigned int out = destination();
+    unsigned int object = this->expr(expr.object);
+    emit(R_GETPROP, {out, object, name(expr.name)});
+    result = out;
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitGroupingExpr(Grouping& expr) {
+    result = this->expr(expr.expression, target);
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitHoistedExpr(Hoisted& expr) {
+    // register code computes the invariant at each iteration.
+    result = this->expr(expr.expression, target);
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitInlinedExpr(Inlined& expr) {
+    // register code makes the call the inliner replaced.
+    result = this->expr(expr.original, target);
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitLiteralExpr(Literal& expr) {
+    unsigned int out = destination();
+    switch (expr.value.getLoxObjectType()) {
+        case LoxType::Nil:
+            emit(R_LOADNIL, {out});
+            break;
+        case LoxType::Bool:
+            emit(expr.value ? R_LOADTRUE : R_LOADFALSE, {out});
+            break;
+        default:
+            chunk.constants.push_back(expr.value);
+            emit(R_LOADK, {out, chunk.constants.size() - 1});
+    }
+    result = out;
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitLogicalExpr(Logical& expr) {
+    // the left operand stays as the result when it decides the outcome.
+    unsigned int out = destination();
+    this->expr(expr.left, out);
+    size_t end = emitJump(expr.operator_.token_type == OR ? R_JMPT : R_JMPF, {out});
+    this->expr(expr.right, out);
+    patchJump(end);
+    result = out;
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitSetExpr(Set& expr) {
+    unsigned int object = this->expr(expr.object);
+    if (isLocal(object) && !isSimple(expr.value)) {
+        unsigned int copy = allocate();
+        emit(R_MOVE, {copy, object});
+        object = copy;
+    }
+    unsigned int value = this->expr(expr.value);
+    emit(R_SETPROP, {object, name(expr.name), value});
+    result = value;
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitSuperExpr(Super& expr) {
+    unsigned int out = destination();
+    auto variable = [&](int slot, int upvalue) -> size_t {
+        if (slot >= 0) return slot;
+        unsigned int reg = allocate();
+        emit(R_GETUPVAL, {reg, (size_t)upvalue});
+        return reg;
+    };
+    size_t object = variable(expr.thisSlot, expr.thisUpvalue);
+    size_t superclass = variable(expr.slot, expr.upvalue);
+    emit(R_GETSUPER, {out, object, superclass, name(expr.method)});
+    result = out;
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitTernaryExpr(Ternary& expr) {
+    unsigned int out = destination();
+    unsigned int saved = top;
+    unsigned int condition = this->expr(expr.condition);
+    top = saved;
+    size_t elseJump = emitJump(R_JMPF, {condition});
+    this->expr(expr.thenBranch, out);
+    size_t end = emitJump(R_JMP);
+    patchJump(elseJump);
+    this->expr(expr.elseBranch, out);
+    patchJump(end);
+    result = out;
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitThisExpr(This& expr) {
+    if (expr.slot >= 0) {
+        result = expr.slot;
+    } else {
+        result = destination();
+        emit(R_GETUPVAL, {result, (size_t)expr.upvalue});
+    }
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitUnaryExpr(Unary& expr) {
+    unsigned int out = destination();
+    unsigned int right = this->expr(expr.right);
+    switch(expr.operator_.token_type) {
+        case TokenType::BANG: emit(R_NOT, {out, right}); break;
+        case TokenType::MINUS: emit(R_NEG, {out, right}); break;
+        default:
+            throw std::runtime_error("Invalid unary expression.");
+    }
+    result = out;
+    return LoxObject();
+}
+
+LoxObject RegisterCompiler::visitVariableExpr(Variable& expr) {
+    if (expr.slot >= 0) {
+        // locals are read in place.
+        result = expr.slot;
+    } else if (expr.upvalue >= 0) {
+        result = destination();
+        emit(R_GETUPVAL, {result, (size_t)expr.upvalue});
+    } else {
+        result = destination();
+        emit(R_GETGLOBAL, {result, (size_t)expr.global, name(expr.name)});
+    }
+    return LoxObject();
+}
+
+// Stmt
+void RegisterCompiler::visitBlockStmt(Block& stmt) {
+    for (auto& statement : stmt.statements) {
+        this->statement(statement);
+    }
+    if (stmt.captured) emit(R_CLOSE, {stmt.firstSlot});
+}
+
+void RegisterCompiler::visitClassStmt(Class& stmt) {
+    unsigned int klass = allocate();
+    if (stmt.superclass) {
+        expr(stmt.superclass, klass);
+    } else {
+        emit(R_LOADNIL, {klass});
+    }
+    chunk.classes.push_back(&stmt);
+    emit(R_CLASS, {klass, chunk.classes.size() - 1});
+
+    // a global class is already defined when its methods are created.
+    if (stmt.slot >= 0) {
+        emit(R_MOVE, {(size_t)stmt.slot, klass});
+    } else {
+        emit(R_SETGLOBAL, {(size_t)stmt.global, name(stmt.name), klass});
+    }
+}
+
+void RegisterCompiler::visitExpressionStmt(Expression& stmt) {
+    expr(stmt.expression);
+}
+
+void RegisterCompiler::visitFunctionStmt(Function& stmt) {
+    chunk.functions.push_back(&stmt);
+    if (stmt.slot >= 0) {
+        emit(R_CLOSURE, {(size_t)stmt.slot, chunk.functions.size() - 1});
+    } else {
+        unsigned int function = allocate();
+        emit(R_CLOSURE, {function, chunk.functions.size() - 1});
+        emit(R_DEFGLOBAL, {(size_t)stmt.global, function});
+    }
+}
+
+void RegisterCompiler::visitIfStmt(If& stmt) {
+    unsigned int condition = expr(stmt.condition);
+    top = chunk.frameSize;
+    size_t elseJump = emitJump(R_JMPF, {condition});
+    statement(stmt.thenBranch);
+    if (stmt.elseBranch) {
+        size_t end = emitJump(R_JMP);
+        patchJump(elseJump);
+        statement(stmt.elseBranch);
+        patchJump(end);
+    } else {
+        patchJump(elseJump);
+    }
+}
+
+void RegisterCompiler::visitPrintStmt(Print& stmt) {
+    emit(R_PRINT, {expr(stmt.expression)});
+}
+
+void RegisterCompiler::visitReturnStmt(Return& stmt) {
+    if (stmt.tailCall) {
+        // the return only runs when the callee can't take over the frame.
+        call(*static_cast<Call*>(stmt.value.get()), R_TAILCALL);
+        emit(R_RETURN, {result});
+    } else if (stmt.value) {
+        emit(R_RETURN, {expr(stmt.value)});
+    } else if (receiver >= 0) {
+        emit(R_RETURN, {(size_t)receiver});
+    } else {
+        unsigned int nil = allocate();
+        emit(R_LOADNIL, {nil});
+        emit(R_RETURN, {nil});
+    }
+}
+
+void RegisterCompiler::visitVarStmt(Var& stmt) {
+    if (stmt.slot >= 0) {
+        // nothing can read the variable before it's defined, so the
+        // initializer is computed in place.
+        if (stmt.initializer) {
+            expr(stmt.initializer, stmt.slot);
+        } else {
+            emit(R_LOADNIL, {(size_t)stmt.slot});
+        }
+        return;
+    }
+
+    unsigned int value;
+    if (stmt.initializer) {
+        value = expr(stmt.initializer);
+    } else {
+        value = allocate();
+        emit(R_LOADNIL, {value});
+    }
+    emit(R_DEFGLOBAL, {(size_t)stmt.global, value});
+}
+
+void RegisterCompiler::visitWhileStmt(While& stmt) {
+    size_t start = chunk.code.size();
+    unsigned int condition = expr(stmt.condition);
+    top = chunk.frameSize;
+    size_t exit = emitJump(R_JMPF, {condition});
+    statement(stmt.body);
+    emitLoop(start);
+    patchJump(exit);
+}
+
+} // namespace lox
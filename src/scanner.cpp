@@ -3,8 +3,8 @@
 
 namespace lox {
 
-Scanner::Scanner(const std::string& source): 
-    source{source}, start{0}, current{0}, line{0} 
+Scanner::Scanner(const std::string& source, Errors& errors): 
+    start{0}, current{0}, line{0}, source{source}, errors{errors} 
 {}
 
 std::vector<Token> Scanner::scanTokens() {
@@ -0,0 +1,457 @@
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include "transpiler.hpp"
+#include "type.hpp"
+
+namespace lox {
+
+void Transpiler::emit(std::vector<SExpr>& statements, std::ostream& out) {
+    Transpiler transpiler;
+    transpiler.captured.push_back({});
+    capturedSlots(statements, transpiler.captured.back());
+    transpiler.scopes.push_back({});
+    for (auto& stmt : statements) {
+        transpiler.translate(stmt);
+    }
+
+    out << "// Generated by the Lox interpreter with --emit-cpp. Build it against the\n"
+        << "// runtime's headers, which aren't installed, and the library:\n"
+        << "//   c++ -std=c++17 -O2 -I<lox>/include <this file> <build>/liblox.a\n\n"
+        << "#include \"transpiled.hpp\"\n\n"
+        << "using namespace lox;\n"
+        << "using namespace lox::transpiled;\n\n"
+        << "// owns the objects of the script, it goes first to be destroyed last.\n"
+        << "static Interpreter interpreter;\n\n";
+    for (auto& name : transpiler.globals) {
+        out << "static Global g_" << name << " {\"" << name << "\"};\n";
+    }
+    for (auto& name : transpiler.properties) {
+        out << "static const Token p_" << name << " {IDENTIFIER, \"" << name << "\", 0};\n";
+    }
+    out << "\nstatic void script() {\n";
+    if (transpiler.globals.count("clock")) {
+        out << "    g_clock.define(nativeClock(interpreter));\n";
+    }
+    out << transpiler.out.str()
+        << "}\n\n"
+        << "int main() {\n"
+        << "    return run(script);\n"
+        << "}\n";
+}
+
+void Transpiler::capturedSlots(std::vector<SExpr>& statements, std::set<unsigned int>& slots) {
+    for (auto& stmt : statements) {
+        capturedSlots(stmt, slots);
+    }
+}
+
+void Transpiler::capturedSlots(SExpr& stmt, std::set<unsigned int>& slots) {
+    // closures are created by the function and class statements of the
+    // frame, the resolver listed the slots they capture in it.
+    auto capture = [&](Function& function) {
+        for (auto& desc : function.upvalues) {
+            if (desc.isLocal) slots.insert(desc.index);
+        }
+    };
+    switch (TypeIdentifier{}.identify(stmt)) {
+        case Type::Function:
+            capture(static_cast<Function&>(*stmt));
+            break;
+        case Type::Class:
+            for (auto& method : static_cast<Class&>(*stmt).methods) capture(*method);
+            break;
+        case Type::Block:
+            capturedSlots(static_cast<Block&>(*stmt).statements, slots);
+            break;
+        case Type::If: {
+            auto& branches = static_cast<If&>(*stmt);
+            capturedSlots(branches.thenBranch, slots);
+            if (branches.elseBranch) capturedSlots(branches.elseBranch, slots);
+            break;
+        }
+        case Type::While:
+            capturedSlots(static_cast<While&>(*stmt).body, slots);
+            break;
+        default:
+            break;
+    }
+}
+
+void Transpiler::line(const std::string& text) {
+    out << std::string(4 * indent, ' ') << text << '\n';
+}
+
+void Transpiler::nested(SExpr& stmt) {
+    indent++;
+    scopes.push_back({});
+    if (TypeIdentifier{}.identify(stmt) == Type::Block) {
+        for (auto& statement : static_cast<Block&>(*stmt).statements) {
+            translate(statement);
+        }
+    } else {
+        translate(stmt);
+    }
+    scopes.pop_back();
+    indent--;
+}
+
+void Transpiler::declare(const std::string& name, int slot, const std::string& value) {
+    bool cell = captured.back().count(slot);
+    scopes.back()[name] = cell;
+    if (cell) {
+        line("Cell v_" + name + " = std::make_shared<LoxObject>(" + value + ");");
+    } else {
+        line("LoxObject v_" + name + " = " + value + ";");
+    }
+}
+
+std::string Transpiler::local(const std::string& name) {
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); scope++) {
+        auto local = scope->find(name);
+        if (local != scope->end()) {
+            return local->second ? "(*v_" + name + ")" : "v_" + name;
+        }
+    }
+    throw std::logic_error("Transpiler: no local named " + name + ".");
+}
+
+std::string Transpiler::variable(const Token& name, int slot, int upvalue) {
+    if (slot < 0 && upvalue < 0) {
+        return global(name.lexeme) + ".get(" + std::to_string(name.line) + ")";
+    }
+    return local(name.lexeme);
+}
+
+std::string Transpiler::global(const std::string& name) {
+    globals.insert(name);
+    return "g_" + name;
+}
+
+std::string Transpiler::property(const Token& name) {
+    properties.insert(name.lexeme);
+    return "p_" + name.lexeme;
+}
+
+std::string Transpiler::operands(PExpr& left, PExpr& right) {
+    std::string first = translate(left);
+    return "{" + first + ", " + translate(right) + "}";
+}
+
+std::string Transpiler::literal(const LoxObject& value) {
+    switch (value.getLoxObjectType()) {
+        case LoxType::Bool:
+            return static_cast<bool>(value) ? "LoxObject(true)" : "LoxObject(false)";
+        case LoxType::Number: {
+            // the shortest digits reading back as the same double.
+            double number = value;
+            std::ostringstream digits;
+            for (int precision = 15; precision <= 17; precision++) {
+                digits.str("");
+                digits << std::setprecision(precision) << number;
+                if (std::stod(digits.str()) == number) break;
+            }
+            std::string text = digits.str();
+            if (text.find_first_of(".e") == std::string::npos) text += ".0";
+            return "LoxObject(" + text + ")";
+        }
+        case LoxType::String: {
+            std::string text;
+            for (unsigned char c : static_cast<std::string>(value)) {
+                if (c == '"' || c == '\\') {
+                    text += '\\';
+                    text += c;
+                } else if (c == '\n') {
+                    text += "\\n";
+                } else if (c < 0x20 || c >= 0x7f) {
+                    char escape[5];
+                    std::snprintf(escape, sizeof(escape), "\\%03o", c);
+                    text += escape;
+                } else {
+                    text += c;
+                }
+            }
+            return "LoxObject(std::string(\"" + text + "\"))";
+        }
+        default:
+            return "LoxObject()";
+    }
+}
+
+void Transpiler::function(Function& stmt, const std::string& prefix, const std::string& suffix) {
+    bool method = stmt.kind != "function";
+    std::string args = stmt.params.empty() ? "const LoxObject*" : "const LoxObject* args";
+    std::string receiver = method ? "const LoxObject& receiver" : "const LoxObject&";
+    line(prefix + "function(interpreter, \"" + stmt.name.lexeme + "\", " + std::to_string(stmt.params.size())
+         + ", " + (stmt.kind == "getter" ? "true" : "false") + ", [=](" + args + ", " + receiver + ") -> LoxObject {");
+
+    bool enclosingInitializer = initializer;
+    initializer = method && stmt.name.lexeme == "init";
+    indent++;
+    captured.push_back({});
+    capturedSlots(stmt.body, captured.back());
+    scopes.push_back({});
+    for (size_t i = 0; i < stmt.params.size(); i++) {
+        declare(stmt.params[i].lexeme, i, "args[" + std::to_string(i) + "]");
+    }
+    if (method) {
+        // the receiver is never assigned, closures can copy it.
+        scopes.back()["this"] = false;
+        line("const LoxObject& v_this = receiver;");
+    }
+    for (auto& statement : stmt.body) {
+        translate(statement);
+    }
+    // an initializer only returns its receiver from a return statement,
+    // class calls return the instance anyway.
+    line("return LoxObject();");
+    scopes.pop_back();
+    captured.pop_back();
+    indent--;
+    initializer = enclosingInitializer;
+
+    line("})" + suffix);
+}
+
+LoxObject Transpiler::visitAssignExpr(Assign& expr) {
+    std::string value = translate(expr.value);
+    if (expr.slot < 0 && expr.upvalue < 0) {
+        code = global(expr.name.lexeme) + ".assign(" + value + ", " + std::to_string(expr.name.line) + ")";
+    } else {
+        code = "(" + local(expr.name.lexeme) + " = " + value + ")";
+    }
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitBinaryExpr(Binary& expr) {
+    std::string op;
+    switch (expr.operator_.token_type) {
+        case TokenType::PLUS: op = "add"; break;
+        case TokenType::MINUS: op = "subtract"; break;
+        case TokenType::STAR: op = "multiply"; break;
+        case TokenType::SLASH: op = "divide"; break;
+        case TokenType::LESS: op = "less"; break;
+        case TokenType::LESS_EQUAL: op = "lessEqual"; break;
+        case TokenType::GREATER: op = "greater"; break;
+        case TokenType::GREATER_EQUAL: op = "greaterEqual"; break;
+        case TokenType::EQUAL_EQUAL: op = "equal"; break;
+        case TokenType::BANG_EQUAL: op = "notEqual"; break;
+        default:
+            throw std::runtime_error("unknown binary expression");
+    }
+    code = op + "(" + operands(expr.left, expr.right) + ")";
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitCallExpr(Call& expr) {
+    code = "call(interpreter, " + callOperands(expr) + ")";
+    return LoxObject();
+}
+
+std::string Transpiler::callOperands(Call& expr) {
+    std::string values = "{" + translate(expr.callee);
+    for (auto& argument : expr.arguments) {
+        values += ", " + translate(argument);
+    }
+    return values + "}";
+}
+
+LoxObject Transpiler::visitCommaExprExpr(CommaExpr& expr) {
+    std::string comma = "(";
+    for (size_t i = 0; i + 1 < expr.expressions.size(); i++) {
+        comma += "(void)(" + translate(expr.expressions[i]) + "), ";
+    }
+    code = comma + translate(expr.expressions.back()) + ")";
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitGetExpr(Get& expr) {
+    code = "get(" + translate(expr.object) + ", " + property(expr.name) + ")";
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitGroupingExpr(Grouping& expr) {
+    code = "(" + translate(expr.expression) + ")";
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitHoistedExpr(Hoisted& expr) {
+    code = translate(expr.expression);
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitInlinedExpr(Inlined& expr) {
+    // the system compiler does its own inlining.
+    code = translate(expr.original);
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitLiteralExpr(Literal& expr) {
+    code = literal(expr.value);
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitLogicalExpr(Logical& expr) {
+    std::string left = translate(expr.left);
+    std::string test = expr.operator_.token_type == OR ? "truthy(left)" : "!truthy(left)";
+    code = "[&]() -> LoxObject { LoxObject left = " + left + "; if (" + test + ") return left; return "
+         + translate(expr.right) + "; }()";
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitSetExpr(Set& expr) {
+    code = "set(" + operands(expr.object, expr.value) + ", " + property(expr.name) + ")";
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitSuperExpr(Super& expr) {
+    code = "superMethod(" + local("super") + ", " + local("this") + ", " + property(expr.method) + ")";
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitTernaryExpr(Ternary& expr) {
+    std::string condition = translate(expr.condition);
+    std::string thenBranch = translate(expr.thenBranch);
+    code = "(truthy(" + condition + ") ? LoxObject(" + thenBranch + ") : LoxObject("
+         + translate(expr.elseBranch) + "))";
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitThisExpr(This& expr) {
+    code = local("this");
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitUnaryExpr(Unary& expr) {
+    std::string op = expr.operator_.token_type == MINUS ? "negate" : "logicalNot";
+    code = op + "(" + translate(expr.right) + ")";
+    return LoxObject();
+}
+
+LoxObject Transpiler::visitVariableExpr(Variable& expr) {
+    code = variable(expr.name, expr.slot, expr.upvalue);
+    return LoxObject();
+}
+
+void Transpiler::visitBlockStmt(Block& stmt) {
+    line("{");
+    indent++;
+    scopes.push_back({});
+    for (auto& statement : stmt.statements) {
+        translate(statement);
+    }
+    scopes.pop_back();
+    indent--;
+    line("}");
+}
+
+void Transpiler::visitClassStmt(Class& stmt) {
+    const std::string& name = stmt.name.lexeme;
+    std::string superclass = "LoxObject()";
+    std::string prefix, suffix;
+    if (stmt.slot >= 0) {
+        // methods may refer to the class, its name is in scope first.
+        bool cell = captured.back().count(stmt.slot);
+        std::string value = stmt.superclass ? "superclass(" + translate(stmt.superclass) + ")" : "";
+        scopes.back()[name] = cell;
+        line(cell ? "Cell v_" + name + " = std::make_shared<LoxObject>();" : "LoxObject v_" + name + ";");
+        prefix = local(name) + " = ";
+        suffix = ";";
+        if (stmt.superclass) superclass = value;
+    } else {
+        if (stmt.superclass) superclass = "superclass(" + translate(stmt.superclass) + ")";
+        prefix = global(name) + ".define(";
+        suffix = ");";
+    }
+
+    // methods capture "super" from a block around the class.
+    if (stmt.superclass) {
+        line("{");
+        indent++;
+        scopes.push_back({{"super", false}});
+        line("LoxObject v_super = " + superclass + ";");
+        superclass = "v_super";
+    }
+    line(prefix + "klass(interpreter, \"" + name + "\", " + superclass + ", {");
+    indent++;
+    for (size_t i = 0; i < stmt.methods.size(); i++) {
+        auto& method = *stmt.methods[i];
+        // the last method of a name replaces the previous ones.
+        bool replaced = false;
+        for (size_t j = i + 1; j < stmt.methods.size(); j++) {
+            replaced = replaced || stmt.methods[j]->name.lexeme == method.name.lexeme;
+        }
+        if (!replaced) function(method, "{\"" + method.name.lexeme + "\", ", "},");
+    }
+    indent--;
+    line("})" + suffix);
+    if (stmt.superclass) {
+        scopes.pop_back();
+        indent--;
+        line("}");
+    }
+}
+
+void Transpiler::visitExpressionStmt(Expression& stmt) {
+    line(translate(stmt.expression) + ";");
+}
+
+void Transpiler::visitFunctionStmt(Function& stmt) {
+    const std::string& name = stmt.name.lexeme;
+    if (stmt.slot < 0) {
+        function(stmt, global(name) + ".define(", ");");
+        return;
+    }
+    // declared before its body, which may call it.
+    bool cell = captured.back().count(stmt.slot);
+    scopes.back()[name] = cell;
+    if (cell) {
+        line("Cell v_" + name + " = std::make_shared<LoxObject>();");
+        function(stmt, "*v_" + name + " = ", ";");
+    } else {
+        function(stmt, "LoxObject v_" + name + " = ", ";");
+    }
+}
+
+void Transpiler::visitIfStmt(If& stmt) {
+    line("if (truthy(" + translate(stmt.condition) + ")) {");
+    nested(stmt.thenBranch);
+    if (stmt.elseBranch) {
+        line("} else {");
+        nested(stmt.elseBranch);
+    }
+    line("}");
+}
+
+void Transpiler::visitPrintStmt(Print& stmt) {
+    line("std::cout << " + translate(stmt.expression) + " << '\\n';");
+}
+
+void Transpiler::visitReturnStmt(Return& stmt) {
+    if (initializer) {
+        line("return " + local("this") + ";");
+    } else if (stmt.tailCall) {
+        line("return tailCall(interpreter, " + callOperands(static_cast<Call&>(*stmt.value)) + ");");
+    } else if (stmt.value) {
+        line("return " + translate(stmt.value) + ";");
+    } else {
+        line("return LoxObject();");
+    }
+}
+
+void Transpiler::visitVarStmt(Var& stmt) {
+    std::string value = stmt.initializer ? translate(stmt.initializer) : "LoxObject()";
+    if (stmt.slot >= 0) {
+        declare(stmt.name.lexeme, stmt.slot, value);
+    } else {
+        line(global(stmt.name.lexeme) + ".define(" + value + ");");
+    }
+}
+
+void Transpiler::visitWhileStmt(While& stmt) {
+    line("while (truthy(" + translate(stmt.condition) + ")) {");
+    nested(stmt.body);
+    line("}");
+}
+
+} // namespace lox
@@ -0,0 +1,1045 @@
+#include "vm.hpp"
+#include "interpreter.hpp"
+#include "compiler.hpp"
+#include "registerCompiler.hpp"
+#include "inliner.hpp"
+#include <algorithm>
+#include <limits>
+#ifdef LOX_PROFILE_OPCODES
+#include <iomanip>
+#endif
+
+namespace lox {
+
+static void checkArity(size_t arity, size_t argc) {
+    if (argc != arity) {
+        throw std::runtime_error("Function argument count mismatch. Expected "
+            + std::to_string(arity) + ", got " + std::to_string(argc) + "\n");
+    }
+}
+
+#ifdef LOX_PROFILE_OPCODES
+// Counts the instructions run, and the pairs of consecutive ones, which are
+// the candidates for superinstructions. The busiest are printed on stderr
+// when the program exits.
+template <size_t N>
+struct OpcodeProfile {
+    const char* const* names;
+    uint64_t counts[N] {};
+    uint64_t pairs[N][N] {};
+    size_t previous {N};
+
+    explicit OpcodeProfile(const char* const* names_) : names{names_} {}
+
+    void record(uint8_t op) {
+        counts[op]++;
+        if (previous < N) pairs[previous][op]++;
+        previous = op;
+    }
+
+    ~OpcodeProfile() {
+        uint64_t total = 0;
+        std::vector<std::pair<uint64_t, std::string>> singles, sequences;
+        for (size_t i = 0; i < N; i++) {
+            total += counts[i];
+            if (counts[i]) singles.push_back({counts[i], names[i]});
+            for (size_t j = 0; j < N; j++) {
+                if (pairs[i][j]) sequences.push_back({pairs[i][j], std::string(names[i]) + " " + names[j]});
+            }
+        }
+        if (total == 0) return;
+        std::cerr << "instructions dispatched: " << total << '\n';
+        report(singles, total);
+        report(sequences, total);
+    }
+
+    static void report(std::vector<std::pair<uint64_t, std::string>>& rows, uint64_t total) {
+        std::sort(rows.rbegin(), rows.rend());
+        if (rows.size() > 20) rows.resize(20);
+        for (auto& [count, name] : rows) {
+            std::cerr << std::setw(12) << count << std::setw(7) << std::fixed << std::setprecision(2)
+                      << 100.0 * count / total << "%  " << name << '\n';
+        }
+    }
+};
+
+#define OPCODE_NAME(op) #op,
+static const char* const opcodeNames[] = { LOX_OPCODES(OPCODE_NAME) };
+static const char* const registerOpcodeNames[] = { LOX_REGISTER_OPCODES(OPCODE_NAME) };
+#undef OPCODE_NAME
+static OpcodeProfile<OP_COUNT> stackProfile(opcodeNames);
+static OpcodeProfile<R_COUNT> registerProfile(registerOpcodeNames);
+#endif
+
+static bool compare(uint16_t comparison, const LoxObject& a, const LoxObject& b) {
+    switch (comparison) {
+        case OP_EQUAL: return a == b;
+        case OP_NOT_EQUAL: return a != b;
+        case OP_GREATER: return a > b;
+        case OP_GREATER_EQUAL: return a >= b;
+        case OP_LESS: return a < b;
+        case OP_LESS_EQUAL: return a <= b;
+        default: throw std::logic_error("Unknown comparison.");
+    }
+}
+
+// runs of a generic instruction seeing the same operand types before it is
+// specialized, doubled by each deoptimization of its site up to MAX_BACKOFF
+// times: a site seeing an uncommon type now and then goes back to the
+// specialized form, one whose types keep changing mostly stays generic.
+static constexpr uint16_t WARMUP = 8;
+static constexpr uint8_t MAX_BACKOFF = 6;
+
+static uint16_t warmup(const TypeFeedback& site) {
+    return WARMUP << std::min(site.deopts, MAX_BACKOFF);
+}
+
+// the specialized form of a binary operator for its operand types,
+// OP_COUNT when there is none.
+static OpCode specialization(OpCode generic, LoxType left, LoxType right) {
+    static_assert(OP_DIVIDE_NUMBERS - OP_EQUAL_NUMBERS == OP_DIVIDE - OP_EQUAL,
+                  "number operators are in the order of the generic ones");
+    if (left == LoxType::Number && right == LoxType::Number) {
+        return static_cast<OpCode>(OP_EQUAL_NUMBERS + (generic - OP_EQUAL));
+    }
+    if (left == LoxType::String && right == LoxType::String && generic == OP_ADD) {
+        return OP_ADD_STRINGS;
+    }
+    return OP_COUNT;
+}
+
+// The generic instruction op saw operands calling for specialized, which
+// replaces it once the same types have been seen for long enough.
+static void observe(uint8_t& op, TypeFeedback& site, LoxType left, LoxType right, OpCode specialized) {
+    if (left != site.left || right != site.right || specialized != site.specialized) {
+        site.left = left;
+        site.right = right;
+        site.specialized = specialized;
+        site.countdown = warmup(site);
+    } else if (specialized != OP_COUNT && --site.countdown == 0) {
+        op = specialized;
+    }
+}
+
+// A guard of the specialized instruction op failed: the generic one takes
+// its place again until its types settle.
+static void deoptimize(uint8_t& op, TypeFeedback& site) {
+    op = site.generic;
+    if (site.deopts < MAX_BACKOFF) site.deopts++;
+    site.countdown = warmup(site);
+}
+
+VM::VM(Interpreter& intp) : interpreter{intp} {
+    maxSlots = std::numeric_limits<size_t>::max();
+}
+
+void VM::setStackLimit(size_t bytes) {
+    maxSlots = bytes / sizeof(LoxObject);
+}
+
+void VM::interpret(Chunk& script, bool registerCode) {
+    size_t previousFp = interpreter.m_fp;
+    LoxFunction* previousClosure = interpreter.m_closure;
+    size_t base = interpreter.m_sp;
+    size_t entry = frames.size();
+    registers = registerCode;
+    try {
+        pushFrame(nullptr, script, base, base, false);
+        if (registers) {
+            runRegisters(entry);
+        } else {
+            run(entry);
+        }
+    } catch (...) {
+        unwind(entry, base);
+        interpreter.m_fp = previousFp;
+        interpreter.m_closure = previousClosure;
+        throw;
+    }
+    interpreter.m_fp = previousFp;
+    interpreter.m_closure = previousClosure;
+}
+
+LoxObject VM::call(LoxFunction* function) {
+    size_t fp = interpreter.m_fp;
+    size_t entry = frames.size();
+    registers = false;
+    try {
+        callFunction(function, fp, fp, false);
+        return run(entry);
+    } catch (...) {
+        unwind(entry, fp);
+        throw;
+    }
+}
+
+void VM::enterLoop(Chunk& loop) {
+    size_t base = interpreter.m_sp;
+    size_t entry = frames.size();
+    registers = false;
+    try {
+        pushFrame(interpreter.m_closure, loop, interpreter.m_fp, interpreter.m_fp, false);
+        frames.back().loop = true;
+        run(entry);
+    } catch (...) {
+        unwind(entry, base);
+        throw;
+    }
+}
+
+void VM::unwind(size_t entry, size_t base) {
+    // drop the frames a runtime error left behind along with their slots.
+    interpreter.closeUpvalues(base);
+    if (frames.size() > entry) {
+        Frame& last = frames.back();
+        size_t top = last.fp + last.chunk->frameSize + last.chunk->maxStack;
+        for (size_t i = base; i < top; i++) {
+            interpreter.m_stack[i] = LoxObject();
+        }
+    }
+    frames.resize(entry);
+    interpreter.m_sp = base;
+}
+
+void VM::pushFrame(LoxFunction* function, Chunk& chunk, size_t fp, size_t ret, bool construct) {
+    size_t top = fp + chunk.frameSize + chunk.maxStack;
+    if (top > maxSlots) {
+        throw std::runtime_error("Stack overflow.");
+    }
+    interpreter.reserveStack(top);
+    frames.push_back({function, &chunk, chunk.code.data(), fp, ret, construct});
+    interpreter.m_fp = fp;
+    interpreter.m_closure = function;
+    // temporaries of register code stay live across calls.
+    interpreter.m_sp = registers ? top : fp + chunk.frameSize;
+}
+
+void VM::callFunction(LoxFunction* function, size_t fp, size_t ret, bool construct) {
+    Function* declaration = function->getDeclaration();
+    Chunk* chunk;
+    if (registers) {
+        chunk = declaration->registerChunk ? declaration->registerChunk.get() 
+                                           : &RegisterCompiler::compile(*declaration);
+    } else {
+        chunk = declaration->chunk ? declaration->chunk.get() : &Compiler::compile(*declaration);
+    }
+    pushFrame(function, *chunk, fp, ret, construct);
+
+    // arguments are already in the parameter slots, the other locals start
+    // out nil and the receiver of a method goes right after the parameters.
+    size_t arity = function->arity();
+    for (size_t i = fp + arity; i < fp + chunk->frameSize; i++) {
+        interpreter.m_stack[i] = LoxObject();
+    }
+    if (function->isMethod()) interpreter.m_stack[fp + arity] = function->getReceiver();
+}
+
+bool VM::callValue(size_t calleeSlot, size_t argc) {
+    size_t args = calleeSlot + 1;
+    LoxObject& callee = interpreter.m_stack[calleeSlot];
+
+    switch (callee.getLoxObjectType()) {
+        case LoxType::Callable: {
+            LoxCallable* callable = callee.getFunction();
+            checkArity(callable->arity(), argc);
+            if (LoxFunction* function = callable->asFunction()) {
+                if (interpreter.m_jit && interpreter.m_jit->call(function, &interpreter.m_stack[args], callee)) {
+                    return false;
+                }
+                callFunction(function, args, calleeSlot, false);
+                return true;
+            }
+            Arguments arguments(interpreter.m_stack.begin() + args,
+                                interpreter.m_stack.begin() + args + argc);
+            LoxObject result = (*callable)(interpreter, arguments);
+            interpreter.m_stack[calleeSlot] = result;
+            return false;
+        }
+        case LoxType::Class: {
+            LoxClass* klass = callee.getLoxClass();
+            checkArity(klass->arity(), argc);
+            LoxObject instance(interpreter.createInstance(klass), &interpreter);
+            if (LoxFunction* init = klass->initializer()) {
+                // the bound initializer takes the place of the class.
+                LoxFunction* bound = interpreter.createFunction(init, instance);
+                callee = LoxObject(bound, &interpreter);
+                callFunction(bound, args, calleeSlot, true);
+                return true;
+            }
+            callee = instance;
+            return false;
+        }
+        default:
+            throw std::runtime_error("Can only call functions and classes.");
+    }
+}
+
+bool VM::invoke(size_t calleeSlot, const Token& name, size_t argc) {
+    LoxObject& object = interpreter.m_stack[calleeSlot];
+    if (object.getLoxObjectType() == LoxType::Instance) {
+        LoxInstance* instance = object.getInstance();
+        LoxObject field;
+        if (instance->getField(name.lexeme, field)) {
+            object = field;
+            return callValue(calleeSlot, argc);
+        }
+        // the receiver stays in the callee's slot, no bound method is made.
+        LoxFunction* method = instance->getClass()->findMethod(name.lexeme);
+        if (method && !method->isGetter()) {
+            checkArity(method->arity(), argc);
+            LoxObject receiver = object;
+            callFunction(method, calleeSlot + 1, calleeSlot, false);
+            interpreter.m_stack[calleeSlot + 1 + argc] = receiver;
+            return true;
+        }
+    }
+    if (LoxFunction* getter = getProperty(object, name)) {
+        LoxObject value = runGetter(getter, interpreter.m_sp);
+        interpreter.m_stack[calleeSlot] = value;
+    }
+    return callValue(calleeSlot, argc);
+}
+
+LoxObject VM::runGetter(LoxFunction* getter, size_t at) {
+    size_t fp = interpreter.m_fp;
+    size_t sp = interpreter.m_sp;
+    LoxFunction* closure = interpreter.m_closure;
+    callFunction(getter, at, at, false);
+    LoxObject result = run(frames.size() - 1);
+    interpreter.m_fp = fp;
+    interpreter.m_sp = sp;
+    interpreter.m_closure = closure;
+    return result;
+}
+
+LoxFunction* VM::getProperty(LoxObject& object, const Token& name, bool* field) {
+    // fields come first, then methods which getters are called from.
+    LoxObject value;
+    LoxObject receiver;
+    LoxClass* klass;
+    switch (object.getLoxObjectType()) {
+        case LoxType::Instance:
+            if (object.getInstance()->getField(name.lexeme, value)) {
+                object = value;
+                if (field) *field = true;
+                return nullptr;
+            }
+            klass = object.getInstance()->getClass();
+            receiver = object;
+            break;
+        case LoxType::Class:
+            if (object.getLoxClass()->getField(name.lexeme, value)) {
+                object = value;
+                return nullptr;
+            }
+            klass = object.getLoxClass();
+            break;
+        default:
+            throw std::runtime_error("Cannot get property from a non-class or a non-class instance");
+    }
+
+    LoxFunction* method = klass->findMethod(name.lexeme);
+    if (!method) {
+        throw std::runtime_error("Undefined property '" + name.lexeme + "'.");
+    }
+    return bindMethod(object, method, receiver);
+}
+
+LoxFunction* VM::bindMethod(LoxObject& object, LoxFunction* method, LoxObject receiver) {
+    // replaces object by the bound method, which is returned when it's a
+    // getter the caller has to run.
+    LoxFunction* bound = interpreter.createFunction(method, receiver);
+    object = LoxObject(bound, &interpreter);
+    return bound->isGetter() ? bound : nullptr;
+}
+
+// the frame stack may be reallocated by any call, pointers are reloaded after it.
+#define LOAD_FRAME() \
+    do { \
+        frame = &frames.back(); \
+        chunk = frame->chunk; \
+        ip = frame->ip; \
+        stack = interpreter.m_stack.data(); \
+        slots = stack + frame->fp; \
+    } while (false)
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#ifdef LOX_PROFILE_OPCODES
+#define FETCH() (profile.record(*ip), READ_BYTE())
+#else
+#define FETCH() READ_BYTE()
+#endif
+
+// Each instruction jumps straight to the next one's handler through the
+// dispatch table when labels as values are available, otherwise the loop
+// goes back to a switch.
+#ifdef LOX_COMPUTED_GOTO
+#define OPCODE_LABEL(op) &&label_##op,
+#define DISPATCH_TABLE(opcodes, count) \
+    static void* dispatch[] = { opcodes(OPCODE_LABEL) }; \
+    static_assert(sizeof(dispatch) / sizeof(dispatch[0]) == count, "an opcode has no handler")
+#define DISPATCH_LOOP() goto *dispatch[FETCH()];
+#define CASE(op) label_##op:
+// jumps out of a handler without destroying its locals: a handler keeps
+// the ones with a destructor in a block of their own, left before NEXT.
+#define NEXT() goto *dispatch[FETCH()]
+#define UNKNOWN_OPCODE() if (false)
+#else
+#define DISPATCH_TABLE(opcodes, count)
+#define DISPATCH_LOOP() for (;;) switch (FETCH())
+#define CASE(op) case op:
+#define NEXT() continue
+#define UNKNOWN_OPCODE() default:
+#endif
+
+LoxObject VM::run(size_t entry) {
+    Frame* frame;
+    Chunk* chunk;
+    const uint8_t* ip;
+    LoxObject* stack;
+    LoxObject* slots;
+    LoxObject* sp;
+    DISPATCH_TABLE(LOX_OPCODES, OP_COUNT);
+#ifdef LOX_PROFILE_OPCODES
+    auto& profile = stackProfile;
+#endif
+
+#define LOAD_STACK() \
+    do { \
+        LOAD_FRAME(); \
+        sp = stack + interpreter.m_sp; \
+    } while (false)
+#define SAVE_FRAME() \
+    do { \
+        frame->ip = ip; \
+        interpreter.m_sp = sp - stack; \
+    } while (false)
+#define BINARY_OP(value) \
+    do { \
+        sp[-2] = value; \
+        --sp; \
+    } while (false)
+// the opcode of the instruction being run, for its site to rewrite.
+#define OPCODE() chunk->code[ip - chunk->code.data() - 1]
+// A generic operator records the types of its operands, then computes value.
+#define GENERIC_BINARY_OP(value) \
+    do { \
+        uint8_t& op = OPCODE(); \
+        TypeFeedback& site = chunk->feedback[READ_SHORT()]; \
+        LoxType left = sp[-2].getLoxObjectType(); \
+        LoxType right = sp[-1].getLoxObjectType(); \
+        observe(op, site, left, right, specialization(site.generic, left, right)); \
+        BINARY_OP(value); \
+    } while (false)
+// A guard failed before the operands were read, the last of which is the
+// site: the generic instruction is dispatched next, on the same stack, as
+// if it had been there all along.
+#define DEOPTIMIZE(operands) \
+    do { \
+        --ip; \
+        deoptimize(chunk->code[ip - chunk->code.data()], \
+                   chunk->feedback[(ip[2 * (operands) - 1] << 8) | ip[2 * (operands)]]); \
+    } while (false)
+#define NUMBERS() \
+    (sp[-2].getLoxObjectType() == LoxType::Number && sp[-1].getLoxObjectType() == LoxType::Number)
+#define NUMBER_OP(value) \
+    if (NUMBERS()) { \
+        double a = sp[-2].getNumber(), b = sp[-1].getNumber(); \
+        ip += 2; \
+        BINARY_OP(LoxObject(value)); \
+    } else DEOPTIMIZE(1)
+// back to the tree walker, which still has the locals of the frame.
+#define LEAVE_LOOP() \
+    do { \
+        for (LoxObject* p = slots + chunk->frameSize; p < slots + chunk->frameSize + chunk->maxStack; p++) { \
+            *p = LoxObject(); \
+        } \
+        interpreter.m_sp = frame->fp + chunk->frameSize; \
+        frames.pop_back(); \
+        return LoxObject(); \
+    } while (false)
+
+    LOAD_STACK();
+    DISPATCH_LOOP() {
+        CASE(OP_CONSTANT) *sp++ = chunk->constants[READ_SHORT()]; NEXT();
+        CASE(OP_NIL) *sp++ = LoxObject(); NEXT();
+        CASE(OP_TRUE) *sp++ = LoxObject(true); NEXT();
+        CASE(OP_FALSE) *sp++ = LoxObject(false); NEXT();
+        CASE(OP_POP) --sp; NEXT();
+        CASE(OP_GET_LOCAL) *sp++ = slots[READ_SHORT()]; NEXT();
+        CASE(OP_SET_LOCAL) slots[READ_SHORT()] = sp[-1]; NEXT();
+        CASE(OP_GET_UPVALUE) {
+            Upvalue& upvalue = *frame->function->getUpvalues()[READ_SHORT()];
+            *sp++ = upvalue.open ? stack[upvalue.slot] : upvalue.closed;
+            NEXT();
+        }
+        CASE(OP_SET_UPVALUE) {
+            Upvalue& upvalue = *frame->function->getUpvalues()[READ_SHORT()];
+            (upvalue.open ? stack[upvalue.slot] : upvalue.closed) = sp[-1];
+            NEXT();
+        }
+        CASE(OP_GET_GLOBAL) {
+            uint16_t global = READ_SHORT();
+            *sp++ = interpreter.globals.get(global, chunk->names[READ_SHORT()]);
+            NEXT();
+        }
+        CASE(OP_DEFINE_GLOBAL) interpreter.globals.define(READ_SHORT(), *--sp); NEXT();
+        CASE(OP_SET_GLOBAL) {
+            uint16_t global = READ_SHORT();
+            interpreter.globals.get(global, chunk->names[READ_SHORT()]) = sp[-1];
+            NEXT();
+        }
+        CASE(OP_GET_PROPERTY) {
+            uint8_t& op = OPCODE();
+            const Token& name = chunk->names[READ_SHORT()];
+            TypeFeedback& site = chunk->feedback[READ_SHORT()];
+            LoxType type = sp[-1].getLoxObjectType();
+            bool field = false;
+            LoxFunction* getter = getProperty(sp[-1], name, &field);
+            observe(op, site, type, LoxType::Nil, field ? OP_GET_FIELD : OP_COUNT);
+            if (getter) {
+                SAVE_FRAME();
+                callFunction(getter, sp - stack, sp - stack - 1, false);
+                LOAD_STACK();
+            }
+            NEXT();
+        }
+        CASE(OP_SET_PROPERTY) {
+            uint8_t& op = OPCODE();
+            const Token& name = chunk->names[READ_SHORT()];
+            TypeFeedback& site = chunk->feedback[READ_SHORT()];
+            LoxType type = sp[-2].getLoxObjectType();
+            observe(op, site, type, LoxType::Nil, type == LoxType::Instance ? OP_SET_FIELD : OP_COUNT);
+            BINARY_OP(sp[-2].set(name, sp[-1]));
+            NEXT();
+        }
+        CASE(OP_GET_SUPER) {
+            const Token& name = chunk->names[READ_SHORT()];
+            LoxFunction* method = (*--sp).getLoxClass()->findMethod(name.lexeme);
+            if (!method) {
+                throw std::runtime_error("Undefined property '" + name.lexeme + "'.");
+            }
+            if (LoxFunction* getter = bindMethod(sp[-1], method, sp[-1])) {
+                SAVE_FRAME();
+                callFunction(getter, sp - stack, sp - stack - 1, false);
+                LOAD_STACK();
+            }
+            NEXT();
+        }
+        CASE(OP_EQUAL) GENERIC_BINARY_OP(LoxObject(sp[-2] == sp[-1])); NEXT();
+        CASE(OP_NOT_EQUAL) GENERIC_BINARY_OP(LoxObject(sp[-2] != sp[-1])); NEXT();
+        CASE(OP_GREATER) GENERIC_BINARY_OP(LoxObject(sp[-2] > sp[-1])); NEXT();
+        CASE(OP_GREATER_EQUAL) GENERIC_BINARY_OP(LoxObject(sp[-2] >= sp[-1])); NEXT();
+        CASE(OP_LESS) GENERIC_BINARY_OP(LoxObject(sp[-2] < sp[-1])); NEXT();
+        CASE(OP_LESS_EQUAL) GENERIC_BINARY_OP(LoxObject(sp[-2] <= sp[-1])); NEXT();
+        CASE(OP_ADD) GENERIC_BINARY_OP(sp[-2] + sp[-1]); NEXT();
+        CASE(OP_SUBTRACT) GENERIC_BINARY_OP(sp[-2] - sp[-1]); NEXT();
+        CASE(OP_MULTIPLY) GENERIC_BINARY_OP(sp[-2] * sp[-1]); NEXT();
+        CASE(OP_DIVIDE) GENERIC_BINARY_OP(sp[-2] / sp[-1]); NEXT();
+        CASE(OP_NOT) sp[-1] = !sp[-1]; NEXT();
+        CASE(OP_NEGATE) sp[-1] = -sp[-1]; NEXT();
+        CASE(OP_PRINT) *interpreter.m_out << *--sp << '\n'; NEXT();
+        CASE(OP_JUMP) {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            NEXT();
+        }
+        CASE(OP_JUMP_IF_FALSE) {
+            uint16_t offset = READ_SHORT();
+            if (!static_cast<bool>(sp[-1])) ip += offset;
+            NEXT();
+        }
+        CASE(OP_JUMP_IF_TRUE) {
+            uint16_t offset = READ_SHORT();
+            if (static_cast<bool>(sp[-1])) ip += offset;
+            NEXT();
+        }
+        CASE(OP_LOOP) {
+            uint16_t offset = READ_SHORT();
+            ip -= offset;
+            // the script's own loops are safe points.
+            if (frames.size() == 1 && !frame->function) interpreter.safePoint();
+            NEXT();
+        }
+        CASE(OP_CALL) {
+            uint8_t& op = OPCODE();
+            size_t argc = READ_SHORT();
+            TypeFeedback& site = chunk->feedback[READ_SHORT()];
+            size_t callee = sp - stack - argc - 1;
+            // the JIT gets its chance at Lox functions in the generic call.
+            LoxObject& function = stack[callee];
+            bool lox = !interpreter.m_jit && function.getLoxObjectType() == LoxType::Callable
+                    && function.getFunction()->asFunction();
+            observe(op, site, function.getLoxObjectType(), LoxType::Nil, lox ? OP_CALL_FUNCTION : OP_COUNT);
+            SAVE_FRAME();
+            if (!callValue(callee, argc)) interpreter.m_sp = callee + 1;
+            LOAD_STACK();
+            NEXT();
+        }
+        CASE(OP_TAIL_CALL) {
+            size_t argc = READ_SHORT();
+            LoxObject& callee = sp[-(long)argc - 1];
+            LoxFunction* function = callee.getLoxObjectType() == LoxType::Callable
+                                  ? callee.getFunction()->asFunction() : nullptr;
+            if (function && function->arity() == argc && frame->function
+                && !frame->construct && frames.size() - 1 > entry) {
+                // the callee takes over the frame: callee and arguments
+                // move down to where the current ones are.
+                interpreter.closeUpvalues(frame->fp);
+                slots[-1] = callee;
+                for (size_t i = 0; i < argc; i++) {
+                    slots[i] = sp[i - argc];
+                }
+                for (LoxObject* p = slots + argc; p < slots + chunk->frameSize + chunk->maxStack; p++) {
+                    *p = LoxObject();
+                }
+                size_t fp = frame->fp;
+                frames.pop_back();
+                callFunction(function, fp, fp - 1, false);
+            } else {
+                // the return instruction that follows gets the result.
+                size_t callee = sp - stack - argc - 1;
+                SAVE_FRAME();
+                if (!callValue(callee, argc)) interpreter.m_sp = callee + 1;
+            }
+            LOAD_STACK();
+            NEXT();
+        }
+        CASE(OP_CLOSURE) {
+            Function* declaration = chunk->functions[READ_SHORT()];
+            *sp++ = LoxObject(interpreter.createFunction(declaration), &interpreter);
+            NEXT();
+        }
+        CASE(OP_CLASS) {
+            Class* declaration = chunk->classes[READ_SHORT()];
+            sp[-1] = interpreter.createClass(*declaration, sp[-1]);
+            NEXT();
+        }
+        CASE(OP_CLOSE_UPVALUES) interpreter.closeUpvalues(frame->fp + READ_SHORT()); NEXT();
+        CASE(OP_RETURN) {
+            {
+                LoxObject result = *--sp;
+                if (frame->loop) {
+                    // a return statement, which the tree walker carries on with.
+                    interpreter.m_returning = true;
+                    interpreter.m_returnValue = result;
+                    LEAVE_LOOP();
+                }
+                if (frame->construct) result = slots[frame->function->arity()];
+                interpreter.closeUpvalues(frame->fp);
+
+                // the slots of the frame, and the callee below them, are released.
+                bool done = frames.size() - 1 == entry;
+                LoxObject* base = done ? slots : slots - 1;
+                for (LoxObject* p = base; p < slots + chunk->frameSize + chunk->maxStack; p++) {
+                    *p = LoxObject();
+                }
+                frames.pop_back();
+                if (done) {
+                    interpreter.m_sp = base - stack;
+                    return result;
+                }
+                *base = result;
+                interpreter.m_sp = base + 1 - stack;
+                interpreter.m_fp = frames.back().fp;
+                interpreter.m_closure = frames.back().function;
+            }
+            LOAD_STACK();
+            NEXT();
+        }
+        CASE(OP_END_LOOP) LEAVE_LOOP();
+        CASE(OP_COMPARE_LOCAL_JUMP) {
+            LoxObject& local = slots[READ_SHORT()];
+            LoxObject& constant = chunk->constants[READ_SHORT()];
+            uint16_t comparison = READ_SHORT();
+            uint16_t offset = READ_SHORT();
+            if (!compare(comparison, local, constant)) ip += offset;
+            NEXT();
+        }
+        CASE(OP_INCREMENT_LOCAL) {
+            LoxObject& local = slots[READ_SHORT()];
+            local = local + chunk->constants[READ_SHORT()];
+            NEXT();
+        }
+        CASE(OP_ADD_LOCALS) {
+            LoxObject& left = slots[READ_SHORT()];
+            *sp++ = left + slots[READ_SHORT()];
+            NEXT();
+        }
+        CASE(OP_INVOKE) {
+            const Token& name = chunk->names[READ_SHORT()];
+            size_t argc = READ_SHORT();
+            size_t callee = sp - stack - argc - 1;
+            SAVE_FRAME();
+            if (!invoke(callee, name, argc)) interpreter.m_sp = callee + 1;
+            LOAD_STACK();
+            NEXT();
+        }
+        CASE(OP_CHECK_FUNCTION) {
+            Function* function = chunk->functions[READ_SHORT()];
+            uint16_t offset = READ_SHORT();
+            if (!Inliner::isFunction(sp[-1], function)) ip += offset;
+            NEXT();
+        }
+        CASE(OP_CHECK_METHOD) {
+            const Token& name = chunk->names[READ_SHORT()];
+            Function* function = chunk->functions[READ_SHORT()];
+            uint16_t offset = READ_SHORT();
+            if (!Inliner::isMethod(sp[-1], name, function)) ip += offset;
+            NEXT();
+        }
+        CASE(OP_START_HOISTED) {
+            While* loop = chunk->loops[READ_SHORT()];
+            LoxObject flag = interpreter.hoists(*loop) ? LoxObject() : LoxObject(false);
+            for (int slot : loop->hoisted) {
+                slots[slot + 1] = flag;
+            }
+            NEXT();
+        }
+        CASE(OP_GET_HOISTED) {
+            // the value, in the slot right below its flag.
+            size_t slot = READ_SHORT();
+            uint16_t offset = READ_SHORT();
+            if (static_cast<bool>(slots[slot + 1])) {
+                *sp++ = slots[slot];
+                ip += offset;
+            }
+            NEXT();
+        }
+        CASE(OP_SET_HOISTED) {
+            // a false flag leaves the value to be computed again.
+            size_t slot = READ_SHORT();
+            if (slots[slot + 1].getLoxObjectType() == LoxType::Nil) {
+                slots[slot] = sp[-1];
+                slots[slot + 1] = LoxObject(true);
+            }
+            NEXT();
+        }
+        CASE(OP_EQUAL_NUMBERS) NUMBER_OP(a == b); NEXT();
+        CASE(OP_NOT_EQUAL_NUMBERS) NUMBER_OP(!(a == b)); NEXT();
+        CASE(OP_GREATER_NUMBERS) NUMBER_OP(!(a < b || a == b)); NEXT();
+        CASE(OP_GREATER_EQUAL_NUMBERS) NUMBER_OP(!(a < b)); NEXT();
+        CASE(OP_LESS_NUMBERS) NUMBER_OP(a < b); NEXT();
+        CASE(OP_LESS_EQUAL_NUMBERS) NUMBER_OP(a < b || a == b); NEXT();
+        CASE(OP_ADD_NUMBERS) NUMBER_OP(a + b); NEXT();
+        CASE(OP_SUBTRACT_NUMBERS) NUMBER_OP(a - b); NEXT();
+        CASE(OP_MULTIPLY_NUMBERS) NUMBER_OP(a * b); NEXT();
+        CASE(OP_DIVIDE_NUMBERS) {
+            // the generic operator reports divisions by zero.
+            if (NUMBERS() && sp[-1].getNumber() != 0.) {
+                ip += 2;
+                BINARY_OP(LoxObject(sp[-2].getNumber() / sp[-1].getNumber()));
+            } else DEOPTIMIZE(1);
+            NEXT();
+        }
+        CASE(OP_ADD_STRINGS) {
+            if (sp[-2].getLoxObjectType() == LoxType::String && sp[-1].getLoxObjectType() == LoxType::String) {
+                ip += 2;
+                sp[-2] += sp[-1];
+                --sp;
+            } else DEOPTIMIZE(1);
+            NEXT();
+        }
+        CASE(OP_GET_FIELD) {
+            {
+                LoxObject value;
+                if (sp[-1].getLoxObjectType() == LoxType::Instance
+                    && sp[-1].getInstance()->getField(chunk->names[(ip[0] << 8) | ip[1]].lexeme, value)) {
+                    ip += 4;
+                    sp[-1] = value;
+                } else DEOPTIMIZE(2);
+            }
+            NEXT();
+        }
+        CASE(OP_SET_FIELD) {
+            if (sp[-2].getLoxObjectType() == LoxType::Instance) {
+                const Token& name = chunk->names[READ_SHORT()];
+                ip += 2;
+                BINARY_OP(sp[-2].getInstance()->set(name, sp[-1]));
+            } else DEOPTIMIZE(2);
+            NEXT();
+        }
+        CASE(OP_CALL_FUNCTION) {
+            size_t argc = (ip[0] << 8) | ip[1];
+            LoxObject& callee = sp[-(long)argc - 1];
+            LoxFunction* function = callee.getLoxObjectType() == LoxType::Callable
+                                  ? callee.getFunction()->asFunction() : nullptr;
+            if (function && function->arity() == argc) {
+                ip += 4;
+                SAVE_FRAME();
+                callFunction(function, sp - stack - argc, sp - stack - argc - 1, false);
+                LOAD_STACK();
+            } else DEOPTIMIZE(2);
+            NEXT();
+        }
+        UNKNOWN_OPCODE() {
+            throw std::logic_error("Unknown opcode.");
+        }
+    }
+
+#undef LOAD_STACK
+#undef SAVE_FRAME
+#undef BINARY_OP
+#undef OPCODE
+#undef GENERIC_BINARY_OP
+#undef DEOPTIMIZE
+#undef NUMBERS
+#undef NUMBER_OP
+#undef LEAVE_LOOP
+}
+
+LoxObject VM::runRegisters(size_t entry) {
+    Frame* frame;
+    Chunk* chunk;
+    const uint8_t* ip;
+    LoxObject* stack;
+    LoxObject* slots;
+    DISPATCH_TABLE(LOX_REGISTER_OPCODES, R_COUNT);
+#ifdef LOX_PROFILE_OPCODES
+    auto& profile = registerProfile;
+#endif
+
+    // register frames keep m_sp at their top, only ip has to be saved.
+#define SAVE_IP() (frame->ip = ip)
+#define TOP(frame) ((frame).fp + (frame).chunk->frameSize + (frame).chunk->maxStack)
+#define REGISTER_OP(value) \
+    do { \
+        size_t a = READ_SHORT(); \
+        LoxObject& b = slots[READ_SHORT()]; \
+        LoxObject& c = slots[READ_SHORT()]; \
+        slots[a] = value; \
+    } while (false)
+#define UNARY_REGISTER_OP(value) \
+    do { \
+        size_t a = READ_SHORT(); \
+        LoxObject& b = slots[READ_SHORT()]; \
+        slots[a] = value; \
+    } while (false)
+// a getter is called with the bound method right above the caller's
+// temporaries and returns into register A.
+#define CALL_GETTER(getter, a, method) \
+    do { \
+        size_t top = TOP(*frame); \
+        SAVE_IP(); \
+        callFunction(getter, top + 1, frame->fp + a, false); \
+        interpreter.m_stack[top] = method; \
+        LOAD_FRAME(); \
+    } while (false)
+
+    LOAD_FRAME();
+    DISPATCH_LOOP() {
+        CASE(R_LOADK) {
+            size_t a = READ_SHORT();
+            slots[a] = chunk->constants[READ_SHORT()];
+            NEXT();
+        }
+        CASE(R_LOADNIL) slots[READ_SHORT()] = LoxObject(); NEXT();
+        CASE(R_LOADTRUE) slots[READ_SHORT()] = LoxObject(true); NEXT();
+        CASE(R_LOADFALSE) slots[READ_SHORT()] = LoxObject(false); NEXT();
+        CASE(R_MOVE) {
+            size_t a = READ_SHORT();
+            slots[a] = slots[READ_SHORT()];
+            NEXT();
+        }
+        CASE(R_GETUPVAL) {
+            size_t a = READ_SHORT();
+            Upvalue& upvalue = *frame->function->getUpvalues()[READ_SHORT()];
+            slots[a] = upvalue.open ? stack[upvalue.slot] : upvalue.closed;
+            NEXT();
+        }
+        CASE(R_SETUPVAL) {
+            Upvalue& upvalue = *frame->function->getUpvalues()[READ_SHORT()];
+            (upvalue.open ? stack[upvalue.slot] : upvalue.closed) = slots[READ_SHORT()];
+            NEXT();
+        }
+        CASE(R_GETGLOBAL) {
+            size_t a = READ_SHORT();
+            uint16_t global = READ_SHORT();
+            slots[a] = interpreter.globals.get(global, chunk->names[READ_SHORT()]);
+            NEXT();
+        }
+        CASE(R_DEFGLOBAL) {
+            uint16_t global = READ_SHORT();
+            interpreter.globals.define(global, slots[READ_SHORT()]);
+            NEXT();
+        }
+        CASE(R_SETGLOBAL) {
+            uint16_t global = READ_SHORT();
+            const Token& name = chunk->names[READ_SHORT()];
+            interpreter.globals.get(global, name) = slots[READ_SHORT()];
+            NEXT();
+        }
+        CASE(R_GETPROP) {
+            {
+                size_t a = READ_SHORT();
+                LoxObject value = slots[READ_SHORT()];
+                const Token& name = chunk->names[READ_SHORT()];
+                if (LoxFunction* getter = getProperty(value, name)) {
+                    CALL_GETTER(getter, a, value);
+                } else {
+                    slots[a] = value;
+                }
+            }
+            NEXT();
+        }
+        CASE(R_SETPROP) {
+            LoxObject& object = slots[READ_SHORT()];
+            const Token& name = chunk->names[READ_SHORT()];
+            object.set(name, slots[READ_SHORT()]);
+            NEXT();
+        }
+        CASE(R_GETSUPER) {
+            {
+                size_t a = READ_SHORT();
+                LoxObject receiver = slots[READ_SHORT()];
+                LoxClass* superclass = slots[READ_SHORT()].getLoxClass();
+                const Token& name = chunk->names[READ_SHORT()];
+                LoxFunction* method = superclass->findMethod(name.lexeme);
+                if (!method) {
+                    throw std::runtime_error("Undefined property '" + name.lexeme + "'.");
+                }
+                LoxObject value;
+                if (LoxFunction* getter = bindMethod(value, method, receiver)) {
+                    CALL_GETTER(getter, a, value);
+                } else {
+                    slots[a] = value;
+                }
+            }
+            NEXT();
+        }
+        CASE(R_EQ) REGISTER_OP(LoxObject(b == c)); NEXT();
+        CASE(R_NE) REGISTER_OP(LoxObject(b != c)); NEXT();
+        CASE(R_GT) REGISTER_OP(LoxObject(b > c)); NEXT();
+        CASE(R_GE) REGISTER_OP(LoxObject(b >= c)); NEXT();
+        CASE(R_LT) REGISTER_OP(LoxObject(b < c)); NEXT();
+        CASE(R_LE) REGISTER_OP(LoxObject(b <= c)); NEXT();
+        CASE(R_ADD) REGISTER_OP(b + c); NEXT();
+        CASE(R_SUB) REGISTER_OP(b - c); NEXT();
+        CASE(R_MUL) REGISTER_OP(b * c); NEXT();
+        CASE(R_DIV) REGISTER_OP(b / c); NEXT();
+        CASE(R_NOT) UNARY_REGISTER_OP(!b); NEXT();
+        CASE(R_NEG) UNARY_REGISTER_OP(-b); NEXT();
+        CASE(R_PRINT) *interpreter.m_out << slots[READ_SHORT()] << '\n'; NEXT();
+        CASE(R_JMP) {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            NEXT();
+        }
+        CASE(R_JMPF) {
+            LoxObject& condition = slots[READ_SHORT()];
+            uint16_t offset = READ_SHORT();
+            if (!static_cast<bool>(condition)) ip += offset;
+            NEXT();
+        }
+        CASE(R_JMPT) {
+            LoxObject& condition = slots[READ_SHORT()];
+            uint16_t offset = READ_SHORT();
+            if (static_cast<bool>(condition)) ip += offset;
+            NEXT();
+        }
+        CASE(R_LOOP) {
+            uint16_t offset = READ_SHORT();
+            ip -= offset;
+            if (frames.size() == 1 && !frame->function) interpreter.safePoint();
+            NEXT();
+        }
+        CASE(R_CALL) {
+            size_t a = READ_SHORT();
+            size_t argc = READ_SHORT();
+            SAVE_IP();
+            callValue(frame->fp + a, argc);
+            LOAD_FRAME();
+            NEXT();
+        }
+        CASE(R_TAILCALL) {
+            size_t a = READ_SHORT();
+            size_t argc = READ_SHORT();
+            LoxObject& callee = slots[a];
+            LoxFunction* function = callee.getLoxObjectType() == LoxType::Callable
+                                  ? callee.getFunction()->asFunction() : nullptr;
+            if (function && function->arity() == argc && frame->function
+                && !frame->construct && frames.size() - 1 > entry) {
+                // same as the stack engine: the callee and its arguments
+                // take over the slots of the current frame.
+                interpreter.closeUpvalues(frame->fp);
+                slots[-1] = callee;
+                for (size_t i = 0; i < argc; i++) {
+                    slots[i] = slots[a + 1 + i];
+                }
+                for (LoxObject* p = slots + argc; p < stack + TOP(*frame); p++) {
+                    *p = LoxObject();
+                }
+                size_t fp = frame->fp;
+                size_t ret = frame->ret;
+                frames.pop_back();
+                callFunction(function, fp, ret, false);
+            } else {
+                // the return instruction that follows gets the result from A.
+                SAVE_IP();
+                callValue(frame->fp + a, argc);
+            }
+            LOAD_FRAME();
+            NEXT();
+        }
+        CASE(R_CLOSURE) {
+            size_t a = READ_SHORT();
+            Function* declaration = chunk->functions[READ_SHORT()];
+            slots[a] = LoxObject(interpreter.createFunction(declaration), &interpreter);
+            NEXT();
+        }
+        CASE(R_CLASS) {
+            size_t a = READ_SHORT();
+            Class* declaration = chunk->classes[READ_SHORT()];
+            slots[a] = interpreter.createClass(*declaration, slots[a]);
+            NEXT();
+        }
+        CASE(R_CLOSE) interpreter.closeUpvalues(frame->fp + READ_SHORT()); NEXT();
+        CASE(R_RETURN) {
+            {
+                LoxObject result = slots[READ_SHORT()];
+                if (frame->construct) result = slots[frame->function->arity()];
+                interpreter.closeUpvalues(frame->fp);
+
+                bool done = frames.size() - 1 == entry;
+                LoxObject* base = done ? slots : slots - 1;
+                for (LoxObject* p = base; p < stack + TOP(*frame); p++) {
+                    *p = LoxObject();
+                }
+                size_t ret = frame->ret;
+                frames.pop_back();
+                if (done) {
+                    interpreter.m_sp = base - stack;
+                    return result;
+                }
+                stack[ret] = result;
+                interpreter.m_sp = TOP(frames.back());
+                interpreter.m_fp = frames.back().fp;
+                interpreter.m_closure = frames.back().function;
+            }
+            LOAD_FRAME();
+            NEXT();
+        }
+        UNKNOWN_OPCODE() {
+            throw std::logic_error("Unknown opcode.");
+        }
+    }
+
+#undef SAVE_IP
+#undef TOP
+#undef REGISTER_OP
+#undef UNARY_REGISTER_OP
+#undef CALL_GETTER
+}
+
+#undef LOAD_FRAME
+#undef READ_BYTE
+#undef READ_SHORT
+#undef FETCH
+#undef OPCODE_LABEL
+#undef DISPATCH_TABLE
+#undef DISPATCH_LOOP
+#undef CASE
+#undef NEXT
+#undef UNKNOWN_OPCODE
+
+} // namespace lox